@@ -0,0 +1,163 @@
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+
+#include "cec/endian_types.hpp"
+#include "cec/message_box.hpp"
+#include "cec/module_filter.hpp"
+#include "cec/transfer.hpp"
+
+using namespace streetpass;
+
+namespace {
+const cec::key_type KEY = {0x10, 0x32, 0x54, 0x76, 0x98, 0xba, 0xdc, 0xfe};
+
+// first_tid lets two filters overlap on some titles only
+cec::ModuleFilter make_filter(unsigned titles, cec::tid_type first_tid) {
+  using TitleFilter = cec::ModuleFilter::TitleFilter;
+
+  cec::ModuleFilter filter(KEY);
+  std::vector<TitleFilter> title_filters;
+  for (unsigned i = 0; i < titles; ++i)
+    title_filters.emplace_back(first_tid + i, cec::SendMode::SEND_RECV,
+                               std::vector<TitleFilter::MVE>{});
+  filter.title_filters().filters(title_filters);
+  return filter;
+}
+
+// a message box file holding count messages of body_size bytes
+cec::bytes make_messages(unsigned count, std::uint32_t body_size) {
+  cec::bytes box;
+  for (unsigned m = 0; m < count; ++m) {
+    std::uint32_t header_size = cec::MessageHeader::fixed_byte_size();
+    std::uint32_t message_size =
+        header_size + body_size + cec::MessageHeader::HMAC_SIZE;
+    cec::bytes header(header_size, 0);
+    header[0] = header[1] = 0x60;
+    std::memcpy(&header[4], &message_size, sizeof(message_size));
+    std::memcpy(&header[8], &header_size, sizeof(header_size));
+    std::memcpy(&header[12], &body_size, sizeof(body_size));
+
+    box.insert(box.end(), header.begin(), header.end());
+    box.insert(box.end(), body_size + cec::MessageHeader::HMAC_SIZE,
+               std::uint8_t(m));
+  }
+  return box;
+}
+}  // namespace
+
+static void BM_ModuleFilterParse(benchmark::State& state) {
+  cec::bytes data = cec::bytes(make_filter(state.range(0), 0x00020000));
+  for (auto _ : state)
+    benchmark::DoNotOptimize(cec::Parser<cec::ModuleFilter>::from_bytes(data));
+
+  state.SetBytesProcessed(state.iterations() * data.size());
+}
+BENCHMARK(BM_ModuleFilterParse)->Arg(0)->Arg(1)->Arg(4)->Arg(8);
+
+static void BM_ModuleFilterSerialize(benchmark::State& state) {
+  auto filter = make_filter(state.range(0), 0x00020000);
+  for (auto _ : state) benchmark::DoNotOptimize(cec::bytes(filter));
+
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ModuleFilterSerialize)->Arg(0)->Arg(1)->Arg(4)->Arg(8);
+
+// the peer shares only its last title with us, the worst case of a match
+static void BM_ModuleFilterMatch(benchmark::State& state) {
+  unsigned titles = state.range(0);
+  auto own = make_filter(titles, 0x00020000);
+  auto peer = make_filter(titles, 0x00020000 + titles - 1);
+  for (auto _ : state) benchmark::DoNotOptimize(own.match(peer));
+
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ModuleFilterMatch)->Arg(1)->Arg(4)->Arg(8);
+
+static void BM_ModuleFilterMismatch(benchmark::State& state) {
+  unsigned titles = state.range(0);
+  auto own = make_filter(titles, 0x00020000);
+  auto peer = make_filter(titles, 0x00030000);
+  for (auto _ : state) benchmark::DoNotOptimize(own.match(peer));
+
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ModuleFilterMismatch)->Arg(1)->Arg(4)->Arg(8);
+
+template <typename E>
+static void BM_EndianRead(benchmark::State& state) {
+  using value_type = decltype(E() + 0);
+  std::vector<E> values(1024);
+  std::iota(values.begin(), values.end(), value_type(1));
+
+  for (auto _ : state) {
+    value_type sum = 0;
+    for (E const& v : values) sum += v;
+    benchmark::DoNotOptimize(sum);
+  }
+
+  state.SetItemsProcessed(state.iterations() * values.size());
+}
+BENCHMARK_TEMPLATE(BM_EndianRead, cec::endian_types::u16le);
+BENCHMARK_TEMPLATE(BM_EndianRead, cec::endian_types::u32le);
+BENCHMARK_TEMPLATE(BM_EndianRead, cec::endian_types::u32be);
+BENCHMARK_TEMPLATE(BM_EndianRead, cec::endian_types::u64le);
+
+template <typename E>
+static void BM_EndianWrite(benchmark::State& state) {
+  using value_type = decltype(E() + 0);
+  std::vector<E> values(1024);
+
+  for (auto _ : state) {
+    for (std::size_t i = 0; i < values.size(); ++i)
+      values[i] = value_type(i);
+    benchmark::ClobberMemory();
+  }
+
+  state.SetItemsProcessed(state.iterations() * values.size());
+}
+BENCHMARK_TEMPLATE(BM_EndianWrite, cec::endian_types::u32le);
+BENCHMARK_TEMPLATE(BM_EndianWrite, cec::endian_types::u32be);
+
+static void BM_MessageViewParse(benchmark::State& state) {
+  unsigned count = state.range(0);
+  cec::bytes box = make_messages(count, 1024);
+
+  for (auto _ : state) {
+    InputMemoryStream stream(box.data(), box.size());
+    for (unsigned m = 0; m < count; ++m)
+      benchmark::DoNotOptimize(cec::MessageView::from_stream(stream));
+  }
+
+  state.SetBytesProcessed(state.iterations() * box.size());
+}
+BENCHMARK(BM_MessageViewParse)->Arg(1)->Arg(16);
+
+static void BM_MessageStreamParser(benchmark::State& state) {
+  std::size_t chunk = state.range(0);
+  cec::bytes box = make_messages(16, 1024);
+
+  for (auto _ : state) {
+    std::size_t body = 0;
+    cec::MessageStreamParser parser(
+        {nullptr, [&body](const std::uint8_t*, std::size_t n) { body += n; },
+         nullptr});
+    for (std::size_t offset = 0; offset < box.size(); offset += chunk)
+      parser.feed(box.data() + offset, std::min(chunk, box.size() - offset));
+    benchmark::DoNotOptimize(body);
+  }
+
+  state.SetBytesProcessed(state.iterations() * box.size());
+}
+BENCHMARK(BM_MessageStreamParser)->Arg(64)->Arg(1500);
+
+static void BM_Crc32(benchmark::State& state) {
+  cec::bytes data(state.range(0), 0xa5);
+  for (auto _ : state)
+    benchmark::DoNotOptimize(cec::crc32(data.data(), data.size()));
+
+  state.SetBytesProcessed(state.iterations() * data.size());
+}
+BENCHMARK(BM_Crc32)->Arg(1024)->Arg(64 * 1024);
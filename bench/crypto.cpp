@@ -0,0 +1,200 @@
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+
+#include "crypto/ccmp.hpp"
+#include "crypto/crypto.hpp"
+#include "crypto/key_cache.hpp"
+#include "crypto/key_deriver.hpp"
+#include "fake_kernel.hpp"
+#include "nl80211/commands.hpp"
+
+using namespace streetpass;
+
+namespace {
+const std::array<std::uint8_t, 16> NORMAL_KEY = {
+    0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77,
+    0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff};
+const std::array<std::uint8_t, 17> CECD_KEY = {
+    0x0f, 0x1e, 0x2d, 0x3c, 0x4b, 0x5a, 0x69, 0x78, 0x87,
+    0x96, 0xa5, 0xb4, 0xc3, 0xd2, 0xe1, 0xf0, 0x01};
+
+crypto::KeyDeriver::peer_tuple make_peer(std::uint32_t i) {
+  crypto::KeyDeriver::peer_tuple peer = {
+      {0x10, 0x32, 0x54, 0x76, 0x98, 0xba, 0xdc, 0xfe},
+      {0x40, 0xf4, 0x07, 0x00, 0x00, 0x01},
+      {0x01, 0x23, 0x45, 0x67, 0x89, 0xab, 0xcd, 0xef},
+      {0x40, 0xf4, 0x07, 0x00, 0x00, 0x02}};
+  std::copy_n(reinterpret_cast<std::uint8_t*>(&i), sizeof(i),
+              peer.client_mac.begin() + 2);
+  return peer;
+}
+
+void load_keys() {
+  crypto::load_normal_key(NORMAL_KEY);
+  crypto::load_cecd_key(CECD_KEY);
+}
+
+template <std::size_t N>
+std::string write_key_file(std::string const& name,
+                           std::array<std::uint8_t, N> const& key) {
+  auto path = std::filesystem::temp_directory_path() / name;
+  std::ofstream f(path, std::ios::binary | std::ios::trunc);
+  f.write(reinterpret_cast<const char*>(key.data()), key.size());
+  return path.string();
+}
+}  // namespace
+
+static void BM_StreetpassCcmpKey(benchmark::State& state) {
+  load_keys();
+  auto peer = make_peer(0);
+  for (auto _ : state)
+    benchmark::DoNotOptimize(crypto::streetpass_ccmp_key(
+        peer.master_key, peer.master_mac, peer.client_key, peer.client_mac));
+
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_StreetpassCcmpKey);
+
+static void BM_KeyCacheHit(benchmark::State& state) {
+  load_keys();
+  crypto::KeyCache cache(1024);
+  auto peer = make_peer(0);
+  for (auto _ : state)
+    benchmark::DoNotOptimize(cache.streetpass_ccmp_key(
+        peer.master_key, peer.master_mac, peer.client_key, peer.client_mac));
+
+  state.SetItemsProcessed(state.iterations());
+  state.counters["hit_ratio"] = double(cache.hits()) / state.iterations();
+}
+BENCHMARK(BM_KeyCacheHit);
+
+static void BM_KeyDeriverDerive(benchmark::State& state) {
+  crypto::KeyDeriver deriver(NORMAL_KEY, CECD_KEY);
+  auto peer = make_peer(0);
+  for (auto _ : state) benchmark::DoNotOptimize(deriver.derive(peer));
+
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_KeyDeriverDerive);
+
+static void BM_KeyDeriverDeriveMany(benchmark::State& state) {
+  crypto::KeyDeriver deriver(NORMAL_KEY, CECD_KEY);
+  std::vector<crypto::KeyDeriver::peer_tuple> peers;
+  for (std::int64_t i = 0; i < state.range(0); i++)
+    peers.push_back(make_peer(i));
+
+  for (auto _ : state) benchmark::DoNotOptimize(deriver.derive_many(peers));
+
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_KeyDeriverDeriveMany)->RangeMultiplier(4)->Range(1, 1024);
+
+static void BM_CcmpDecryptMany(benchmark::State& state) {
+  crypto::CcmpEngine engine(NORMAL_KEY);
+
+  // QoS data frames with a 1500 bytes payload
+  std::vector<std::vector<std::uint8_t>> plaintexts(state.range(0));
+  std::vector<crypto::ccmp_frame> frames;
+  for (auto& p : plaintexts) {
+    p.assign(26 + crypto::CcmpEngine::HEADER_SIZE + 1500 +
+                 crypto::CcmpEngine::MIC_SIZE,
+             0xa5);
+    p[0] = 0x88;
+    p[1] = 0x00;
+    frames.push_back({p.data(), p.size(), frames.size() + 1, 0, false});
+  }
+  engine.encrypt_many(frames);
+  auto ciphertexts = plaintexts;
+
+  for (auto _ : state) {
+    state.PauseTiming();
+    plaintexts = ciphertexts;
+    for (std::size_t i = 0; i < frames.size(); i++)
+      frames[i].data = plaintexts[i].data();
+    state.ResumeTiming();
+
+    benchmark::DoNotOptimize(engine.decrypt_many(frames));
+  }
+
+  state.SetBytesProcessed(state.iterations() * state.range(0) * 1500);
+}
+BENCHMARK(BM_CcmpDecryptMany)->RangeMultiplier(4)->Range(1, 256);
+
+static void BM_LoadNormalKeyFromMemory(benchmark::State& state) {
+  for (auto _ : state) crypto::load_normal_key(NORMAL_KEY);
+}
+BENCHMARK(BM_LoadNormalKeyFromMemory);
+
+static void BM_LoadNormalKeyFromFile(benchmark::State& state) {
+  auto path = write_key_file("streetpass_bench_normal_key.bin", NORMAL_KEY);
+  for (auto _ : state) crypto::load_normal_key(path);
+
+  std::filesystem::remove(path);
+}
+BENCHMARK(BM_LoadNormalKeyFromFile);
+
+static void BM_LoadCecdKeyFromMemory(benchmark::State& state) {
+  for (auto _ : state) crypto::load_cecd_key(CECD_KEY);
+}
+BENCHMARK(BM_LoadCecdKeyFromMemory);
+
+static void BM_LoadCecdKeyFromFile(benchmark::State& state) {
+  auto path = write_key_file("streetpass_bench_cecd_key.bin", CECD_KEY);
+  for (auto _ : state) crypto::load_cecd_key(path);
+
+  std::filesystem::remove(path);
+}
+BENCHMARK(BM_LoadCecdKeyFromFile);
+
+static void BM_CryptoContextFromFiles(benchmark::State& state) {
+  auto normal_path =
+      write_key_file("streetpass_bench_normal_key.bin", NORMAL_KEY);
+  auto cecd_path = write_key_file("streetpass_bench_cecd_key.bin", CECD_KEY);
+  for (auto _ : state)
+    benchmark::DoNotOptimize(
+        crypto::CryptoContext::from_files(normal_path, cecd_path));
+
+  std::filesystem::remove(normal_path);
+  std::filesystem::remove(cecd_path);
+}
+BENCHMARK(BM_CryptoContextFromFiles);
+
+// Installs then removes the pairwise keys of a batch of peers with the
+// pipelined nl80211::commands, one datagram per batch, including the round-
+// trip to the fake kernel.
+static void BM_PairwiseKeyBatch(benchmark::State& state) {
+  constexpr std::uint32_t CIPHER_CCMP_128 = 0x000fac04;
+
+  bench::fake_kernel();
+  nl80211::Socket nlsock;
+  static std::uint32_t if_idx =
+      nl80211::commands::new_interface(nlsock, 0, NL80211_IFTYPE_ADHOC,
+                                       "benchkeys0")
+          .index;
+
+  crypto::CryptoContext ctx(NORMAL_KEY, CECD_KEY);
+  std::vector<nl80211::pairwise_key> keys;
+  for (std::int64_t i = 0; i < state.range(0); ++i) {
+    auto peer = make_peer(i);
+    auto key = ctx.streetpass_ccmp_key(peer.master_key, peer.master_mac,
+                                       peer.client_key, peer.client_mac);
+    keys.push_back({peer.client_mac, 0, {key.begin(), key.end()}});
+  }
+
+  for (auto _ : state) {
+    auto added = nl80211::commands::new_keys(nlsock, if_idx, CIPHER_CCMP_128,
+                                             keys);
+    auto removed = nl80211::commands::del_keys(nlsock, if_idx, keys);
+    if (std::count(added.begin(), added.end(), 0) != state.range(0) ||
+        std::count(removed.begin(), removed.end(), 0) != state.range(0)) {
+      state.SkipWithError("the kernel rejected a key");
+      break;
+    }
+  }
+
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_PairwiseKeyBatch)->Arg(1)->Arg(16)->Arg(64);
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "nl80211/fake_kernel.hpp"
+
+namespace streetpass::bench {
+// The fake kernel of the cases that measure netlink round-trips, installed
+// as the transport of every socket created after the first call. It stays
+// alive until exit, so it outlives the sockets of the static objects built
+// on top of it.
+inline nl80211::FakeKernel& fake_kernel() {
+  static nl80211::FakeKernel kernel;
+  static bool installed = [] {
+    nl80211::set_transport_factory(kernel.factory());
+    return true;
+  }();
+  (void)installed;
+  return kernel;
+}
+}  // namespace streetpass::bench
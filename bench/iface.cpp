@@ -0,0 +1,114 @@
+#include <benchmark/benchmark.h>
+#include <tins/tins.h>
+
+#include "cec/module_filter.hpp"
+#include "iface/physical.hpp"
+#include "iface/streetpass.hpp"
+#include "fake_kernel.hpp"
+
+using namespace streetpass;
+
+namespace {
+using iface::StreetpassInterface;
+
+// a probe request as sent by a scanning 3DS sharing one title
+std::vector<std::uint8_t> make_streetpass_probereq() {
+  using TitleFilter = cec::ModuleFilter::TitleFilter;
+
+  cec::ModuleFilter filter({0x10, 0x32, 0x54, 0x76, 0x98, 0xba, 0xdc, 0xfe});
+  filter.title_filters().filters({TitleFilter(
+      0x00020800, cec::SendMode::SEND_RECV, std::vector<TitleFilter::MVE>{})});
+
+  cec::bytes module_filter_bytes = cec::bytes(filter);
+  cec::bytes vendor_specific_data;
+  vendor_specific_data.push_back(0x01);
+  vendor_specific_data.insert(vendor_specific_data.end(),
+                              module_filter_bytes.begin(),
+                              module_filter_bytes.end());
+
+  Tins::Dot11ProbeRequest probereq(Tins::HWAddress<6>::broadcast,
+                                   "40:f4:07:00:00:02");
+  probereq.ssid(StreetpassInterface::SSID);
+  probereq.supported_rates(StreetpassInterface::SUPPORTED_RATES);
+  probereq.vendor_specific(Tins::Dot11ManagementFrame::vendor_specific_type(
+      StreetpassInterface::OUI, vendor_specific_data));
+  return probereq.serialize();
+}
+
+// what most of the probe requests seen on a busy channel look like
+std::vector<std::uint8_t> make_other_probereq() {
+  Tins::Dot11ProbeRequest probereq(Tins::HWAddress<6>::broadcast,
+                                   "02:00:00:00:01:00");
+  probereq.ssid("home-wifi");
+  probereq.supported_rates(StreetpassInterface::SUPPORTED_RATES);
+  return probereq.serialize();
+}
+
+// A StreetPass interface set up on the fake kernel, shared by the pipeline
+// cases. It stays alive until exit, like the sockets of the info cache.
+StreetpassInterface& fake_interface() {
+  static std::unique_ptr<StreetpassInterface> iface = [] {
+    bench::fake_kernel();
+    return iface::PhysicalInterface(0)
+        .setup_streetpass_interface_async("streetpass0")
+        .get();
+  }();
+  return *iface;
+}
+}  // namespace
+
+// the classification done on every frame received while scanning
+static void BM_IsStreetpassScanProbereq(
+    benchmark::State& state, std::vector<std::uint8_t> (*make_frame)()) {
+  auto data = make_frame();
+  for (auto _ : state) {
+    Tins::Dot11ProbeRequest probereq(data.data(), data.size());
+    benchmark::DoNotOptimize(
+        StreetpassInterface::is_streetpass_scan_probereq(probereq));
+  }
+
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK_CAPTURE(BM_IsStreetpassScanProbereq, streetpass,
+                  make_streetpass_probereq);
+BENCHMARK_CAPTURE(BM_IsStreetpassScanProbereq, other, make_other_probereq);
+
+// Probe requests through the whole scan path, from the netlink socket to the
+// module filter match, with the fake kernel injecting as fast as the scan
+// loop reads.
+static void BM_ScanPipeline(benchmark::State& state) {
+  nl80211::FakeKernel& kernel = bench::fake_kernel();
+  StreetpassInterface& iface = fake_interface();
+
+  cec::ModuleFilter own({0x01, 0x23, 0x45, 0x67, 0x89, 0xab, 0xcd, 0xef});
+  own.title_filters().filters({cec::ModuleFilter::TitleFilter(
+      0x00020800, cec::SendMode::SEND_RECV,
+      std::vector<cec::ModuleFilter::TitleFilter::MVE>{})});
+
+  // the StreetPass one last, so the scan ends on the last frame of a batch
+  std::vector<nl80211::FakeKernel::frame> frames(state.range(1),
+                                                 make_other_probereq());
+  frames.push_back(make_streetpass_probereq());
+
+  std::int64_t batch = state.range(0);
+  std::int64_t matched = 0;
+  for (auto _ : state) {
+    std::int64_t received = 0;
+    kernel.inject(iface.get_id(), frames, 0, batch);
+    iface.scan_with_cb(0, [&](Tins::HWAddress<6> const&,
+                              cec::ModuleFilter const& other) {
+      matched += own.match(other);
+      return ++received < batch / std::int64_t(frames.size());
+    });
+    kernel.stop_injecting(iface.get_id());
+  }
+
+  state.SetItemsProcessed(state.iterations() * batch);
+  state.counters["matched"] = matched;
+}
+// batch of frames, then unrelated probe requests per StreetPass one
+BENCHMARK(BM_ScanPipeline)
+    ->Args({1024, 0})
+    ->Args({1024, 3})
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
@@ -0,0 +1,13 @@
+#include <benchmark/benchmark.h>
+
+// Tags the results with the library version so that JSON outputs of two
+// releases (--benchmark_out_format=json) can be told apart when diffed.
+int main(int argc, char** argv) {
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) return 1;
+
+  benchmark::AddCustomContext("streetpass_version", STREETPASS_VERSION);
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
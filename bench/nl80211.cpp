@@ -0,0 +1,94 @@
+#include <benchmark/benchmark.h>
+
+#include <memory>
+#include <vector>
+
+#include "nl80211/message.hpp"
+
+using namespace streetpass;
+
+namespace {
+using nl_msg_ptr = std::unique_ptr<nl_msg, decltype(&nlmsg_free)>;
+
+// arbitrary, only the kernel resolves the real one
+constexpr int FAMILY_ID = 0x1c;
+
+// an NL80211_CMD_FRAME event as delivered for a received probe request
+nl_msg_ptr make_frame_event(std::size_t frame_size) {
+  nl_msg_ptr msg(nlmsg_alloc(), nlmsg_free);
+  genlmsg_put(msg.get(), 0, 0, FAMILY_ID, 0, 0, NL80211_CMD_FRAME, 0);
+  nla_put_u32(msg.get(), NL80211_ATTR_WIPHY, 0);
+  nla_put_u32(msg.get(), NL80211_ATTR_IFINDEX, 3);
+  nla_put_u64(msg.get(), NL80211_ATTR_WDEV, 1);
+  nla_put_u32(msg.get(), NL80211_ATTR_WIPHY_FREQ, 2412);
+  nla_put_u32(msg.get(), NL80211_ATTR_RX_SIGNAL_DBM, -42);
+
+  std::vector<std::uint8_t> frame(frame_size, 0xdd);
+  nla_put(msg.get(), NL80211_ATTR_FRAME, frame.size(), frame.data());
+  return msg;
+}
+
+// a wiphy dump fragment: two bands with their channels, nested twice
+nl_msg_ptr make_wiphy_bands() {
+  nl_msg_ptr msg(nlmsg_alloc(), nlmsg_free);
+  genlmsg_put(msg.get(), 0, 1, FAMILY_ID, 0, NLM_F_MULTI,
+              NL80211_CMD_NEW_WIPHY, 0);
+  nla_put_u32(msg.get(), NL80211_ATTR_WIPHY, 0);
+
+  nlattr* bands = nla_nest_start(msg.get(), NL80211_ATTR_WIPHY_BANDS);
+  for (int band = 0; band < 2; ++band) {
+    nlattr* b = nla_nest_start(msg.get(), band);
+    nlattr* freqs = nla_nest_start(msg.get(), NL80211_BAND_ATTR_FREQS);
+    for (int channel = 0; channel < 14; ++channel) {
+      nlattr* f = nla_nest_start(msg.get(), channel);
+      nla_put_u32(msg.get(), NL80211_FREQUENCY_ATTR_FREQ,
+                  (band ? 5180 : 2412) + channel * (band ? 20 : 5));
+      nla_put_u32(msg.get(), NL80211_FREQUENCY_ATTR_MAX_TX_POWER, 2000);
+      nla_nest_end(msg.get(), f);
+    }
+    nla_nest_end(msg.get(), freqs);
+    nla_nest_end(msg.get(), b);
+  }
+  nla_nest_end(msg.get(), bands);
+  return msg;
+}
+}  // namespace
+
+// what every scan handler does first with a received frame
+static void BM_AttributesFrameEvent(benchmark::State& state) {
+  auto msg = make_frame_event(state.range(0));
+  for (auto _ : state) {
+    nl80211::Attributes attrs(msg.get());
+    benchmark::DoNotOptimize(
+        attrs.get<std::vector<std::uint8_t>>(NL80211_ATTR_FRAME).value());
+  }
+
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_AttributesFrameEvent)->Arg(64)->Arg(256);
+
+static void BM_AttributesNested(benchmark::State& state) {
+  auto msg = make_wiphy_bands();
+  for (auto _ : state) {
+    nl80211::Attributes attrs(msg.get());
+    auto bands =
+        attrs.get<nl80211::Attributes>(NL80211_ATTR_WIPHY_BANDS).value();
+
+    std::uint32_t sum = 0;
+    for (int band : bands.types()) {
+      auto freqs = bands.get<nl80211::Attributes>(band)
+                       .value()
+                       .get<nl80211::Attributes>(NL80211_BAND_ATTR_FREQS)
+                       .value();
+      for (int channel : freqs.types())
+        sum += freqs.get<nl80211::Attributes>(channel)
+                   .value()
+                   .get<std::uint32_t>(NL80211_FREQUENCY_ATTR_FREQ)
+                   .value();
+    }
+    benchmark::DoNotOptimize(sum);
+  }
+
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_AttributesNested);
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace streetpass::cec {
+
+// Read-only mapping of a whole file, e.g. a message box file to parse in
+// place with MessageView or MessageStreamParser.
+//
+// A mapping keeps reflecting the pages of the file: a writer that truncates
+// and rewrites it in place shows through, and reads past the new end of
+// file raise SIGBUS. Files below copy_below bytes are read into memory
+// instead, larger ones must be replaced by renaming a new file into place.
+class MappedFile {
+ public:
+  explicit MappedFile(std::string const& path, std::size_t copy_below = 0);
+  ~MappedFile();
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+  MappedFile(MappedFile&& other) noexcept;
+  MappedFile& operator=(MappedFile&& other) noexcept;
+
+  const uint8_t* data() const { return m_data; }
+  std::size_t size() const { return m_size; }
+
+ private:
+  const uint8_t* m_data = nullptr;
+  std::size_t m_size = 0;
+  std::unique_ptr<uint8_t[]> m_copy;  // m_data points here when copied
+};
+}  // namespace streetpass::cec
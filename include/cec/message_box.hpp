@@ -0,0 +1,191 @@
+#pragma once
+
+#include <tins/memory_helpers.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <vector>
+
+#include "cec/cec.hpp"
+#include "cec/endian_types.hpp"
+
+using namespace streetpass::cec::endian_types;
+using Tins::Memory::InputMemoryStream;
+
+// Layouts of the CEC message box files, as documented by citra's cecd
+// implementation: an MBoxInfo____ file holds a box info header followed by
+// the header of every message in the box, and each message is a header,
+// optional extra headers, the body and an HMAC-SHA256 of the message.
+namespace streetpass::cec {
+
+class MessageHeader : public ICecFormat {
+ public:
+  using message_id_type = std::array<uint8_t, 8>;
+
+  static MessageHeader from_stream(InputMemoryStream& stream);
+
+  uint32_t message_size() const;
+  uint32_t header_size() const;
+  uint32_t body_size() const;
+  tid_type title_id() const;
+  uint32_t batch_id() const;
+  message_id_type message_id() const;
+  uint32_t version() const;
+  uint8_t send_method() const;
+  bool is_unopen() const;
+  bool is_new() const;
+  uint64_t sender_id() const;
+  uint8_t forward_count() const;
+
+  constexpr unsigned byte_size() const { return sizeof(message_header); }
+  constexpr static unsigned fixed_byte_size() {
+    return sizeof(message_header);
+  }
+  explicit operator bytes() const;
+  friend std::ostream& operator<<(std::ostream& s, const MessageHeader& h);
+
+  static constexpr uint16_t MAGIC = 0x6060;
+  static constexpr unsigned HMAC_SIZE = 0x20;
+
+ private:
+  MessageHeader() = default;
+
+  struct timestamp {
+    u32le a;
+    u32le b;
+    u32le c;
+  } __attribute__((__packed__));
+
+  struct message_header {
+    u16le magic;
+    u8 padding0[2];
+    u32le message_size;  // header_size + body_size + HMAC_SIZE
+    u32le header_size;
+    u32le body_size;
+    u32le title_id;
+    u32le title_id2;
+    u32le batch_id;
+    u32le unknown_id;
+    u8 message_id[8];
+    u32le version;
+    u8 message_id2[8];
+    u8 flag;
+    u8 send_method;
+    u8 is_unopen;
+    u8 is_new;
+    u64le sender_id;
+    u64le sender_id2;
+    timestamp send_time;
+    timestamp recv_time;
+    timestamp create_time;
+    u8 forward_count;
+    u8 user_data;
+    u8 padding1[2];
+  } __attribute__((__packed__));
+
+  static_assert(sizeof(message_header) == 0x70);
+
+  message_header m_internal;
+};
+
+class MessageBoxInfo : public ICecFormat {
+ public:
+  static MessageBoxInfo from_stream(InputMemoryStream& stream);
+
+  uint32_t max_box_size() const;
+  uint32_t box_size() const;
+  uint32_t max_message_num() const;
+  uint32_t message_num() const;
+  uint32_t max_batch_size() const;
+  uint32_t max_message_size() const;
+  std::vector<MessageHeader> const& message_headers() const;
+
+  unsigned byte_size() const;
+  explicit operator bytes() const;
+  friend std::ostream& operator<<(std::ostream& s, const MessageBoxInfo& b);
+
+  static constexpr uint16_t MAGIC = 0x6262;
+
+ private:
+  MessageBoxInfo() = default;
+
+  struct box_info_header {
+    u16le magic;
+    u8 padding[2];
+    u32le box_info_size;
+    u32le max_box_size;
+    u32le box_size;
+    u32le max_message_num;
+    u32le message_num;
+    u32le max_batch_size;
+    u32le max_message_size;
+  } __attribute__((__packed__));
+
+  static_assert(sizeof(box_info_header) == 0x20);
+
+  box_info_header m_internal;
+  std::vector<MessageHeader> m_headers;
+};
+
+// A whole message parsed in place: only the header is copied, the body and
+// the HMAC point into the parsed buffer, which must outlive the view.
+class MessageView : public ICecFormat {
+ public:
+  static MessageView from_stream(InputMemoryStream& stream);
+
+  MessageHeader const& header() const { return m_header; }
+  const uint8_t* body() const { return m_body; }
+  uint32_t body_size() const { return m_header.body_size(); }
+  const uint8_t* hmac() const { return m_hmac; }
+
+  unsigned byte_size() const { return m_header.message_size(); }
+  // copies the message, including its extra headers
+  explicit operator bytes() const;
+
+ private:
+  MessageView(MessageHeader const& header, const uint8_t* begin)
+      : m_header(header), m_begin(begin) {}
+
+  MessageHeader m_header;
+  const uint8_t* m_begin;
+  const uint8_t* m_body = nullptr;
+  const uint8_t* m_hmac = nullptr;
+};
+
+// Incremental parser for a sequence of messages arriving in arbitrary
+// chunks. Bodies are handed out as they come, straight from the fed
+// buffers, so a message is never held in memory as a whole.
+class MessageStreamParser {
+ public:
+  struct handlers {
+    std::function<void(MessageHeader const&)> on_header;
+    std::function<void(const uint8_t*, std::size_t)> on_body;
+    std::function<void(std::array<uint8_t, MessageHeader::HMAC_SIZE> const&)>
+        on_end;
+  };
+
+  MessageStreamParser(handlers h, uint32_t max_message_size = 0x100000);
+
+  void feed(const uint8_t* data, std::size_t size);
+  void feed(bytes const& data) { feed(data.data(), data.size()); }
+
+  // true when no message is partially parsed
+  bool idle() const { return m_state == state::HEADER && m_filled == 0; }
+
+ private:
+  enum class state { HEADER, EXTRA_HEADER, BODY, HMAC };
+
+  handlers m_handlers;
+  uint32_t m_max_message_size;
+
+  state m_state = state::HEADER;
+  std::array<uint8_t, MessageHeader::fixed_byte_size()> m_header_buffer;
+  std::array<uint8_t, MessageHeader::HMAC_SIZE> m_hmac;
+  std::size_t m_filled = 0;
+  std::size_t m_remaining = 0;
+  uint32_t m_body_size = 0;
+};
+}  // namespace streetpass::cec
@@ -212,6 +212,8 @@ class ModuleFilter : public ICecFormat {
     unsigned count() const;
     unsigned byte_size() const;
     bool match(FilterList<T> const& other) const;
+    // number of our filters matched by at least one of the other list
+    unsigned match_count(FilterList<T> const& other) const;
     explicit operator bytes() const;
 
     template <class E>
@@ -234,6 +236,7 @@ class ModuleFilter : public ICecFormat {
   void key(key_type const& k);
 
   bool match(ModuleFilter const& other) const;
+  unsigned matching_titles(ModuleFilter const& other) const;
   unsigned byte_size() const;
   explicit operator bytes() const;
   friend std::ostream& operator<<(std::ostream& s, const ModuleFilter& l);
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "cec/cec.hpp"
+#include "cec/mapped_file.hpp"
+#include "cec/message_box.hpp"
+#include "cec/module_filter.hpp"
+
+namespace streetpass::cec {
+
+// Outgoing messages of every title, served straight from memory-mapped
+// files. The root directory follows the 3DS CEC layout: one directory per
+// title named after its 8 hex digits title id, holding an OutBox__ directory
+// with one file per message next to the MBoxInfo____ and OBIndex_____ files.
+//
+// Boxes are immutable snapshots: a change on disk, reported by inotify,
+// rebuilds the box of that title only. Messages below COPY_BELOW bytes are
+// copied into memory, so peers still sending from the previous snapshot
+// never see a rewrite. Larger ones stay mapped and must be replaced by
+// renaming a new file into place, never rewritten in place: the old
+// mapping would show the new contents, or fault past their end.
+class Outbox {
+ public:
+  struct message {
+    std::string name;
+    std::shared_ptr<const MappedFile> file;
+    MessageView view;  // points into file
+    timespec mtime;
+  };
+
+  struct title_box {
+    tid_type title_id;
+    std::vector<message> messages;
+  };
+
+  Outbox(std::string const& root);
+  ~Outbox();
+
+  Outbox(const Outbox&) = delete;
+  Outbox& operator=(const Outbox&) = delete;
+  Outbox(Outbox&&) = delete;
+  Outbox& operator=(Outbox&&) = delete;
+
+  // nullptr when the title has no outbox
+  std::shared_ptr<const title_box> find(tid_type title_id) const;
+  // boxes of the titles listed in the peer title filters
+  std::vector<std::shared_ptr<const title_box>> for_peer(
+      ModuleFilter const& peer) const;
+  std::size_t size() const;
+
+  // inotify descriptor, readable when process_events() has work to do
+  int get_fd() const { return m_inotify_fd; }
+  // applies the pending changes without blocking, returns the number of
+  // titles reloaded
+  std::size_t process_events();
+
+  static const std::string OUTBOX_DIR;
+  static constexpr std::size_t COPY_BELOW = 64 * 1024;
+
+ private:
+  std::string m_root;
+  int m_inotify_fd = -1;
+  int m_root_wd = -1;
+
+  mutable std::mutex m_mutex;
+  std::unordered_map<tid_type, std::shared_ptr<const title_box>> m_boxes;
+  std::map<int, tid_type> m_watches;
+  // directory name of each title, the hex digits may be in either case
+  std::map<tid_type, std::string> m_dirs;
+
+  void watch_title(tid_type title_id, std::string const& dir);
+  void reload(tid_type title_id);
+  std::string title_path(tid_type title_id) const;
+};
+}  // namespace streetpass::cec
@@ -0,0 +1,177 @@
+#pragma once
+
+#include <tins/memory_helpers.h>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <vector>
+
+#include "cec/cec.hpp"
+#include "cec/endian_types.hpp"
+
+using namespace streetpass::cec::endian_types;
+using Tins::Memory::InputMemoryStream;
+
+// Transfer of a payload (typically a whole message box) between two
+// associated peers. The payload is cut in fixed size chunks, a window of
+// chunks is kept in flight and the receiver acknowledges cumulatively plus
+// a bitmap of the chunks received past the first hole, so a lost chunk only
+// costs its own retransmission.
+namespace streetpass::cec {
+
+// CRC-32 (IEEE 802.3), pass the previous result to continue a computation
+uint32_t crc32(const uint8_t* data, std::size_t size, uint32_t crc = 0);
+
+class TransferFrame : public ICecFormat {
+ public:
+  enum class type : uint8_t { DATA = 0, ACK = 1 };
+
+  static TransferFrame from_stream(InputMemoryStream& stream);
+
+  // payload must outlive the frame
+  static TransferFrame data(uint32_t transfer_id, uint32_t index,
+                            uint32_t chunk_count, uint16_t chunk_size,
+                            uint32_t payload_crc, const uint8_t* payload,
+                            uint16_t length);
+  static TransferFrame ack(uint32_t transfer_id, uint32_t next_index,
+                           uint32_t sack);
+
+  type frame_type() const;
+  uint32_t transfer_id() const;
+  // DATA: index of the chunk, ACK: first chunk not received yet
+  uint32_t index() const;
+  uint32_t chunk_count() const;
+  uint16_t chunk_size() const;
+  // ACK: bit i set when chunk index() + 1 + i was received
+  uint32_t sack() const;
+  uint32_t chunk_crc() const;
+  uint32_t payload_crc() const;
+  uint16_t length() const;
+  // points into the parsed buffer
+  const uint8_t* payload() const { return m_payload; }
+
+  unsigned byte_size() const { return sizeof(frame_header) + length(); }
+  explicit operator bytes() const;
+  friend std::ostream& operator<<(std::ostream& s, const TransferFrame& f);
+
+  static constexpr uint16_t MAGIC = 0x7474;
+  static constexpr unsigned SACK_BITS = 32;
+
+ private:
+  TransferFrame() = default;
+
+  struct frame_header {
+    u16le magic;
+    u8 type;
+    u8 padding;
+    u32le transfer_id;
+    u32le index;
+    u32le chunk_count;
+    u32le sack;
+    u32le chunk_crc;
+    u32le payload_crc;
+    u16le length;
+    u16le chunk_size;
+  } __attribute__((__packed__));
+
+  static_assert(sizeof(frame_header) == 0x20);
+
+  frame_header m_internal;
+  const uint8_t* m_payload = nullptr;
+};
+
+class TransferSender {
+ public:
+  using send_fn = std::function<void(bytes const&)>;
+  using clock = std::chrono::steady_clock;
+
+  // payload is sent in place and must outlive the sender
+  TransferSender(uint32_t transfer_id, const uint8_t* payload,
+                 std::size_t size, send_fn send, uint16_t chunk_size = 1024,
+                 std::size_t window = 16,
+                 std::chrono::milliseconds retransmit_timeout =
+                     std::chrono::milliseconds(50));
+
+  // sends new chunks while the window allows it and retransmits the ones
+  // unacknowledged for too long
+  void pump(clock::time_point now = clock::now());
+  // handles an ACK of this transfer, other frames are ignored
+  void on_frame(TransferFrame const& frame);
+  // the link dropped: everything in flight is considered lost and the next
+  // pump() restarts from the first unacknowledged chunk
+  void resume();
+
+  bool done() const noexcept { return m_base == m_chunk_count; }
+  uint32_t chunk_count() const noexcept { return m_chunk_count; }
+  uint32_t acked() const noexcept { return m_acked_count; }
+  std::size_t in_flight() const noexcept { return m_in_flight; }
+  uint64_t retransmissions() const noexcept { return m_retransmissions; }
+
+ private:
+  uint32_t m_transfer_id;
+  const uint8_t* m_payload;
+  std::size_t m_size;
+  send_fn m_send;
+  uint16_t m_chunk_size;
+  std::size_t m_window;
+  std::chrono::milliseconds m_retransmit_timeout;
+
+  uint32_t m_chunk_count;
+  uint32_t m_payload_crc;
+  std::vector<bool> m_acked;
+  // time_point() when the chunk is not in flight
+  std::vector<clock::time_point> m_sent;
+  uint32_t m_base = 0;  // first unacknowledged chunk
+  uint32_t m_next = 0;  // first chunk never sent
+  uint32_t m_acked_count = 0;
+  std::size_t m_in_flight = 0;
+  uint64_t m_retransmissions = 0;
+
+  void send_chunk(uint32_t index, clock::time_point now);
+  void mark_acked(uint32_t index);
+};
+
+class TransferReceiver {
+ public:
+  using send_fn = std::function<void(bytes const&)>;
+
+  TransferReceiver(uint32_t transfer_id, send_fn send,
+                   std::size_t max_size = 0x100000, unsigned ack_every = 4);
+
+  // handles a DATA frame of this transfer, other frames are ignored; chunks
+  // failing their CRC are dropped and will be retransmitted
+  void on_frame(TransferFrame const& frame);
+  // sends the current acknowledgement, e.g. on a timer or after the link
+  // came back so the sender resumes where the receiver stands
+  void flush_ack();
+
+  bool done() const noexcept {
+    return m_chunk_count != 0 && m_next == m_chunk_count;
+  }
+  // complete payload once done()
+  bytes const& payload() const noexcept { return m_payload; }
+  uint32_t received() const noexcept { return m_received_count; }
+
+ private:
+  uint32_t m_transfer_id;
+  send_fn m_send;
+  std::size_t m_max_size;
+  unsigned m_ack_every;
+
+  uint32_t m_chunk_count = 0;
+  uint16_t m_chunk_size = 0;
+  uint32_t m_payload_crc = 0;
+  bytes m_payload;
+  std::vector<bool> m_received;
+  uint32_t m_next = 0;  // first chunk not received
+  uint32_t m_received_count = 0;
+  unsigned m_unacked = 0;
+  // CRC of the chunks before m_next, advanced as holes get filled
+  uint32_t m_running_crc = 0;
+
+  uint32_t sack() const;
+};
+}  // namespace streetpass::cec
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cryptopp/aes.h>
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+namespace streetpass::crypto {
+// An 802.11 MPDU, without FCS, protected with CCMP: MAC header, 8 bytes CCMP
+// header, payload and 8 bytes MIC. Frames are processed in place.
+struct ccmp_frame {
+  std::uint8_t* data;
+  std::size_t size;
+  // packet number and key id, read on decryption and written on encryption
+  std::uint64_t pn;
+  std::uint8_t key_id;
+  // set once the frame has been authenticated (or protected)
+  bool valid;
+};
+
+// Userspace AES-CCMP (CCM with an 8 bytes MIC, RFC 3610 / IEEE 802.11i) for
+// offline processing of captured traffic. Batches are processed in lock-step
+// so that the CTR keystream of every frame is produced by one AES call and
+// the CBC-MAC chains of several frames are advanced together, which lets
+// Crypto++ keep the AES-NI pipeline full. Crypto++ may use workspace inside
+// the AES object even from const calls, so a CcmpEngine must not be shared
+// between threads.
+class CcmpEngine {
+ public:
+  static constexpr std::size_t HEADER_SIZE = 8;
+  static constexpr std::size_t MIC_SIZE = 8;
+
+  explicit CcmpEngine(std::array<std::uint8_t, 16> const& temporal_key);
+
+  bool decrypt(ccmp_frame& frame) const;
+  bool encrypt(ccmp_frame& frame) const;
+
+  // returns the number of frames that were authenticated
+  std::size_t decrypt_many(std::vector<ccmp_frame>& frames) const;
+  // payloads must leave room for the CCMP header and the MIC, returns the
+  // number of frames that could be protected
+  std::size_t encrypt_many(std::vector<ccmp_frame>& frames) const;
+
+ private:
+  struct job;
+
+  CryptoPP::AES::Encryption m_aes;
+
+  void process(std::vector<ccmp_frame>& frames, std::size_t first,
+               std::size_t count, bool encrypt) const;
+  void cbc_mac(std::vector<job>& jobs) const;
+  void keystream(std::vector<job>& jobs,
+                 std::vector<std::uint8_t>& stream) const;
+};
+}  // namespace streetpass::crypto
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cryptopp/aes.h>
+
+#include <array>
+#include <cstdint>
+#include <string>
+
+namespace streetpass::crypto {
+// Immutable key material together with its AES key schedule. Every member
+// function is const and derivations do not touch shared mutable state, so a
+// single context can be used from several threads at once.
+class CryptoContext {
+ public:
+  CryptoContext(std::array<std::uint8_t, 16> const& normal_key,
+                std::array<std::uint8_t, 17> const& cecd_key);
+
+  static CryptoContext from_files(std::string const& normal_key_path,
+                                  std::string const& cecd_key_path);
+
+  std::array<std::uint8_t, 16> const& normal_key() const noexcept {
+    return m_normal_key;
+  }
+  std::array<std::uint8_t, 17> const& cecd_key() const noexcept {
+    return m_cecd_key;
+  }
+
+  std::array<std::uint8_t, 16> streetpass_ccmp_key(
+      std::array<std::uint8_t, 8> const& master_key,
+      std::array<std::uint8_t, 6> const& master_mac,
+      std::array<std::uint8_t, 8> const& client_key,
+      std::array<std::uint8_t, 6> const& client_mac) const;
+
+ private:
+  std::array<std::uint8_t, 16> m_normal_key;
+  std::array<std::uint8_t, 17> m_cecd_key;
+  // only used through the const ProcessBlock()
+  CryptoPP::AES::Encryption m_aes;
+};
+}  // namespace streetpass::crypto
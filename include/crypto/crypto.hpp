@@ -2,9 +2,18 @@
 
 #include <array>
 #include <cstdint>
+#include <memory>
 #include <string>
 
+#include "crypto/context.hpp"
+
 namespace streetpass::crypto {
+// The free functions below operate on a process-wide default context. The
+// loaders publish a new context instead of mutating key material in place,
+// so derivations running on other threads keep a consistent snapshot.
+std::shared_ptr<const CryptoContext> default_context();
+void set_default_context(std::shared_ptr<const CryptoContext> context);
+
 void load_normal_key(std::string const& filepath);
 void load_normal_key(std::array<std::uint8_t, 16> const& key);
 
@@ -16,4 +25,7 @@ std::array<std::uint8_t, 16> streetpass_ccmp_key(
     std::array<std::uint8_t, 6> const& master_mac,
     std::array<std::uint8_t, 8> const& client_key,
     std::array<std::uint8_t, 6> const& client_mac);
+
+// incremented every time key material is loaded
+std::uint64_t key_generation();
 }  // namespace streetpass::crypto
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+namespace streetpass::crypto {
+// Bounded LRU cache of streetpass_ccmp_key() results, keyed by the
+// (master_key, master_mac, client_key, client_mac) tuple. Entries derived
+// with previously loaded key material are dropped on the next lookup.
+class KeyCache {
+ public:
+  using ccmp_key_type = std::array<std::uint8_t, 16>;
+
+  explicit KeyCache(std::size_t capacity);
+
+  KeyCache(const KeyCache&) = delete;
+  KeyCache& operator=(const KeyCache&) = delete;
+  KeyCache(KeyCache&&) = delete;
+  KeyCache& operator=(KeyCache&&) = delete;
+
+  ccmp_key_type streetpass_ccmp_key(
+      std::array<std::uint8_t, 8> const& master_key,
+      std::array<std::uint8_t, 6> const& master_mac,
+      std::array<std::uint8_t, 8> const& client_key,
+      std::array<std::uint8_t, 6> const& client_mac);
+
+  std::size_t capacity() const noexcept { return m_capacity; }
+  std::size_t size() const;
+  std::uint64_t hits() const noexcept { return m_hits; }
+  std::uint64_t misses() const noexcept { return m_misses; }
+  void clear();
+
+ private:
+  using tuple_type = std::array<std::uint8_t, 28>;
+
+  struct tuple_hash {
+    std::size_t operator()(tuple_type const& t) const noexcept;
+  };
+
+  using entry_list = std::list<std::pair<tuple_type, ccmp_key_type>>;
+
+  mutable std::mutex m_mutex;
+  std::size_t m_capacity;
+  std::uint64_t m_generation;
+  // most recently used first
+  entry_list m_entries;
+  std::unordered_map<tuple_type, entry_list::iterator, tuple_hash> m_index;
+  std::atomic<std::uint64_t> m_hits;
+  std::atomic<std::uint64_t> m_misses;
+
+  void check_generation();
+};
+}  // namespace streetpass::crypto
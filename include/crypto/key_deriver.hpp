@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cryptopp/aes.h>
+#include <cryptopp/hmac.h>
+#include <cryptopp/sha.h>
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "crypto/context.hpp"
+
+namespace streetpass::crypto {
+// CCMP key derivation with the HMAC-SHA1 and AES key schedules computed once
+// at construction. The HMAC state is reused between derivations, so a
+// KeyDeriver must not be shared between threads.
+class KeyDeriver {
+ public:
+  using ccmp_key_type = std::array<std::uint8_t, 16>;
+
+  struct peer_tuple {
+    std::array<std::uint8_t, 8> master_key;
+    std::array<std::uint8_t, 6> master_mac;
+    std::array<std::uint8_t, 8> client_key;
+    std::array<std::uint8_t, 6> client_mac;
+  };
+
+  // snapshot of the default context key material
+  KeyDeriver();
+  explicit KeyDeriver(CryptoContext const& context);
+  KeyDeriver(std::array<std::uint8_t, 16> const& normal_key,
+             std::array<std::uint8_t, 17> const& cecd_key);
+
+  ccmp_key_type derive(std::array<std::uint8_t, 8> const& master_key,
+                       std::array<std::uint8_t, 6> const& master_mac,
+                       std::array<std::uint8_t, 8> const& client_key,
+                       std::array<std::uint8_t, 6> const& client_mac);
+  ccmp_key_type derive(peer_tuple const& peer);
+  std::vector<ccmp_key_type> derive_many(std::vector<peer_tuple> const& peers);
+
+ private:
+  CryptoPP::HMAC<CryptoPP::SHA1> m_hmac;
+  CryptoPP::AES::Encryption m_aes;
+
+  void hash_peer(peer_tuple const& peer, std::uint8_t* ctr);
+};
+}  // namespace streetpass::crypto
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+
+#include "cec/module_filter.hpp"
+
+namespace streetpass::history {
+
+enum class outcome : std::uint8_t { SEEN = 0, EXCHANGED = 1, FAILED = 2 };
+
+struct encounter {
+  std::uint64_t mac;
+  std::chrono::system_clock::time_point time;
+  std::uint64_t module_filter_hash;
+  outcome result;
+};
+
+// Append-only log of peer encounters, memory-mapped from a single file:
+// a header, a fixed hash index of bucket heads and the records themselves.
+// Each record links to the previous one of its bucket, so the index never
+// needs rebuilding and opening the store costs the same whatever its size.
+//
+// A record is written before the index points to it and only counts once the
+// header record count covers it: a crash mid-append loses that record alone,
+// opening the store unwinds whatever the append had already published.
+// Without flush() this holds for crashes of the process, not of the host,
+// and compact() does not fsync the directory after renaming the new file
+// into place. The file uses the host byte order.
+class PeerStore {
+ private:
+  struct header;
+  struct record;
+
+  std::string m_path;
+  int m_fd = -1;
+  std::uint8_t* m_map = nullptr;
+  std::size_t m_map_size = 0;
+  mutable std::mutex m_mutex;
+
+  void open(std::uint32_t index_capacity);
+  void close() noexcept;
+  void grow();
+
+  header* hdr() const;
+  std::uint32_t* index() const;
+  record* records() const;
+  std::uint32_t committed_head(std::uint64_t mac) const;
+  record const* find(std::uint64_t mac) const;
+
+ public:
+  // index_capacity is only used when the file is created, rounded up to a
+  // power of two
+  PeerStore(std::string const& path, std::uint32_t index_capacity = 4096);
+  ~PeerStore();
+
+  PeerStore(const PeerStore&) = delete;
+  PeerStore& operator=(const PeerStore&) = delete;
+  PeerStore(PeerStore&&) = delete;
+  PeerStore& operator=(PeerStore&&) = delete;
+
+  void append(encounter const& e);
+
+  // latest encounter with the peer
+  std::optional<encounter> last(std::uint64_t mac) const;
+  bool seen_since(std::uint64_t mac,
+                  std::chrono::system_clock::time_point since) const;
+
+  // Rewrites the file with only the latest encounter of every peer met since
+  // keep_since, resizing the index to the number of peers kept.
+  void compact(std::chrono::system_clock::time_point keep_since);
+  // forces the mapped pages to disk
+  void flush();
+
+  std::size_t size() const;
+
+  static std::uint64_t pack_mac(std::array<std::uint8_t, 6> const& mac);
+  static std::uint64_t hash(cec::ModuleFilter const& module_filter);
+};
+}  // namespace streetpass::history
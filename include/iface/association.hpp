@@ -0,0 +1,106 @@
+#pragma once
+
+#include <tins/tins.h>
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <vector>
+
+#include "cec/module_filter.hpp"
+#include "iface/key_slots.hpp"
+#include "iface/proberesp_template.hpp"
+#include "nl80211/socket.hpp"
+#include "nl80211/tx_queue.hpp"
+
+namespace streetpass::iface {
+class StreetpassInterface;
+
+// Pairs with many peers at once from a single receive loop. Every peer moves
+// through its own state machine with its own deadline, so a peer that stops
+// answering only times itself out.
+class AssociationEngine {
+ public:
+  enum class state {
+    PROBE_SEEN,  // scan probe request received, initial response pending
+    RESPONDED,   // initial probe response sent, waiting for the assoc probe
+    KEYING,      // assoc probe received, response and key install pending
+    CONFIRMING,  // key installed, waiting for the TX status of the response
+    ASSOCIATED,
+    FAILED
+  };
+
+  struct result {
+    Tins::HWAddress<6> peer;
+    state final_state;
+    std::chrono::nanoseconds latency;
+  };
+
+  using accept_fn = std::function<bool(Tins::HWAddress<6> const&,
+                                       cec::ModuleFilter const&)>;
+  using key_fn = std::function<KeySlotManager::key_type(
+      Tins::HWAddress<6> const&, Tins::Dot11ProbeRequest const&)>;
+  using result_fn = std::function<bool(result const&)>;
+
+ private:
+  struct peer {
+    state current;
+    cec::ModuleFilter module_filter;
+    std::chrono::steady_clock::time_point start;
+    // receive time of the probe request awaiting our response
+    std::chrono::steady_clock::time_point last_rx;
+    std::chrono::steady_clock::time_point deadline;
+    Tins::Dot11ProbeRequest assoc_probereq;
+  };
+
+  StreetpassInterface& m_iface;
+  ProbeResponseTemplate m_proberesp;
+  key_fn m_key_fn;
+  std::chrono::milliseconds m_peer_timeout;
+  std::size_t m_max_peers;
+
+  nl80211::Socket m_rx_sock;
+  nl80211::TxQueue m_tx;
+  Tins::HWAddress<6> m_own_addr;
+  std::map<Tins::HWAddress<6>, peer> m_peers;
+  std::vector<Tins::HWAddress<6>> m_tx_failed;
+  // peers whose association probe response the radio sent
+  std::vector<Tins::HWAddress<6>> m_tx_confirmed;
+
+  void on_frame(std::vector<std::uint8_t> const& data,
+                std::chrono::steady_clock::time_point rx,
+                accept_fn const& accept);
+  bool advance(result_fn const& on_result);
+  bool finish(Tins::HWAddress<6> const& addr, state final_state,
+              result_fn const& on_result);
+  void send_proberesp(Tins::HWAddress<6> const& addr,
+                      std::chrono::steady_clock::time_point rx, bool confirm);
+  void remove_keys(std::vector<Tins::HWAddress<6>> const& addrs);
+
+ public:
+  AssociationEngine(StreetpassInterface& iface,
+                    cec::ModuleFilter const& module_filter, key_fn key,
+                    std::chrono::milliseconds peer_timeout =
+                        std::chrono::milliseconds(1000),
+                    std::size_t max_peers = 32);
+  ~AssociationEngine();
+
+  AssociationEngine(const AssociationEngine&) = delete;
+  AssociationEngine& operator=(const AssociationEngine&) = delete;
+  AssociationEngine(AssociationEngine&&) = delete;
+  AssociationEngine& operator=(AssociationEngine&&) = delete;
+
+  // Runs the receive loop for at most the given duration. Peers whose scan
+  // probe requests are accepted get associated; on_result is called once per
+  // peer that reaches ASSOCIATED or FAILED and stops the loop when it
+  // returns false. A peer is only ASSOCIATED once the radio sent our
+  // response to its association probe request; when it could not, the key
+  // is removed again and the peer FAILED. Peers still in progress when the
+  // time is up are reported as FAILED too.
+  void run(std::chrono::milliseconds duration, accept_fn const& accept,
+           result_fn const& on_result);
+
+  std::size_t in_progress() const noexcept { return m_peers.size(); }
+};
+}  // namespace streetpass::iface
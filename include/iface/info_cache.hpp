@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "iface/rtnl.hpp"
+#include "nl80211/commands.hpp"
+#include "nl80211/socket.hpp"
+
+namespace streetpass::iface {
+// Process-wide snapshot of wiphy names and virtual interface attributes.
+// The snapshot is kept in sync with the kernel by draining the nl80211
+// "config" multicast group and the rtnetlink link group (netdev renames are
+// only notified there) before every lookup, so that accessors only hit
+// netlink on a cache miss.
+class InfoCache {
+ private:
+  std::mutex m_mutex;
+  nl80211::Socket m_query_sock;
+  nl80211::Socket m_event_sock;
+  rtnl::Socket m_link_sock;
+  std::unordered_map<std::uint32_t, std::string> m_wiphy_names;
+  std::unordered_map<std::uint32_t, nl80211::wiface> m_wifaces;
+
+  InfoCache();
+  void process_events();
+
+ public:
+  InfoCache(const InfoCache&) = delete;
+  InfoCache& operator=(const InfoCache&) = delete;
+  InfoCache(InfoCache&&) = delete;
+  InfoCache& operator=(InfoCache&&) = delete;
+
+  static InfoCache& instance();
+
+  std::string get_wiphy_name(std::uint32_t index);
+  nl80211::wiface get_interface(std::uint32_t if_idx);
+
+  void update(nl80211::wiphy const& w);
+  void update(nl80211::wiface const& w);
+  void invalidate();
+};
+}  // namespace streetpass::iface
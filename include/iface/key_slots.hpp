@@ -0,0 +1,74 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "nl80211/socket.hpp"
+
+namespace streetpass::iface {
+
+// Tracks the pairwise CCMP keys installed on an IBSS interface, one entry per
+// peer. Installs and removals are pipelined in a single netlink batch. Keys
+// always use index 0, which is what 3DS peers expect and all drivers accept
+// without Extended Key ID, so a rekey deletes and reinstalls the key in the
+// same batch.
+class KeySlotManager {
+ public:
+  using mac_type = std::array<std::uint8_t, 6>;
+  using key_type = std::array<std::uint8_t, 16>;
+  using clock = std::chrono::steady_clock;
+
+ private:
+  struct slot {
+    clock::time_point last_seen;
+  };
+
+  nl80211::Socket m_nlsock;
+  std::uint32_t m_if_idx;
+  std::size_t m_capacity;
+  clock::duration m_ttl;
+
+  mutable std::mutex m_mutex;
+  std::map<mac_type, slot> m_slots;
+
+  // the least recently seen peers, never one of those being installed
+  std::vector<mac_type> pick_evictions(
+      std::size_t needed,
+      std::vector<std::pair<mac_type, key_type>> const& keys) const;
+
+ public:
+  KeySlotManager(std::uint32_t if_idx, std::size_t capacity = 32,
+                 clock::duration ttl = std::chrono::seconds(60));
+
+  KeySlotManager(const KeySlotManager&) = delete;
+  KeySlotManager& operator=(const KeySlotManager&) = delete;
+  KeySlotManager(KeySlotManager&&) = delete;
+  KeySlotManager& operator=(KeySlotManager&&) = delete;
+
+  // Installs (or rekeys) every given peer in one batch. Peers that do not fit
+  // evict the least recently seen ones, more peers than slots throw
+  // std::length_error. Throws NlError if any install failed, after the
+  // successful ones have been recorded.
+  void install(std::vector<std::pair<mac_type, key_type>> const& keys);
+  void remove(std::vector<mac_type> const& peers);
+
+  // marks a peer as still around, postponing the expiry of its key
+  void touch(mac_type const& peer);
+  // removes the keys of the peers not seen for longer than the TTL,
+  // returns the number of keys removed
+  std::size_t expire();
+
+  std::optional<std::uint8_t> key_index(mac_type const& peer) const;
+  std::size_t size() const;
+  std::size_t capacity() const noexcept { return m_capacity; }
+
+  static const std::uint32_t CIPHER;
+  static const std::uint8_t KEY_IDX;
+};
+}  // namespace streetpass::iface
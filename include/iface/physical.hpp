@@ -1,7 +1,9 @@
 #pragma once
 
 #include <exception>
-#include <unordered_set>
+#include <future>
+#include <map>
+#include <memory>
 #include <vector>
 
 #include "nl80211/commands.hpp"
@@ -13,12 +15,11 @@ class VirtualInterface;
 class PhysicalInterface {
  private:
   std::uint32_t m_index;
-  std::unordered_set<std::uint32_t> m_supported_cmds;
-  std::unordered_set<std::uint32_t> m_supported_iftypes;
-  std::unordered_set<std::uint32_t> m_supported_ciphers;
+  nl80211::WiphyCapabilities m_capabilities;
 
   PhysicalInterface(nl80211::wiphy wiphy);
   static nl80211::wiphy get_all_info(std::uint32_t index);
+  void prepare_streetpass_interface() const;
 
  public:
   PhysicalInterface(std::uint32_t index);
@@ -32,9 +33,18 @@ class PhysicalInterface {
   void check_supported() const;
   StreetpassInterface setup_streetpass_interface(
       std::string const& name = "streetpass") const;
+  std::future<std::unique_ptr<StreetpassInterface>>
+  setup_streetpass_interface_async(
+      std::string const& name = "streetpass") const;
 
   static std::vector<PhysicalInterface> find_all();
   static std::vector<PhysicalInterface> find_all_supported();
+  // Sets up an interface named prefix + wiphy id on every supported wiphy
+  // concurrently. Each future either holds the interface or rethrows the
+  // error that made the setup of that wiphy fail.
+  static std::map<std::uint32_t,
+                  std::future<std::unique_ptr<StreetpassInterface>>>
+  setup_all_streetpass_interfaces(std::string const& prefix = "streetpass");
 };
 
 class UnsupportedPhysicalInterface : public std::exception {
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <tins/tins.h>
+
+#include <cstdint>
+#include <vector>
+
+namespace streetpass::iface {
+
+// Serialized probe response shared by every peer: only the destination
+// address and the sequence number are patched in place before sending.
+class ProbeResponseTemplate {
+ private:
+  std::vector<std::uint8_t> m_frame;
+  std::uint16_t m_seq_num = 0;
+
+ public:
+  ProbeResponseTemplate(std::vector<std::uint8_t> frame);
+
+  // frame addressed to the peer, valid until the next call
+  std::vector<std::uint8_t> const& for_peer(Tins::HWAddress<6> const& peer);
+
+  std::size_t size() const noexcept { return m_frame.size(); }
+
+  static constexpr std::size_t ADDR1_OFFSET = 4;
+  static constexpr std::size_t SEQ_CTRL_OFFSET = 22;
+};
+}  // namespace streetpass::iface
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <linux/rtnetlink.h>
+#include <netlink/netlink.h>
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "nl80211/transport.hpp"
+
+namespace streetpass::rtnl {
+struct link {
+  int index;
+  unsigned int flags;
+  std::string name;
+};
+
+class Socket {
+ private:
+  std::unique_ptr<nl_sock, decltype(&nl_socket_free)> m_nlsock;
+  std::unique_ptr<nl80211::Transport> m_transport;
+
+ public:
+  Socket();
+  ~Socket() = default;
+
+  Socket(const Socket&) = delete;
+  Socket& operator=(const Socket&) = delete;
+  Socket(Socket&&) = delete;
+  Socket& operator=(Socket&&) = delete;
+
+  int get_fd() const;
+  void add_membership(rtnetlink_groups group);
+  bool wait_readable(std::chrono::milliseconds timeout) const;
+  void recv_pending(
+      std::function<bool(std::uint16_t, link const&)> const& callback);
+
+  nl_sock* get() const { return m_nlsock.get(); }
+  nl80211::Transport& transport() const { return *m_transport; }
+};
+
+link get_link(Socket& sock, int if_idx);
+bool is_link_up(Socket& sock, int if_idx);
+void set_link_up(Socket& sock, int if_idx);
+void set_link_down(Socket& sock, int if_idx);
+void set_links_state(Socket& sock, std::vector<int> const& if_indices,
+                     bool up);
+}  // namespace streetpass::rtnl
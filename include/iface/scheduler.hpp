@@ -0,0 +1,77 @@
+#pragma once
+
+#include <tins/tins.h>
+
+#include <chrono>
+#include <cstddef>
+#include <map>
+#include <set>
+
+#include "cec/module_filter.hpp"
+
+namespace streetpass::iface {
+
+// Decides which of the peers in range get one of the few exchange slots.
+// Peers are ranked by novelty (time since our last exchange with them), the
+// number of titles matching ours and how recently they were seen; only the
+// best ranked ones are admitted while slots are free, and the lowest ranked
+// are shed when too many are waiting.
+//
+// A peer exchanged with less than a quarter of the cooldown ago is always
+// turned down. Past that and until the cooldown ends, it is only admitted
+// while no peer outside its cooldown is waiting, so a console lingering in
+// range does not spend the airtime of new ones on repeat exchanges.
+//
+// Meant to back the accept callback of an AssociationEngine, with every
+// result of the engine reported through complete(). Peers keep sending scan
+// probe requests, so a peer turned down now is admitted on a later one
+// once it ranks high enough.
+class ExchangeScheduler {
+ public:
+  using clock = std::chrono::steady_clock;
+
+ private:
+  struct candidate {
+    unsigned matching_titles;
+    clock::time_point last_seen;
+  };
+
+  cec::ModuleFilter m_module_filter;
+  std::size_t m_max_concurrent;
+  std::size_t m_max_queued;
+  clock::duration m_cooldown;
+  clock::duration m_stale_after;
+
+  std::map<Tins::HWAddress<6>, candidate> m_queue;
+  std::set<Tins::HWAddress<6>> m_active;
+  std::map<Tins::HWAddress<6>, clock::time_point> m_exchanged;
+  std::size_t m_shed = 0;
+
+  // 1 for peers never exchanged with, rising back from 0 over the cooldown
+  double novelty(Tins::HWAddress<6> const& addr, clock::time_point now) const;
+  double score(Tins::HWAddress<6> const& addr, candidate const& c,
+               clock::time_point now) const;
+  void prune(clock::time_point now);
+
+ public:
+  ExchangeScheduler(cec::ModuleFilter const& module_filter,
+                    std::size_t max_concurrent = 4,
+                    std::size_t max_queued = 64,
+                    clock::duration cooldown = std::chrono::minutes(30),
+                    clock::duration stale_after = std::chrono::seconds(10));
+
+  // Records a sighting of the peer and returns whether it should start an
+  // exchange now. Peers we do not match are never admitted.
+  bool admit(Tins::HWAddress<6> const& addr,
+             cec::ModuleFilter const& module_filter);
+  // frees the slot of an admitted peer
+  void complete(Tins::HWAddress<6> const& addr, bool exchanged);
+  // records an exchange that happened before, e.g. in a previous run
+  void remember(Tins::HWAddress<6> const& addr, clock::time_point when);
+
+  std::size_t active() const noexcept { return m_active.size(); }
+  std::size_t queued() const noexcept { return m_queue.size(); }
+  // peers dropped because the queue was full
+  std::size_t shed() const noexcept { return m_shed; }
+};
+}  // namespace streetpass::iface
@@ -2,9 +2,14 @@
 
 #include <tins/tins.h>
 
+#include <chrono>
+#include <memory>
+#include <optional>
 #include <string>
 
 #include "cec/module_filter.hpp"
+#include "iface/association.hpp"
+#include "iface/key_slots.hpp"
 #include "iface/physical.hpp"
 #include "iface/virtual.hpp"
 #include "nl80211/socket.hpp"
@@ -13,12 +18,17 @@ namespace streetpass::iface {
 class StreetpassInterface : public VirtualInterface {
  private:
   nl80211::Socket nlsock;
+  std::chrono::nanoseconds m_ready_latency;
+  std::unique_ptr<KeySlotManager> m_key_slots;
   StreetpassInterface(PhysicalInterface const& phys, std::string const& name);
   friend class PhysicalInterface;
+  friend class AssociationEngine;
 
   Tins::Dot11ProbeResponse make_initial_proberesp(
       Tins::HWAddress<6> const& peer_addr,
       cec::ModuleFilter const& module_filter);
+  static std::optional<cec::ModuleFilter> parse_module_filter(
+      Tins::Dot11ProbeRequest const& probereq);
 
  public:
   StreetpassInterface(const StreetpassInterface&) = delete;
@@ -26,6 +36,18 @@ class StreetpassInterface : public VirtualInterface {
   StreetpassInterface(StreetpassInterface&&) = delete;
   StreetpassInterface& operator=(StreetpassInterface&&) = delete;
 
+  // time spent between the creation request and the IBSS being joined, also
+  // exported as the streetpass_interface_ready_seconds summary
+  std::chrono::nanoseconds ready_latency() const noexcept {
+    return m_ready_latency;
+  }
+
+  // pairwise keys of the peers we are exchanging with
+  KeySlotManager& key_slots() noexcept { return *m_key_slots; }
+
+  static bool is_streetpass_scan_probereq(
+      Tins::Dot11ProbeRequest const& probereq);
+
   void scan_with_cb(
       unsigned int timeout,
       std::function<bool(Tins::HWAddress<6> const&,
@@ -38,13 +60,16 @@ class StreetpassInterface : public VirtualInterface {
   std::map<Tins::HWAddress<6>, cec::ModuleFilter> scan(
       unsigned int timeout, cec::ModuleFilter const& module_filter);
 
-  void associate(unsigned int timeout, Tins::HWAddress<6> const& peer_addr,
-                 cec::ModuleFilter const& module_filter);
+  // associates with a single peer, see AssociationEngine to pair with many
+  bool associate(unsigned int timeout, Tins::HWAddress<6> const& peer_addr,
+                 cec::ModuleFilter const& module_filter,
+                 AssociationEngine::key_fn const& key);
 
   static const std::string SSID;
   static const Tins::HWAddress<3> OUI;
   static const Tins::Dot11ManagementFrame::rates_type SUPPORTED_RATES;
   static const Tins::Dot11ManagementFrame::rates_type EXT_SUPPORTED_RATES;
   static const int CHANNEL_FREQ;
+  static const std::chrono::milliseconds SETUP_TIMEOUT;
 };
 }  // namespace streetpass::iface
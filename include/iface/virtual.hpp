@@ -5,6 +5,7 @@
 #include <array>
 #include <cstdint>
 #include <string>
+#include <vector>
 
 #include "iface/physical.hpp"
 
@@ -28,5 +29,8 @@ class VirtualInterface {
 
   void up() const;
   void down() const;
+
+  // brings all interfaces down with a single rtnetlink request
+  static void down(std::vector<VirtualInterface> const& ifaces);
 };
 }  // namespace streetpass::iface
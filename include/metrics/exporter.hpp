@@ -0,0 +1,33 @@
+#pragma once
+
+#include <string>
+#include <thread>
+
+#include "metrics/registry.hpp"
+
+namespace streetpass::metrics {
+
+// Serves the registry on a local Unix socket, one snapshot per connection
+// with a minimal HTTP response so both Prometheus and
+// `curl --unix-socket <path> http://localhost/metrics` can scrape it.
+class UnixSocketExporter {
+ public:
+  UnixSocketExporter(std::string const& path, Registry& r = registry());
+  ~UnixSocketExporter();
+
+  UnixSocketExporter(const UnixSocketExporter&) = delete;
+  UnixSocketExporter& operator=(const UnixSocketExporter&) = delete;
+  UnixSocketExporter(UnixSocketExporter&&) = delete;
+  UnixSocketExporter& operator=(UnixSocketExporter&&) = delete;
+
+ private:
+  std::string m_path;
+  Registry& m_registry;
+  int m_listen_fd = -1;
+  int m_stop_fd = -1;
+  std::thread m_thread;
+
+  void serve();
+  void reply(int fd);
+};
+}  // namespace streetpass::metrics
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace streetpass::metrics {
+
+// Lock-free log-linear histogram in the spirit of HdrHistogram: every power
+// of two range is split into 2^SUB_BUCKET_BITS linear buckets, which bounds
+// the relative error of the recorded values to about 3%.
+class Histogram {
+ public:
+  static constexpr unsigned SUB_BUCKET_BITS = 5;
+  static constexpr unsigned MAX_VALUE_BITS = 40;
+  static constexpr std::size_t SUB_BUCKET_COUNT = 1u << SUB_BUCKET_BITS;
+  static constexpr std::size_t BUCKET_COUNT =
+      (MAX_VALUE_BITS - SUB_BUCKET_BITS + 1) * SUB_BUCKET_COUNT;
+
+ private:
+  std::array<std::atomic<std::uint64_t>, BUCKET_COUNT> m_buckets = {};
+  std::atomic<std::uint64_t> m_count = 0;
+  std::atomic<std::uint64_t> m_sum = 0;
+  std::atomic<std::uint64_t> m_max = 0;
+
+  static std::size_t bucket_index(std::uint64_t value) noexcept;
+  static std::uint64_t bucket_value(std::size_t index) noexcept;
+
+ public:
+  Histogram() = default;
+
+  Histogram(const Histogram&) = delete;
+  Histogram& operator=(const Histogram&) = delete;
+  Histogram(Histogram&&) = delete;
+  Histogram& operator=(Histogram&&) = delete;
+
+  // values above 2^MAX_VALUE_BITS are clamped into the last bucket
+  void record(std::uint64_t value) noexcept;
+  void reset() noexcept;
+
+  std::uint64_t count() const noexcept { return m_count.load(); }
+  std::uint64_t max() const noexcept { return m_max.load(); }
+  double mean() const noexcept;
+  // value at the given percentile (0-100), 0 when nothing was recorded
+  std::uint64_t percentile(double p) const noexcept;
+};
+}  // namespace streetpass::metrics
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <ostream>
+
+#include "metrics/histogram.hpp"
+
+namespace streetpass::metrics {
+
+// Milestones of a probe request on its way to our probe response, each
+// measured from the netlink receive of the request.
+enum class stage : std::size_t {
+  CLASSIFIED,  // recognized as a streetpass scan probe request
+  PARSED,      // module filter parsed
+  MATCHED,     // module filter checked against ours
+  TX_DONE,     // response TX status reported
+  COUNT
+};
+
+const char* stage_name(stage s) noexcept;
+
+class ResponseLatency {
+ private:
+  std::array<Histogram, static_cast<std::size_t>(stage::COUNT)> m_stages;
+
+ public:
+  using clock = std::chrono::steady_clock;
+
+  ResponseLatency() = default;
+
+  ResponseLatency(const ResponseLatency&) = delete;
+  ResponseLatency& operator=(const ResponseLatency&) = delete;
+  ResponseLatency(ResponseLatency&&) = delete;
+  ResponseLatency& operator=(ResponseLatency&&) = delete;
+
+  // records the time elapsed since rx in nanoseconds
+  void mark(stage s, clock::time_point rx) noexcept;
+
+  Histogram const& histogram(stage s) const noexcept {
+    return m_stages[static_cast<std::size_t>(s)];
+  }
+  void reset() noexcept;
+
+  // one line per stage: count, mean and percentiles in microseconds
+  void dump(std::ostream& os) const;
+};
+
+// process-wide instance fed by the scan and association paths
+ResponseLatency& response_latency();
+
+// prints response_latency() to stderr when the process exits
+void dump_response_latency_on_exit();
+}  // namespace streetpass::metrics
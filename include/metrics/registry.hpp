@@ -0,0 +1,126 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace streetpass::metrics {
+
+// Monotonic counter split in cache line sized shards. Every thread sticks to
+// one shard, so increments are relaxed adds on a line nobody else writes and
+// never take a lock; reads sum the shards.
+class Counter {
+ public:
+  static constexpr std::size_t SHARD_COUNT = 16;
+
+  Counter() = default;
+
+  Counter(const Counter&) = delete;
+  Counter& operator=(const Counter&) = delete;
+  Counter(Counter&&) = delete;
+  Counter& operator=(Counter&&) = delete;
+
+  void inc(std::uint64_t n = 1) noexcept {
+    m_shards[shard_index()].value.fetch_add(n, std::memory_order_relaxed);
+  }
+  std::uint64_t value() const noexcept;
+
+ private:
+  struct alignas(64) shard {
+    std::atomic<std::uint64_t> value = 0;
+  };
+
+  std::array<shard, SHARD_COUNT> m_shards;
+
+  static inline std::atomic<std::size_t> s_next_shard = 0;
+
+  static std::size_t shard_index() noexcept {
+    thread_local const std::size_t index =
+        s_next_shard.fetch_add(1, std::memory_order_relaxed) % SHARD_COUNT;
+    return index;
+  }
+};
+
+class Gauge {
+ public:
+  Gauge() = default;
+
+  Gauge(const Gauge&) = delete;
+  Gauge& operator=(const Gauge&) = delete;
+  Gauge(Gauge&&) = delete;
+  Gauge& operator=(Gauge&&) = delete;
+
+  void set(std::int64_t v) noexcept {
+    m_value.store(v, std::memory_order_relaxed);
+  }
+  void add(std::int64_t n) noexcept {
+    m_value.fetch_add(n, std::memory_order_relaxed);
+  }
+  std::int64_t value() const noexcept {
+    return m_value.load(std::memory_order_relaxed);
+  }
+
+ private:
+  std::atomic<std::int64_t> m_value = 0;
+};
+
+// Named metrics, exported in the Prometheus text format. Registration takes
+// a lock and is meant to happen once per call site, e.g. into a function
+// local static reference; the returned metrics live as long as the registry.
+class Registry {
+ public:
+  using labels = std::vector<std::pair<std::string, std::string>>;
+  using collector = std::function<void(std::ostream&)>;
+
+  Registry() = default;
+
+  Registry(const Registry&) = delete;
+  Registry& operator=(const Registry&) = delete;
+  Registry(Registry&&) = delete;
+  Registry& operator=(Registry&&) = delete;
+
+  // the same name and labels always return the same metric; a name
+  // registered as another metric type throws std::invalid_argument
+  Counter& counter(std::string const& name, std::string const& help,
+                   labels const& l = {});
+  Gauge& gauge(std::string const& name, std::string const& help,
+               labels const& l = {});
+
+  // appends metrics maintained elsewhere, e.g. histograms, to the export
+  void add_collector(collector c);
+
+  void write_prometheus(std::ostream& os) const;
+  // atomically replaces path, for node_exporter's textfile collector
+  void write_file(std::string const& path) const;
+
+ private:
+  enum class type { COUNTER, GAUGE };
+
+  struct family {
+    type kind;
+    std::string help;
+    // by rendered label set
+    std::map<std::string, std::unique_ptr<Counter>> counters;
+    std::map<std::string, std::unique_ptr<Gauge>> gauges;
+  };
+
+  mutable std::mutex m_mutex;
+  std::map<std::string, family> m_families;
+  std::vector<collector> m_collectors;
+
+  family& get_family(std::string const& name, std::string const& help,
+                     type kind);
+};
+
+// process-wide registry fed by the library, also exports response_latency()
+Registry& registry();
+}  // namespace streetpass::metrics
@@ -1,12 +1,11 @@
 #pragma once
 
 #include <cstdint>
-#include <set>
 #include <string>
-#include <unordered_set>
 #include <vector>
 
 #include "nl80211/socket.hpp"
+#include "nl80211/wiphy.hpp"
 
 namespace streetpass::nl80211 {
 
@@ -18,22 +17,24 @@ struct wiface {
   std::array<std::uint8_t, 6> mac;
 };
 
-struct band {
-  std::set<std::uint32_t> freqs;
-  std::set<float> bitrates;
+struct pairwise_key {
+  std::array<std::uint8_t, 6> mac;
+  std::uint8_t key_idx;
+  std::vector<std::uint8_t> key;  // unused when deleting
 };
 
 struct wiphy {
   std::uint32_t index;
   std::string name;
-  std::unordered_set<std::uint32_t> supported_cmds;
-  std::unordered_set<std::uint32_t> supported_iftypes;
-  std::unordered_set<std::uint32_t> supported_ciphers;
-  std::vector<band> bands;
+  WiphyCapabilities capabilities;
 };
 
 namespace commands {
 
+// response handlers, also usable on nl80211 "config" multicast events
+bool parse_wiphy_message(Attributes& msg_attrs, void* arg);
+bool parse_interface_message(Attributes& msg_attrs, void* arg);
+
 void new_key(Socket& nlsock, std::uint32_t if_idx, std::uint8_t key_idx,
              std::uint32_t cipher, std::array<std::uint8_t, 6> const& mac,
              std::vector<std::uint8_t> const& key);
@@ -41,6 +42,22 @@ void new_key(Socket& nlsock, std::uint32_t if_idx, std::uint8_t key_idx,
 void del_key(Socket& nlsock, std::uint32_t if_idx, std::uint8_t key_idx,
              std::array<std::uint8_t, 6> const& mac);
 
+// pipelined variants, one datagram for the whole batch; return one libnl
+// error code per key (0 on success) instead of throwing
+std::vector<int> new_keys(Socket& nlsock, std::uint32_t if_idx,
+                          std::uint32_t cipher,
+                          std::vector<pairwise_key> const& keys);
+
+std::vector<int> del_keys(Socket& nlsock, std::uint32_t if_idx,
+                          std::vector<pairwise_key> const& keys);
+// Deletes then installs keys in a single datagram, so that a peer in both
+// lists is rekeyed in place. Returns the error codes of the deletions
+// followed by those of the installs.
+std::vector<int> replace_keys(Socket& nlsock, std::uint32_t if_idx,
+                              std::uint32_t cipher,
+                              std::vector<pairwise_key> const& removed,
+                              std::vector<pairwise_key> const& added);
+
 void set_interface_mode(Socket& nlsock, std::uint32_t if_idx,
                         nl80211_iftype mode);
 
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "nl80211/transport.hpp"
+
+namespace streetpass::nl80211 {
+
+// In-process stand-in for the parts of the kernel the library talks to: the
+// nl80211 family and the rtnetlink link messages. Every socket created while
+// factory() is installed gets a socketpair to a server thread instead of a
+// netlink socket. The thread answers wiphy, interface, IBSS, key and frame
+// commands, sends the multicast events the kernel would, and injects
+// NL80211_CMD_FRAME events carrying received frames at a configurable rate.
+class FakeKernel {
+ public:
+  using frame = std::vector<std::uint8_t>;
+  using clock = std::chrono::steady_clock;
+
+  struct stats {
+    std::uint64_t requests;
+    std::uint64_t frames_injected;
+    // injected while no socket was registered for them
+    std::uint64_t frames_dropped;
+    // NL80211_CMD_FRAME requests, i.e. frames transmitted by the library
+    std::uint64_t frames_sent;
+    // most messages ever queued for a socket that did not keep up
+    std::uint64_t backlog_max;
+  };
+
+  static constexpr int FAMILY_ID = 0x1c;
+
+ private:
+  using bytes = std::vector<std::uint8_t>;
+
+  struct connection;
+
+  struct iface {
+    std::uint32_t index;
+    std::uint32_t wiphy;
+    std::uint32_t type;
+    std::string name;
+    std::array<std::uint8_t, 6> mac;
+    unsigned int flags;
+    std::uint32_t freq;
+    // destroyed with this socket, as with NL80211_ATTR_SOCKET_OWNER
+    connection* owner;
+  };
+
+  struct injection {
+    std::vector<frame> frames;
+    std::vector<bytes> events;  // built once the schedule starts
+    clock::duration period;
+    std::uint64_t remaining;
+    bool forever;
+    bool started = false;
+    std::size_t next = 0;
+    clock::time_point due;
+  };
+
+  std::uint32_t m_wiphys;
+  int m_wake_fd;
+
+  // shared with the user threads
+  std::mutex m_mutex;
+  bool m_stop = false;
+  std::vector<std::shared_ptr<connection>> m_adopted;
+  std::map<std::uint32_t, injection> m_injections;  // by interface index
+
+  std::atomic<std::uint64_t> m_requests{0};
+  std::atomic<std::uint64_t> m_frames_injected{0};
+  std::atomic<std::uint64_t> m_frames_dropped{0};
+  std::atomic<std::uint64_t> m_frames_sent{0};
+  std::atomic<std::uint64_t> m_backlog_max{0};
+
+  // server thread only
+  std::vector<std::shared_ptr<connection>> m_connections;
+  std::map<std::uint32_t, iface> m_ifaces;
+  std::uint32_t m_next_ifindex = 100;
+  std::uint64_t m_next_cookie = 1;
+
+  std::thread m_thread;
+
+  void adopt(std::shared_ptr<connection> conn);
+  void run();
+  void receive(connection& conn);
+  void handle_nl80211(connection& conn, nlmsghdr* hdr);
+  void handle_rtnl(connection& conn, nlmsghdr* hdr);
+  void close(connection& conn);
+  void remove_iface(std::uint32_t if_idx);
+  void set_link_flags(iface& i, unsigned int flags, unsigned int change);
+  void multicast(int protocol, int group, bytes const& message);
+  connection* frame_receiver(std::uint32_t if_idx, frame const& f) const;
+  void inject_due(clock::time_point now);
+  clock::duration next_wakeup(clock::time_point now) const;
+  void send(connection& conn, bytes message);
+  void flush(connection& conn);
+
+  friend class FakeTransport;
+
+ public:
+  explicit FakeKernel(std::uint32_t wiphys = 1);
+  ~FakeKernel();
+
+  FakeKernel(const FakeKernel&) = delete;
+  FakeKernel& operator=(const FakeKernel&) = delete;
+  FakeKernel(FakeKernel&&) = delete;
+  FakeKernel& operator=(FakeKernel&&) = delete;
+
+  // transports to install with set_transport_factory, the kernel must
+  // outlive the sockets created from them
+  transport_factory factory();
+
+  // Injects count frames (0 for no limit) received on if_idx, cycling
+  // through frames, at rate frames per second. A rate of 0 sends them as
+  // fast as the receiving socket reads them. The schedule starts once a
+  // socket registered for the frame type on the interface, frames the
+  // socket does not keep up with are queued rather than dropped.
+  void inject(std::uint32_t if_idx, std::vector<frame> const& frames,
+              double rate, std::uint64_t count = 0);
+  void stop_injecting(std::uint32_t if_idx);
+  bool injecting(std::uint32_t if_idx);
+
+  stats get_stats() const;
+};
+}  // namespace streetpass::nl80211
@@ -8,6 +8,7 @@
 #include <map>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "nl80211/socket.hpp"
 
@@ -16,6 +17,9 @@ class Message {
  private:
   std::unique_ptr<nl_msg, decltype(&nlmsg_free)> m_nl_msg;
   friend void Socket::send_message(Message&);
+  friend std::uint32_t Socket::send_async(Message&);
+  friend std::vector<int> Socket::send_batch(
+      std::vector<std::unique_ptr<Message>> const&);
 
  public:
   Message(nl80211_commands cmd, int driver_id, int flags = 0);
@@ -68,6 +72,8 @@ class Attributes {
  public:
   std::map<int, nlattr*> m_attrs;
   std::vector<int> m_attr_types;
+  std::uint8_t m_cmd = 0;
+  std::uint32_t m_seq = 0;
 
  public:
   Attributes(nl_msg* nlmsg);
@@ -77,6 +83,17 @@ class Attributes {
 
   std::vector<int> const& types() const { return m_attr_types; }
 
+  // generic netlink command of the message, 0 for nested attributes
+  std::uint8_t command() const { return m_cmd; }
+  // netlink sequence number, 0 for notifications and nested attributes
+  std::uint32_t sequence() const { return m_seq; }
+
+  // raw attribute pointer, nullptr if the attribute is absent
+  nlattr* find(int attr) const {
+    auto it = m_attrs.find(attr);
+    return it == m_attrs.end() ? nullptr : it->second;
+  }
+
   template <typename T>
   Attribute<T> get(int attr) const {
     nlattr* attr_ptr = nullptr;
@@ -5,9 +5,15 @@
 #include <netlink/netlink.h>
 
 #include <array>
+#include <chrono>
+#include <cstdint>
 #include <exception>
 #include <functional>
 #include <memory>
+#include <string>
+#include <vector>
+
+#include "nl80211/transport.hpp"
 
 namespace streetpass::nl80211 {
 class Message;
@@ -16,10 +22,14 @@ class Attributes;
 class Socket {
  private:
   std::unique_ptr<nl_sock, decltype(&nl_socket_free)> m_nlsock;
+  std::unique_ptr<Transport> m_transport;
   int m_driver_id;
 
+  nl_cb* alloc_cb() const;
+
  public:
   Socket();
+  explicit Socket(std::unique_ptr<Transport> transport);
   ~Socket() = default;
 
   Socket(const Socket&) = delete;
@@ -28,10 +38,25 @@ class Socket {
   Socket& operator=(Socket&&) = delete;
 
   int get_driver_id() const;
+  int get_fd() const;
+  void add_membership(std::string const& group);
+  bool wait_readable(std::chrono::milliseconds timeout) const;
   void send_message(Message& msg);
+  // sends without waiting for the reply, returns the sequence number used
+  std::uint32_t send_async(Message& msg);
+  // Sends every message in a single datagram and waits for all the ACKs.
+  // Returns one libnl error code per message, 0 when it succeeded.
+  std::vector<int> send_batch(
+      std::vector<std::unique_ptr<Message>> const& msgs);
   void recv_messages();
   void recv_messages(std::function<bool(Attributes&, void*)> callback,
                      void* arg, bool disable_seq_check = false,
                      unsigned int timeout = 0);
+  void recv_pending(std::function<bool(Attributes&, void*)> callback,
+                    void* arg);
+  // also reports the ACK (0) or error code of every request answered
+  void recv_pending(std::function<bool(Attributes&, void*)> callback,
+                    std::function<void(std::uint32_t, int)> on_status,
+                    void* arg);
 };
 }  // namespace streetpass::nl80211
@@ -0,0 +1,38 @@
+#pragma once
+#include <netlink/netlink.h>
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+
+namespace streetpass::nl80211 {
+// Carries the netlink traffic of a socket. Sockets talk to the kernel unless
+// another transport factory is installed, e.g. a FakeKernel to run the whole
+// library without hardware. All functions return libnl error codes.
+class Transport {
+ public:
+  virtual ~Transport() = default;
+
+  // binds the transport to sock, then connects it to a netlink protocol
+  virtual int connect(nl_sock* sock, int protocol) = 0;
+  // generic netlink family and multicast group ids, as genl_ctrl_resolve*
+  virtual int resolve_family(std::string const& family) = 0;
+  virtual int resolve_group(std::string const& family,
+                            std::string const& group) = 0;
+  virtual int add_membership(int group) = 0;
+
+  // descriptor to poll for incoming messages
+  virtual int fd() const = 0;
+  // sends a buffer of completed messages, as nl_sendto
+  virtual int sendto(void* buf, std::size_t size) = 0;
+  // routes the messages received through cb via the transport
+  virtual void attach(nl_cb* cb) = 0;
+};
+
+using transport_factory = std::function<std::unique_ptr<Transport>()>;
+
+// transport of the sockets created from now on, nullptr for the kernel
+void set_transport_factory(transport_factory factory);
+std::unique_ptr<Transport> make_transport();
+}  // namespace streetpass::nl80211
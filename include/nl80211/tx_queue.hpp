@@ -0,0 +1,90 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "nl80211/socket.hpp"
+
+namespace streetpass::nl80211 {
+
+// Transmits management frames without waiting for the kernel between them.
+// The cookie returned for every NL80211_CMD_FRAME is matched against the
+// FRAME_TX_STATUS events of the "mlme" group to complete the request.
+class TxQueue {
+ public:
+  struct tx_status {
+    std::uint64_t cookie;
+    bool acked;
+    // libnl error code, NLE_AGAIN when no status came back in time
+    int error;
+  };
+
+  using callback = std::function<void(tx_status const&)>;
+  using clock = std::chrono::steady_clock;
+
+ private:
+  struct request {
+    std::vector<std::uint8_t> frame;
+    callback done;
+    clock::time_point sent;
+  };
+
+  // a FRAME_TX_STATUS that overtook the reply carrying its cookie
+  struct early_status {
+    bool acked;
+    clock::time_point received;
+  };
+
+  Socket m_nlsock;
+  std::uint32_t m_if_idx;
+  std::uint32_t m_freq;
+  std::size_t m_max_in_flight;
+  std::chrono::milliseconds m_status_timeout;
+
+  std::deque<request> m_backlog;
+  std::map<std::uint32_t, request> m_awaiting_cookie;  // by netlink seq
+  std::map<std::uint64_t, request> m_awaiting_status;  // by cookie
+  std::map<std::uint64_t, early_status> m_early_status;  // by cookie
+  std::vector<std::pair<callback, tx_status>> m_completed;
+
+  void flush();
+  void complete(request& req, tx_status const& status);
+
+ public:
+  TxQueue(std::uint32_t if_idx, std::uint32_t freq,
+          std::size_t max_in_flight = 16,
+          std::chrono::milliseconds status_timeout =
+              std::chrono::milliseconds(500));
+
+  TxQueue(const TxQueue&) = delete;
+  TxQueue& operator=(const TxQueue&) = delete;
+  TxQueue(TxQueue&&) = delete;
+  TxQueue& operator=(TxQueue&&) = delete;
+
+  // Never blocks on the kernel: frames past the in-flight limit wait in a
+  // backlog until earlier ones complete. Completions are delivered from
+  // process().
+  void submit(std::vector<std::uint8_t> frame, callback done);
+  std::future<tx_status> submit(std::vector<std::uint8_t> frame);
+
+  // handles the replies and status events already received, then refills
+  // the in-flight window
+  void process();
+
+  int get_fd() const { return m_nlsock.get_fd(); }
+  bool wait_readable(std::chrono::milliseconds timeout) const {
+    return m_nlsock.wait_readable(timeout);
+  }
+
+  std::size_t in_flight() const noexcept {
+    return m_awaiting_cookie.size() + m_awaiting_status.size();
+  }
+  std::size_t backlog() const noexcept { return m_backlog.size(); }
+};
+}  // namespace streetpass::nl80211
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <linux/nl80211.h>
+#include <netlink/attr.h>
+
+#include <bitset>
+#include <cstdint>
+#include <set>
+#include <vector>
+
+namespace streetpass::nl80211 {
+class Attributes;
+
+struct band {
+  std::set<std::uint32_t> freqs;
+  std::set<float> bitrates;
+};
+
+// Capabilities of a wiphy, kept as the raw nl80211 attributes of the
+// GET_WIPHY response and decoded on first access. Commands, interface types
+// and ciphers are decoded into bitsets so that support checks are a single
+// bit test. Lazy decoding is not synchronized: concurrent readers must use
+// their own copy.
+class WiphyCapabilities {
+ private:
+  enum field : std::uint8_t {
+    COMMANDS = 1 << 0,
+    IFTYPES = 1 << 1,
+    CIPHERS = 1 << 2,
+    BANDS = 1 << 3
+  };
+
+  static constexpr std::size_t NOT_PRESENT = static_cast<std::size_t>(-1);
+
+  std::vector<std::uint8_t> m_raw;
+  std::size_t m_cmds_offset = NOT_PRESENT;
+  std::size_t m_iftypes_offset = NOT_PRESENT;
+  std::size_t m_ciphers_offset = NOT_PRESENT;
+  std::size_t m_bands_offset = NOT_PRESENT;
+
+  mutable std::uint8_t m_decoded = 0;
+  mutable std::bitset<NL80211_CMD_MAX + 1> m_cmds;
+  mutable std::bitset<NUM_NL80211_IFTYPES> m_iftypes;
+  // cipher suites of the 00-0F-AC OUI are indexed by their suite type
+  mutable std::bitset<32> m_ieee_ciphers;
+  mutable std::vector<std::uint32_t> m_other_ciphers;
+  mutable std::vector<band> m_bands;
+
+  std::size_t keep(Attributes const& msg_attrs, int attr);
+  nlattr* raw(std::size_t offset) const;
+  void decode(field f) const;
+
+ public:
+  WiphyCapabilities() = default;
+  explicit WiphyCapabilities(Attributes const& msg_attrs);
+
+  bool supports_command(std::uint32_t cmd) const;
+  bool supports_iftype(std::uint32_t iftype) const;
+  bool supports_cipher(std::uint32_t cipher) const;
+  std::vector<band> const& bands() const;
+};
+}  // namespace streetpass::nl80211
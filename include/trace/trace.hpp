@@ -0,0 +1,146 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+// Binary trace of the frame pipeline, to tell after the fact where the
+// probe requests of a given peer were dropped. Events go to a ring owned by
+// the recording thread: recording is a timestamp read and a 24 bytes store,
+// no lock and no shared cache line. The rings are kept after their thread
+// exits and dump() writes them all for streetpass_trace_dump to decode.
+//
+// STREETPASS_TRACE_EVENT compiles to nothing unless the library is built
+// with the STREETPASS_TRACE CMake option.
+namespace streetpass::trace {
+
+enum class stage : std::uint8_t {
+  RECEIVED,    // probe request handed to a scan handler
+  CLASSIFIED,  // result: 1 when recognized as a streetpass scan
+  PARSED,      // result: a parse_result
+  MATCHED,     // result: 1 when the module filter was accepted
+  DELIVERED,   // result: scan callback return value, -1 when it threw
+  TX_DONE,     // result: libnl error of the probe response, 0 when sent
+  COUNT
+};
+
+const char* stage_name(stage s) noexcept;
+
+enum parse_result : std::int32_t {
+  PARSE_OK = 0,
+  NO_VENDOR_ELEMENT = 1,
+  BAD_VENDOR_DATA = 2,
+  BAD_MODULE_FILTER = 3,
+};
+
+const char* parse_result_name(std::int32_t r) noexcept;
+
+struct event {
+  std::uint64_t timestamp;  // trace clock ticks
+  std::uint32_t sequence;   // per ring, detects overwritten events
+  std::int32_t result;
+  std::array<std::uint8_t, 6> mac;
+  stage where;
+  std::uint8_t padding;
+};
+
+static_assert(sizeof(event) == 24);
+
+// TSC on x86-64, steady_clock nanoseconds elsewhere; dump() records how to
+// convert them
+inline std::uint64_t ticks() noexcept {
+#if defined(__x86_64__)
+  return __rdtsc();
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+#endif
+}
+
+// Single producer ring: only the owning thread pushes. Readers copy it
+// concurrently and rely on the sequence numbers to drop the events
+// overwritten meanwhile.
+class Ring {
+ public:
+  static constexpr std::size_t CAPACITY = 4096;
+
+  Ring(std::uint32_t thread_index) : m_thread_index(thread_index) {}
+
+  Ring(const Ring&) = delete;
+  Ring& operator=(const Ring&) = delete;
+  Ring(Ring&&) = delete;
+  Ring& operator=(Ring&&) = delete;
+
+  void push(stage s, const std::uint8_t* mac, std::int32_t result) noexcept {
+    std::uint64_t head = m_head.load(std::memory_order_relaxed);
+    event& e = m_events[head & (CAPACITY - 1)];
+    // seqlock write: no reader window reaches head + CAPACITY, so a copy
+    // taken while the payload is half written is dropped
+    e.sequence = static_cast<std::uint32_t>(head + CAPACITY);
+    std::atomic_thread_fence(std::memory_order_release);
+    e.timestamp = ticks();
+    e.result = result;
+    for (std::size_t i = 0; i < e.mac.size(); ++i) e.mac[i] = mac ? mac[i] : 0;
+    e.where = s;
+    std::atomic_thread_fence(std::memory_order_release);
+    e.sequence = static_cast<std::uint32_t>(head);
+    m_head.store(head + 1, std::memory_order_release);
+  }
+
+  // events still in the ring, oldest first
+  std::vector<event> snapshot() const;
+  std::uint32_t thread_index() const noexcept { return m_thread_index; }
+
+ private:
+  static_assert((CAPACITY & (CAPACITY - 1)) == 0);
+
+  std::array<event, CAPACITY> m_events = {};
+  std::atomic<std::uint64_t> m_head = 0;
+  std::uint32_t m_thread_index;
+};
+
+// ring of the calling thread, allocated on its first event
+Ring& thread_ring();
+
+inline void record(stage s, const std::uint8_t* mac,
+                   std::int32_t result) noexcept {
+  thread_local Ring& ring = thread_ring();
+  ring.push(s, mac, result);
+}
+
+// writes every ring to path, throws std::system_error on failure
+void dump(std::string const& path);
+// dumps to path when the process exits
+void dump_on_exit(std::string const& path);
+
+struct decoded_event {
+  std::uint32_t thread_index;
+  std::uint64_t ns;  // steady_clock nanoseconds
+  event e;
+};
+
+// reads a dump back, sorted by time; throws std::runtime_error on a file
+// that is not a trace dump
+std::vector<decoded_event> load(std::string const& path);
+}  // namespace streetpass::trace
+
+#ifdef STREETPASS_TRACE
+#define STREETPASS_TRACE_EVENT(where, mac, result) \
+  ::streetpass::trace::record(::streetpass::trace::stage::where, mac, result)
+#else
+// arguments are not evaluated, only referenced to keep them "used"
+#define STREETPASS_TRACE_EVENT(where, mac, result) \
+  do {                                             \
+    (void)sizeof(mac);                             \
+    (void)sizeof(result);                          \
+  } while (0)
+#endif
@@ -0,0 +1,82 @@
+#include "cec/mapped_file.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <system_error>
+#include <utility>
+
+namespace streetpass::cec {
+
+MappedFile::MappedFile(std::string const& path, std::size_t copy_below) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    throw std::system_error(errno, std::generic_category(),
+                            "Failed to open " + path);
+
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    int err = errno;
+    close(fd);
+    throw std::system_error(err, std::generic_category(),
+                            "Failed to stat " + path);
+  }
+
+  m_size = st.st_size;
+  if (m_size != 0 && m_size < copy_below) {
+    m_copy = std::make_unique<uint8_t[]>(m_size);
+    std::size_t done = 0;
+    while (done < m_size) {
+      ssize_t n = pread(fd, m_copy.get() + done, m_size - done, done);
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0) {
+        // truncated meanwhile, or a read error
+        int err = n < 0 ? errno : EIO;
+        close(fd);
+        throw std::system_error(err, std::generic_category(),
+                                "Failed to read " + path);
+      }
+      done += n;
+    }
+    m_data = m_copy.get();
+  } else if (m_size != 0) {
+    void* map = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+      int err = errno;
+      close(fd);
+      throw std::system_error(err, std::generic_category(),
+                              "Failed to map " + path);
+    }
+    // parsing walks the file front to back
+    madvise(map, m_size, MADV_SEQUENTIAL);
+    m_data = static_cast<const uint8_t*>(map);
+  }
+
+  // the mapping stays valid once the descriptor is closed
+  close(fd);
+}
+
+MappedFile::~MappedFile() {
+  if (m_data != nullptr && !m_copy)
+    munmap(const_cast<uint8_t*>(m_data), m_size);
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+    : m_data(std::exchange(other.m_data, nullptr)),
+      m_size(std::exchange(other.m_size, 0)),
+      m_copy(std::move(other.m_copy)) {}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+  if (this != &other) {
+    if (m_data != nullptr && !m_copy)
+      munmap(const_cast<uint8_t*>(m_data), m_size);
+    m_data = std::exchange(other.m_data, nullptr);
+    m_size = std::exchange(other.m_size, 0);
+    m_copy = std::move(other.m_copy);
+  }
+  return *this;
+}
+}  // namespace streetpass::cec
@@ -0,0 +1,252 @@
+#include "cec/message_box.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+
+using Tins::Memory::InputMemoryStream;
+using Tins::Memory::OutputMemoryStream;
+
+namespace streetpass::cec {
+
+namespace {
+bool consistent_sizes(uint32_t message_size, uint32_t header_size,
+                      uint32_t body_size) {
+  return header_size >= MessageHeader::fixed_byte_size() &&
+         uint64_t(message_size) ==
+             uint64_t(header_size) + body_size + MessageHeader::HMAC_SIZE;
+}
+}  // namespace
+
+MessageHeader MessageHeader::from_stream(InputMemoryStream& stream) {
+  MessageHeader header;
+  if (!stream.can_read(sizeof(header.m_internal))) throw "bad message header";
+  stream.read(&header.m_internal, sizeof(header.m_internal));
+
+  if (header.m_internal.magic != MAGIC) throw "bad message header magic";
+  if (!consistent_sizes(header.message_size(), header.header_size(),
+                        header.body_size()))
+    throw "bad message header sizes";
+
+  return header;
+}
+
+uint32_t MessageHeader::message_size() const {
+  return m_internal.message_size;
+}
+
+uint32_t MessageHeader::header_size() const { return m_internal.header_size; }
+
+uint32_t MessageHeader::body_size() const { return m_internal.body_size; }
+
+tid_type MessageHeader::title_id() const { return m_internal.title_id; }
+
+uint32_t MessageHeader::batch_id() const { return m_internal.batch_id; }
+
+MessageHeader::message_id_type MessageHeader::message_id() const {
+  message_id_type id;
+  std::copy(std::begin(m_internal.message_id),
+            std::end(m_internal.message_id), id.begin());
+  return id;
+}
+
+uint32_t MessageHeader::version() const { return m_internal.version; }
+
+uint8_t MessageHeader::send_method() const { return m_internal.send_method; }
+
+bool MessageHeader::is_unopen() const { return m_internal.is_unopen != 0; }
+
+bool MessageHeader::is_new() const { return m_internal.is_new != 0; }
+
+uint64_t MessageHeader::sender_id() const { return m_internal.sender_id; }
+
+uint8_t MessageHeader::forward_count() const {
+  return m_internal.forward_count;
+}
+
+MessageHeader::operator bytes() const {
+  bytes buffer(sizeof(m_internal));
+  OutputMemoryStream stream(buffer);
+  stream.write(m_internal);
+  return buffer;
+}
+
+std::ostream& operator<<(std::ostream& s, const MessageHeader& h) {
+  std::stringstream ss;
+  ss << "Message: title_id=" << std::hex << std::setfill('0') << std::setw(8)
+     << h.title_id() << ", message_id=";
+  for (unsigned b : h.message_id()) ss << std::setw(2) << b;
+  ss << ", sender_id=" << std::setw(16) << h.sender_id() << std::dec
+     << ", header_size=" << h.header_size() << ", body_size=" << h.body_size();
+
+  s << ss.str();
+  return s;
+}
+
+MessageBoxInfo MessageBoxInfo::from_stream(InputMemoryStream& stream) {
+  MessageBoxInfo box;
+  if (!stream.can_read(sizeof(box.m_internal))) throw "bad box info header";
+  stream.read(&box.m_internal, sizeof(box.m_internal));
+
+  if (box.m_internal.magic != MAGIC) throw "bad box info header magic";
+  if (box.message_num() > box.max_message_num()) throw "bad message count";
+
+  uint64_t headers_size =
+      uint64_t(box.message_num()) * MessageHeader::fixed_byte_size();
+  if (!stream.can_read(headers_size)) throw "bad box info length";
+
+  box.m_headers.reserve(box.message_num());
+  for (uint32_t i = 0; i < box.message_num(); ++i)
+    box.m_headers.push_back(MessageHeader::from_stream(stream));
+
+  return box;
+}
+
+uint32_t MessageBoxInfo::max_box_size() const {
+  return m_internal.max_box_size;
+}
+
+uint32_t MessageBoxInfo::box_size() const { return m_internal.box_size; }
+
+uint32_t MessageBoxInfo::max_message_num() const {
+  return m_internal.max_message_num;
+}
+
+uint32_t MessageBoxInfo::message_num() const { return m_internal.message_num; }
+
+uint32_t MessageBoxInfo::max_batch_size() const {
+  return m_internal.max_batch_size;
+}
+
+uint32_t MessageBoxInfo::max_message_size() const {
+  return m_internal.max_message_size;
+}
+
+std::vector<MessageHeader> const& MessageBoxInfo::message_headers() const {
+  return m_headers;
+}
+
+unsigned MessageBoxInfo::byte_size() const {
+  return sizeof(m_internal) +
+         m_headers.size() * MessageHeader::fixed_byte_size();
+}
+
+MessageBoxInfo::operator bytes() const {
+  bytes buffer(byte_size());
+  OutputMemoryStream stream(buffer);
+  stream.write(m_internal);
+
+  for (MessageHeader const& header : m_headers) {
+    bytes header_bytes = bytes(header);
+    stream.write(header_bytes.data(), header_bytes.size());
+  }
+
+  return buffer;
+}
+
+std::ostream& operator<<(std::ostream& s, const MessageBoxInfo& b) {
+  std::stringstream ss;
+  ss << "Box: messages=" << b.message_num() << "/" << b.max_message_num()
+     << ", size=" << b.box_size() << "/" << b.max_box_size();
+  for (MessageHeader const& h : b.m_headers) ss << std::endl << "  " << h;
+
+  s << ss.str();
+  return s;
+}
+
+MessageView MessageView::from_stream(InputMemoryStream& stream) {
+  const uint8_t* begin = stream.pointer();
+  MessageView view(MessageHeader::from_stream(stream), begin);
+
+  uint32_t remaining =
+      view.m_header.message_size() - MessageHeader::fixed_byte_size();
+  if (!stream.can_read(remaining)) throw "bad message length";
+
+  view.m_body = begin + view.m_header.header_size();
+  view.m_hmac = view.m_body + view.m_header.body_size();
+  stream.skip(remaining);
+
+  return view;
+}
+
+MessageView::operator bytes() const {
+  return bytes(m_begin, m_begin + m_header.message_size());
+}
+
+MessageStreamParser::MessageStreamParser(handlers h,
+                                         uint32_t max_message_size)
+    : m_handlers(std::move(h)), m_max_message_size(max_message_size) {}
+
+void MessageStreamParser::feed(const uint8_t* data, std::size_t size) {
+  while (true) {
+    switch (m_state) {
+      case state::HEADER: {
+        if (size == 0) return;
+
+        std::size_t n = std::min(size, m_header_buffer.size() - m_filled);
+        std::memcpy(m_header_buffer.data() + m_filled, data, n);
+        m_filled += n;
+        data += n;
+        size -= n;
+        if (m_filled < m_header_buffer.size()) return;
+
+        MessageHeader header = Parser<MessageHeader>::from_bytes(
+            m_header_buffer.data(), m_header_buffer.size());
+        if (header.message_size() > m_max_message_size)
+          throw "message exceeds maximum size";
+
+        m_filled = 0;
+        m_remaining = header.header_size() - MessageHeader::fixed_byte_size();
+        m_body_size = header.body_size();
+        m_state = state::EXTRA_HEADER;
+        if (m_handlers.on_header) m_handlers.on_header(header);
+        break;
+      }
+      case state::EXTRA_HEADER: {
+        if (m_remaining == 0) {
+          m_remaining = m_body_size;
+          m_state = state::BODY;
+          break;
+        }
+        if (size == 0) return;
+
+        std::size_t n = std::min(size, m_remaining);
+        data += n;
+        size -= n;
+        m_remaining -= n;
+        break;
+      }
+      case state::BODY: {
+        if (m_remaining == 0) {
+          m_state = state::HMAC;
+          break;
+        }
+        if (size == 0) return;
+
+        std::size_t n = std::min(size, m_remaining);
+        if (m_handlers.on_body) m_handlers.on_body(data, n);
+        data += n;
+        size -= n;
+        m_remaining -= n;
+        break;
+      }
+      case state::HMAC: {
+        if (size == 0) return;
+
+        std::size_t n = std::min(size, m_hmac.size() - m_filled);
+        std::memcpy(m_hmac.data() + m_filled, data, n);
+        m_filled += n;
+        data += n;
+        size -= n;
+        if (m_filled < m_hmac.size()) return;
+
+        m_filled = 0;
+        m_state = state::HEADER;
+        if (m_handlers.on_end) m_handlers.on_end(m_hmac);
+        break;
+      }
+    }
+  }
+}
+}  // namespace streetpass::cec
@@ -2,12 +2,35 @@
 
 #include <iomanip>
 #include <iostream>
+#include <unordered_map>
+
+#include "metrics/registry.hpp"
 
 using namespace Tins;
 using Tins::Memory::InputMemoryStream;
 using Tins::Memory::OutputMemoryStream;
 
 namespace streetpass::cec {
+namespace {
+metrics::Counter& parsed_filters() {
+  static auto& counter = metrics::registry().counter(
+      "streetpass_module_filters_parsed_total", "Module filters parsed.");
+  return counter;
+}
+
+void count_rejected(const char* reason) {
+  // parse errors are string literals, resolve each one once per thread
+  thread_local std::unordered_map<const char*, metrics::Counter*> counters;
+  auto& counter = counters[reason];
+  if (counter == nullptr)
+    counter = &metrics::registry().counter(
+        "streetpass_module_filters_rejected_total",
+        "Module filters rejected while parsing, by error.",
+        {{"reason", reason}});
+  counter->inc();
+}
+}  // namespace
+
 ModuleFilter::FilterListMarker::operator std::string() const {
   switch (m_value) {
     case RAW_BYTES_FILTER:
@@ -30,35 +53,45 @@ std::ostream& operator<<(std::ostream& s,
 }
 
 ModuleFilter ModuleFilter::from_stream(InputMemoryStream& stream) {
-  ModuleFilter filter;
-  bool found_raw_bytes_list = false;
-  bool found_title_list = false;
-  bool found_key_list = false;
-
-  while (stream.can_read(sizeof(filter_list_header))) {
-    const filter_list_header* header =
-        reinterpret_cast<const filter_list_header*>(stream.pointer());
-
-    if (header->marker == ModuleFilter::FilterListMarker::RAW_BYTES_FILTER) {
-      if (found_raw_bytes_list) throw "bad - already found raw bytes list";
-      filter.m_raw_bytes_list = FilterList<RawBytesFilter>::from_stream(stream);
-      found_raw_bytes_list = true;
-    } else if (header->marker == ModuleFilter::FilterListMarker::TITLE_FILTER) {
-      if (found_title_list) throw "bad - already found title list";
-      filter.m_title_list = FilterList<TitleFilter>::from_stream(stream);
-      found_title_list = true;
-    } else if (header->marker == ModuleFilter::FilterListMarker::KEY_FILTER) {
-      if (found_key_list) throw "bad - already found key list";
-      filter.m_key_list = FilterList<KeyFilter>::from_stream(stream);
-      found_key_list = true;
-    } else {
-      throw "bad marker";
+  try {
+    ModuleFilter filter;
+    bool found_raw_bytes_list = false;
+    bool found_title_list = false;
+    bool found_key_list = false;
+
+    while (stream.can_read(sizeof(filter_list_header))) {
+      const filter_list_header* header =
+          reinterpret_cast<const filter_list_header*>(stream.pointer());
+
+      if (header->marker ==
+          ModuleFilter::FilterListMarker::RAW_BYTES_FILTER) {
+        if (found_raw_bytes_list) throw "bad - already found raw bytes list";
+        filter.m_raw_bytes_list =
+            FilterList<RawBytesFilter>::from_stream(stream);
+        found_raw_bytes_list = true;
+      } else if (header->marker ==
+                 ModuleFilter::FilterListMarker::TITLE_FILTER) {
+        if (found_title_list) throw "bad - already found title list";
+        filter.m_title_list = FilterList<TitleFilter>::from_stream(stream);
+        found_title_list = true;
+      } else if (header->marker ==
+                 ModuleFilter::FilterListMarker::KEY_FILTER) {
+        if (found_key_list) throw "bad - already found key list";
+        filter.m_key_list = FilterList<KeyFilter>::from_stream(stream);
+        found_key_list = true;
+      } else {
+        throw "bad marker";
+      }
     }
-  }
 
-  if (filter.m_key_list.count() != 1) throw "bad - key list count != 1";
+    if (filter.m_key_list.count() != 1) throw "bad - key list count != 1";
 
-  return filter;
+    parsed_filters().inc();
+    return filter;
+  } catch (const char* reason) {
+    count_rejected(reason);
+    throw;
+  }
 }
 
 ModuleFilter::ModuleFilter(key_type const& k) { key(k); }
@@ -90,8 +123,21 @@ void ModuleFilter::key(key_type const& k) {
 }
 
 bool ModuleFilter::match(ModuleFilter const& other) const {
-  return m_title_list.match(other.title_filters()) ||
-         m_raw_bytes_list.match(other.raw_bytes_filters());
+  static auto& matched = metrics::registry().counter(
+      "streetpass_module_filter_matches_total",
+      "Module filter comparisons, by result.", {{"result", "match"}});
+  static auto& mismatched = metrics::registry().counter(
+      "streetpass_module_filter_matches_total",
+      "Module filter comparisons, by result.", {{"result", "mismatch"}});
+
+  bool result = m_title_list.match(other.title_filters()) ||
+                m_raw_bytes_list.match(other.raw_bytes_filters());
+  (result ? matched : mismatched).inc();
+  return result;
+}
+
+unsigned ModuleFilter::matching_titles(ModuleFilter const& other) const {
+  return m_title_list.match_count(other.title_filters());
 }
 
 unsigned ModuleFilter::byte_size() const {
@@ -464,12 +510,23 @@ void ModuleFilter::FilterList<T>::filters(std::vector<T> const& filters) {
 template <class T>
 bool ModuleFilter::FilterList<T>::match(
     ModuleFilter::FilterList<T> const& other) const {
-  for (unsigned i = 0; this->count(); i++) {
-    for (unsigned j = i; other.count(); j++)
-      if (this->filters()[i].match(other.filters()[j])) return true;
+  return match_count(other) != 0;
+}
+
+template <class T>
+unsigned ModuleFilter::FilterList<T>::match_count(
+    ModuleFilter::FilterList<T> const& other) const {
+  unsigned matches = 0;
+  for (auto const& own : this->filters()) {
+    for (auto const& theirs : other.filters()) {
+      if (own.match(theirs)) {
+        matches++;
+        break;
+      }
+    }
   }
 
-  return false;
+  return matches;
 }
 
 template <class T>
@@ -0,0 +1,236 @@
+#include "cec/outbox.hpp"
+
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <filesystem>
+#include <iomanip>
+#include <set>
+#include <sstream>
+#include <system_error>
+
+namespace fs = std::filesystem;
+
+namespace streetpass::cec {
+
+const std::string Outbox::OUTBOX_DIR("OutBox__");
+
+namespace {
+const std::string BOX_INFO_FILE("MBoxInfo____");
+const std::string INDEX_FILE("OBIndex_____");
+
+constexpr uint32_t DIR_EVENTS =
+    IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR;
+constexpr uint32_t BOX_EVENTS = DIR_EVENTS | IN_CLOSE_WRITE;
+
+bool parse_title_id(std::string const& name, tid_type& title_id) {
+  if (name.size() != 8 ||
+      !std::all_of(name.begin(), name.end(),
+                   [](unsigned char c) { return std::isxdigit(c); }))
+    return false;
+
+  title_id = std::stoul(name, nullptr, 16);
+  return true;
+}
+
+bool same_mtime(timespec const& a, timespec const& b) {
+  return a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
+}
+}  // namespace
+
+Outbox::Outbox(std::string const& root) : m_root(root) {
+  m_inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (m_inotify_fd < 0)
+    throw std::system_error(errno, std::generic_category(),
+                            "Failed to initialize inotify");
+
+  m_root_wd = inotify_add_watch(m_inotify_fd, m_root.c_str(), DIR_EVENTS);
+  if (m_root_wd < 0) {
+    int err = errno;
+    close(m_inotify_fd);
+    throw std::system_error(err, std::generic_category(),
+                            "Failed to watch " + m_root);
+  }
+
+  std::error_code ec;
+  for (auto const& entry : fs::directory_iterator(m_root, ec)) {
+    tid_type title_id;
+    if (!entry.is_directory(ec) ||
+        !parse_title_id(entry.path().filename().string(), title_id))
+      continue;
+
+    watch_title(title_id, entry.path().filename().string());
+    reload(title_id);
+  }
+}
+
+Outbox::~Outbox() { close(m_inotify_fd); }
+
+std::string Outbox::title_path(tid_type title_id) const {
+  auto it = m_dirs.find(title_id);
+  if (it != m_dirs.end()) return m_root + "/" + it->second;
+
+  std::stringstream ss;
+  ss << m_root << "/" << std::hex << std::uppercase << std::setfill('0')
+     << std::setw(8) << title_id;
+  return ss.str();
+}
+
+void Outbox::watch_title(tid_type title_id, std::string const& dir) {
+  m_dirs[title_id] = dir;
+  std::string path = title_path(title_id);
+
+  // the title directory announces the creation of its outbox
+  int wd = inotify_add_watch(m_inotify_fd, path.c_str(), DIR_EVENTS);
+  if (wd >= 0) m_watches[wd] = title_id;
+
+  path += "/" + OUTBOX_DIR;
+  wd = inotify_add_watch(m_inotify_fd, path.c_str(), BOX_EVENTS);
+  if (wd >= 0) m_watches[wd] = title_id;
+}
+
+void Outbox::reload(tid_type title_id) {
+  std::shared_ptr<const title_box> previous = find(title_id);
+
+  auto box = std::make_shared<title_box>();
+  box->title_id = title_id;
+
+  std::error_code ec;
+  for (auto const& entry :
+       fs::directory_iterator(title_path(title_id) + "/" + OUTBOX_DIR, ec)) {
+    std::string name = entry.path().filename().string();
+    if (!entry.is_regular_file(ec) || name == BOX_INFO_FILE ||
+        name == INDEX_FILE)
+      continue;
+
+    struct stat st;
+    if (stat(entry.path().c_str(), &st) < 0) continue;
+
+    // unchanged messages keep their mapping
+    if (previous) {
+      auto it = std::find_if(
+          previous->messages.begin(), previous->messages.end(),
+          [&name](message const& m) { return m.name == name; });
+      if (it != previous->messages.end() &&
+          it->file->size() == static_cast<std::size_t>(st.st_size) &&
+          same_mtime(it->mtime, st.st_mtim)) {
+        box->messages.push_back(*it);
+        continue;
+      }
+    }
+
+    try {
+      auto file = std::make_shared<const MappedFile>(entry.path().string(),
+                                                     COPY_BELOW);
+      MessageView view =
+          Parser<MessageView>::from_bytes(file->data(), file->size());
+      box->messages.push_back({name, file, view, st.st_mtim});
+    } catch (const char*) {
+      // malformed or partially written message, skipped until rewritten
+    } catch (std::system_error&) {
+      // removed while being loaded
+    }
+  }
+
+  std::sort(box->messages.begin(), box->messages.end(),
+            [](message const& a, message const& b) { return a.name < b.name; });
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (box->messages.empty())
+    m_boxes.erase(title_id);
+  else
+    m_boxes[title_id] = std::move(box);
+}
+
+std::shared_ptr<const Outbox::title_box> Outbox::find(
+    tid_type title_id) const {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto it = m_boxes.find(title_id);
+  return it == m_boxes.end() ? nullptr : it->second;
+}
+
+std::vector<std::shared_ptr<const Outbox::title_box>> Outbox::for_peer(
+    ModuleFilter const& peer) const {
+  std::vector<std::shared_ptr<const title_box>> boxes;
+  for (auto const& filter : peer.title_filters().filters()) {
+    auto box = find(filter.title_id());
+    if (box) boxes.push_back(std::move(box));
+  }
+  return boxes;
+}
+
+std::size_t Outbox::size() const {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_boxes.size();
+}
+
+std::size_t Outbox::process_events() {
+  alignas(inotify_event) char buffer[4096];
+  std::set<tid_type> dirty;
+  bool rescan = false;
+
+  while (true) {
+    ssize_t len = read(m_inotify_fd, buffer, sizeof(buffer));
+    if (len < 0) {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN) break;
+      throw std::system_error(errno, std::generic_category(),
+                              "Failed to read inotify events");
+    }
+
+    for (char* p = buffer; p < buffer + len;) {
+      auto event = reinterpret_cast<inotify_event*>(p);
+      p += sizeof(inotify_event) + event->len;
+
+      if (event->mask & IN_Q_OVERFLOW) {
+        rescan = true;
+        continue;
+      }
+      if (event->mask & IN_IGNORED) {
+        m_watches.erase(event->wd);
+        continue;
+      }
+
+      std::string name = event->len ? event->name : "";
+      if (event->wd == m_root_wd) {
+        tid_type title_id;
+        if (!parse_title_id(name, title_id)) continue;
+
+        if (event->mask & (IN_CREATE | IN_MOVED_TO))
+          watch_title(title_id, name);
+        dirty.insert(title_id);
+        continue;
+      }
+
+      auto it = m_watches.find(event->wd);
+      if (it == m_watches.end()) continue;
+
+      if (name == OUTBOX_DIR && (event->mask & (IN_CREATE | IN_MOVED_TO)))
+        watch_title(it->second, m_dirs[it->second]);
+      dirty.insert(it->second);
+    }
+  }
+
+  if (rescan) {
+    // events were lost, fall back to a full scan
+    std::error_code ec;
+    for (auto const& entry : fs::directory_iterator(m_root, ec)) {
+      tid_type title_id;
+      if (entry.is_directory(ec) &&
+          parse_title_id(entry.path().filename().string(), title_id)) {
+        watch_title(title_id, entry.path().filename().string());
+        dirty.insert(title_id);
+      }
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto const& [title_id, box] : m_boxes) dirty.insert(title_id);
+  }
+
+  for (tid_type title_id : dirty) reload(title_id);
+  return dirty.size();
+}
+}  // namespace streetpass::cec
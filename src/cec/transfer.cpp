@@ -0,0 +1,306 @@
+#include "cec/transfer.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+
+using Tins::Memory::InputMemoryStream;
+using Tins::Memory::OutputMemoryStream;
+
+namespace streetpass::cec {
+
+namespace {
+constexpr std::array<uint32_t, 256> make_crc_table() {
+  std::array<uint32_t, 256> table{};
+  for (uint32_t i = 0; i < 256; ++i) {
+    uint32_t c = i;
+    for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+    table[i] = c;
+  }
+  return table;
+}
+
+constexpr std::array<uint32_t, 256> CRC_TABLE = make_crc_table();
+}  // namespace
+
+uint32_t crc32(const uint8_t* data, std::size_t size, uint32_t crc) {
+  crc = ~crc;
+  for (std::size_t i = 0; i < size; ++i)
+    crc = CRC_TABLE[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+  return ~crc;
+}
+
+TransferFrame TransferFrame::from_stream(InputMemoryStream& stream) {
+  TransferFrame frame;
+  if (!stream.can_read(sizeof(frame.m_internal))) throw "bad transfer frame";
+  stream.read(&frame.m_internal, sizeof(frame.m_internal));
+
+  if (frame.m_internal.magic != MAGIC) throw "bad transfer frame magic";
+
+  switch (frame.frame_type()) {
+    case type::DATA:
+      if (frame.chunk_size() == 0 || frame.length() > frame.chunk_size() ||
+          frame.index() >= frame.chunk_count())
+        throw "bad transfer frame chunk";
+      if (!stream.can_read(frame.length())) throw "bad transfer frame length";
+      frame.m_payload = stream.pointer();
+      stream.skip(frame.length());
+      break;
+    case type::ACK:
+      if (frame.length() != 0) throw "bad transfer frame length";
+      break;
+    default:
+      throw "bad transfer frame type";
+  }
+
+  return frame;
+}
+
+TransferFrame TransferFrame::data(uint32_t transfer_id, uint32_t index,
+                                  uint32_t chunk_count, uint16_t chunk_size,
+                                  uint32_t payload_crc,
+                                  const uint8_t* payload, uint16_t length) {
+  TransferFrame frame;
+  std::memset(&frame.m_internal, 0, sizeof(frame.m_internal));
+  frame.m_internal.magic = MAGIC;
+  frame.m_internal.type = static_cast<uint8_t>(type::DATA);
+  frame.m_internal.transfer_id = transfer_id;
+  frame.m_internal.index = index;
+  frame.m_internal.chunk_count = chunk_count;
+  frame.m_internal.chunk_size = chunk_size;
+  frame.m_internal.chunk_crc = crc32(payload, length);
+  frame.m_internal.payload_crc = payload_crc;
+  frame.m_internal.length = length;
+  frame.m_payload = payload;
+  return frame;
+}
+
+TransferFrame TransferFrame::ack(uint32_t transfer_id, uint32_t next_index,
+                                 uint32_t sack) {
+  TransferFrame frame;
+  std::memset(&frame.m_internal, 0, sizeof(frame.m_internal));
+  frame.m_internal.magic = MAGIC;
+  frame.m_internal.type = static_cast<uint8_t>(type::ACK);
+  frame.m_internal.transfer_id = transfer_id;
+  frame.m_internal.index = next_index;
+  frame.m_internal.sack = sack;
+  return frame;
+}
+
+TransferFrame::type TransferFrame::frame_type() const {
+  return static_cast<type>(m_internal.type);
+}
+
+uint32_t TransferFrame::transfer_id() const { return m_internal.transfer_id; }
+
+uint32_t TransferFrame::index() const { return m_internal.index; }
+
+uint32_t TransferFrame::chunk_count() const { return m_internal.chunk_count; }
+
+uint16_t TransferFrame::chunk_size() const { return m_internal.chunk_size; }
+
+uint32_t TransferFrame::sack() const { return m_internal.sack; }
+
+uint32_t TransferFrame::chunk_crc() const { return m_internal.chunk_crc; }
+
+uint32_t TransferFrame::payload_crc() const { return m_internal.payload_crc; }
+
+uint16_t TransferFrame::length() const { return m_internal.length; }
+
+TransferFrame::operator bytes() const {
+  bytes buffer(byte_size());
+  OutputMemoryStream stream(buffer);
+  stream.write(m_internal);
+  if (length() != 0) stream.write(m_payload, length());
+  return buffer;
+}
+
+std::ostream& operator<<(std::ostream& s, const TransferFrame& f) {
+  std::stringstream ss;
+  ss << "Transfer " << std::hex << std::setfill('0') << std::setw(8)
+     << f.transfer_id() << std::dec;
+  if (f.frame_type() == TransferFrame::type::DATA)
+    ss << ": DATA " << f.index() << "/" << f.chunk_count()
+       << ", length=" << f.length();
+  else
+    ss << ": ACK next=" << f.index() << ", sack=" << std::hex
+       << std::setw(8) << f.sack();
+
+  s << ss.str();
+  return s;
+}
+
+TransferSender::TransferSender(uint32_t transfer_id, const uint8_t* payload,
+                               std::size_t size, send_fn send,
+                               uint16_t chunk_size, std::size_t window,
+                               std::chrono::milliseconds retransmit_timeout)
+    : m_transfer_id(transfer_id),
+      m_payload(payload),
+      m_size(size),
+      m_send(std::move(send)),
+      m_chunk_size(chunk_size),
+      m_window(window),
+      m_retransmit_timeout(retransmit_timeout) {
+  if (m_chunk_size == 0) throw "bad transfer chunk size";
+  if ((m_size + m_chunk_size - 1) / m_chunk_size > UINT32_MAX)
+    throw "transfer too large";
+
+  // an empty payload still takes one chunk to be delivered
+  m_chunk_count = std::max<std::size_t>(
+      1, (m_size + m_chunk_size - 1) / m_chunk_size);
+  m_payload_crc = crc32(m_payload, m_size);
+  m_acked.resize(m_chunk_count, false);
+  m_sent.resize(m_chunk_count);
+}
+
+void TransferSender::send_chunk(uint32_t index, clock::time_point now) {
+  std::size_t offset = std::size_t(index) * m_chunk_size;
+  uint16_t length = std::min<std::size_t>(m_chunk_size, m_size - offset);
+
+  if (m_sent[index] == clock::time_point()) ++m_in_flight;
+  m_sent[index] = now;
+
+  m_send(bytes(TransferFrame::data(m_transfer_id, index, m_chunk_count,
+                                   m_chunk_size, m_payload_crc,
+                                   m_payload + offset, length)));
+}
+
+void TransferSender::pump(clock::time_point now) {
+  // holes first: chunks lost in flight or dropped by resume()
+  for (uint32_t i = m_base; i < m_next; ++i) {
+    if (m_acked[i]) continue;
+
+    bool lost = m_sent[i] == clock::time_point();
+    if (lost ? m_in_flight < m_window
+             : now - m_sent[i] >= m_retransmit_timeout) {
+      send_chunk(i, now);
+      ++m_retransmissions;
+    }
+  }
+
+  // a resumed receiver may already hold chunks past a hole
+  while (m_next < m_chunk_count && m_in_flight < m_window) {
+    if (!m_acked[m_next]) send_chunk(m_next, now);
+    ++m_next;
+  }
+}
+
+void TransferSender::mark_acked(uint32_t index) {
+  if (m_acked[index]) return;
+
+  m_acked[index] = true;
+  ++m_acked_count;
+  if (m_sent[index] != clock::time_point()) {
+    m_sent[index] = clock::time_point();
+    --m_in_flight;
+  }
+}
+
+void TransferSender::on_frame(TransferFrame const& frame) {
+  if (frame.frame_type() != TransferFrame::type::ACK ||
+      frame.transfer_id() != m_transfer_id)
+    return;
+
+  uint32_t next = std::min(frame.index(), m_chunk_count);
+  for (uint32_t i = m_base; i < next; ++i) mark_acked(i);
+
+  for (unsigned bit = 0; bit < TransferFrame::SACK_BITS; ++bit) {
+    uint64_t i = uint64_t(next) + 1 + bit;
+    if (i >= m_chunk_count) break;
+    if (frame.sack() & (1u << bit)) mark_acked(i);
+  }
+
+  while (m_base < m_chunk_count && m_acked[m_base]) ++m_base;
+  // the receiver may be ahead of us when resuming an earlier transfer
+  m_next = std::max(m_next, m_base);
+}
+
+void TransferSender::resume() {
+  for (uint32_t i = m_base; i < m_next; ++i)
+    m_sent[i] = clock::time_point();
+  m_in_flight = 0;
+}
+
+TransferReceiver::TransferReceiver(uint32_t transfer_id, send_fn send,
+                                   std::size_t max_size, unsigned ack_every)
+    : m_transfer_id(transfer_id),
+      m_send(std::move(send)),
+      m_max_size(max_size),
+      m_ack_every(std::max(1u, ack_every)) {}
+
+uint32_t TransferReceiver::sack() const {
+  uint32_t bits = 0;
+  for (unsigned bit = 0; bit < TransferFrame::SACK_BITS; ++bit) {
+    uint64_t i = uint64_t(m_next) + 1 + bit;
+    if (i >= m_chunk_count) break;
+    if (m_received[i]) bits |= 1u << bit;
+  }
+  return bits;
+}
+
+void TransferReceiver::flush_ack() {
+  m_unacked = 0;
+  m_send(bytes(TransferFrame::ack(m_transfer_id, m_next, sack())));
+}
+
+void TransferReceiver::on_frame(TransferFrame const& frame) {
+  if (frame.frame_type() != TransferFrame::type::DATA ||
+      frame.transfer_id() != m_transfer_id)
+    return;
+
+  if (m_chunk_count == 0) {
+    if (uint64_t(frame.chunk_count() - 1) * frame.chunk_size() >= m_max_size)
+      throw "transfer exceeds maximum size";
+
+    m_chunk_count = frame.chunk_count();
+    m_chunk_size = frame.chunk_size();
+    m_payload_crc = frame.payload_crc();
+    m_payload.resize(std::min<uint64_t>(
+        uint64_t(m_chunk_count) * m_chunk_size, m_max_size));
+    m_received.resize(m_chunk_count, false);
+  } else if (frame.chunk_count() != m_chunk_count ||
+             frame.chunk_size() != m_chunk_size ||
+             frame.payload_crc() != m_payload_crc) {
+    throw "inconsistent transfer frame";
+  }
+
+  uint32_t index = frame.index();
+  bool last = index == m_chunk_count - 1;
+  if (!last && frame.length() != m_chunk_size)
+    throw "bad transfer frame length";
+
+  std::size_t offset = std::size_t(index) * m_chunk_size;
+  if (offset + frame.length() > m_payload.size())
+    throw "transfer exceeds maximum size";
+
+  // corrupted chunks are left unacknowledged
+  if (crc32(frame.payload(), frame.length()) != frame.chunk_crc()) return;
+
+  if (m_received[index]) {
+    // our acknowledgement was lost, repeat it right away
+    flush_ack();
+    return;
+  }
+
+  std::memcpy(m_payload.data() + offset, frame.payload(), frame.length());
+  m_received[index] = true;
+  ++m_received_count;
+  if (last) m_payload.resize(offset + frame.length());
+
+  bool in_order = index == m_next;
+  while (m_next < m_chunk_count && m_received[m_next]) {
+    std::size_t begin = std::size_t(m_next) * m_chunk_size;
+    std::size_t end = std::min(begin + m_chunk_size, m_payload.size());
+    m_running_crc = crc32(m_payload.data() + begin, end - begin, m_running_crc);
+    ++m_next;
+  }
+
+  if (done() && m_running_crc != m_payload_crc)
+    throw "bad transfer payload crc";
+
+  // holes and completion are reported at once so the sender reacts early
+  if (!in_order || done() || ++m_unacked >= m_ack_every) flush_ack();
+}
+}  // namespace streetpass::cec
@@ -0,0 +1,291 @@
+#include "crypto/ccmp.hpp"
+
+#include <algorithm>
+
+namespace streetpass::crypto {
+using namespace CryptoPP;
+
+namespace {
+constexpr std::size_t BLOCK_SIZE = AES::BLOCKSIZE;
+// number of frames processed in lock-step
+constexpr std::size_t BATCH_SIZE = 64;
+
+constexpr std::uint8_t FC_TYPE_MASK = 0x0c;
+constexpr std::uint8_t FC_TYPE_DATA = 0x08;
+constexpr std::uint8_t FC_SUBTYPE_QOS = 0x80;
+constexpr std::uint8_t FC_SUBTYPE_MASK_BITS = 0x70;
+constexpr std::uint8_t FC_TO_FROM_DS = 0x03;
+constexpr std::uint8_t FC_RETRY = 0x08;
+constexpr std::uint8_t FC_PWR_MGT = 0x10;
+constexpr std::uint8_t FC_MORE_DATA = 0x20;
+constexpr std::uint8_t FC_PROTECTED = 0x40;
+constexpr std::uint8_t FC_ORDER = 0x80;
+constexpr std::uint8_t EXT_IV = 0x20;
+
+// CCM flags: Adata, M = 8 ((8 - 2) / 2 << 3) and L = 2 (2 - 1)
+constexpr std::uint8_t B0_FLAGS = 0x59;
+constexpr std::uint8_t CTR_FLAGS = 0x01;
+
+struct mac_header {
+  std::size_t size;
+  bool data;
+  bool qos;
+  bool a4;
+  std::size_t qos_offset;
+};
+
+bool parse_mac_header(const std::uint8_t* data, std::size_t size,
+                      mac_header& hdr) {
+  if (size < 24) return false;
+
+  hdr.data = (data[0] & FC_TYPE_MASK) == FC_TYPE_DATA;
+  hdr.qos = hdr.data && (data[0] & FC_SUBTYPE_QOS);
+  hdr.a4 = (data[1] & FC_TO_FROM_DS) == FC_TO_FROM_DS;
+  hdr.size = hdr.a4 ? 30 : 24;
+  hdr.qos_offset = hdr.size;
+  if (hdr.qos) hdr.size += 2;
+  // HT control field
+  if (hdr.qos && (data[1] & FC_ORDER)) hdr.size += 4;
+
+  return size >= hdr.size + CcmpEngine::HEADER_SIZE + CcmpEngine::MIC_SIZE;
+}
+
+std::size_t blocks(std::size_t size) {
+  return (size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+}
+}  // namespace
+
+struct CcmpEngine::job {
+  std::uint8_t* payload;
+  std::size_t payload_size;
+  std::uint8_t* mic;
+  std::array<std::uint8_t, 13> nonce;
+  // B0 followed by the length-prefixed AAD, zero padded
+  std::array<std::uint8_t, 3 * BLOCK_SIZE> prefix;
+  std::size_t prefix_blocks;
+  std::array<std::uint8_t, BLOCK_SIZE> mac;
+  // offset of the A_0 keystream block in the batch keystream
+  std::size_t stream_offset;
+
+  std::size_t mac_blocks() const {
+    return prefix_blocks + blocks(payload_size);
+  }
+
+  void mac_block(std::size_t k, std::uint8_t* out) const {
+    if (k < prefix_blocks) {
+      std::copy_n(prefix.begin() + k * BLOCK_SIZE, BLOCK_SIZE, out);
+      return;
+    }
+
+    std::size_t offset = (k - prefix_blocks) * BLOCK_SIZE;
+    std::size_t len = std::min(BLOCK_SIZE, payload_size - offset);
+    std::fill_n(std::copy_n(payload + offset, len, out), BLOCK_SIZE - len, 0);
+  }
+
+  bool setup(ccmp_frame& frame, bool encrypt);
+};
+
+bool CcmpEngine::job::setup(ccmp_frame& frame, bool encrypt) {
+  std::uint8_t* data = frame.data;
+  mac_header hdr;
+  if (!parse_mac_header(data, frame.size, hdr)) return false;
+
+  std::uint8_t* ccmp_hdr = data + hdr.size;
+  if (encrypt) {
+    data[1] |= FC_PROTECTED;
+    ccmp_hdr[0] = frame.pn;
+    ccmp_hdr[1] = frame.pn >> 8;
+    ccmp_hdr[2] = 0;
+    ccmp_hdr[3] = EXT_IV | ((frame.key_id & 0x3) << 6);
+    for (int i = 0; i < 4; i++) ccmp_hdr[4 + i] = frame.pn >> (16 + 8 * i);
+  } else {
+    if (!(ccmp_hdr[3] & EXT_IV)) return false;
+    frame.key_id = ccmp_hdr[3] >> 6;
+    frame.pn = std::uint64_t(ccmp_hdr[0]) | std::uint64_t(ccmp_hdr[1]) << 8;
+    for (int i = 0; i < 4; i++)
+      frame.pn |= std::uint64_t(ccmp_hdr[4 + i]) << (16 + 8 * i);
+  }
+
+  payload = ccmp_hdr + HEADER_SIZE;
+  payload_size = frame.size - hdr.size - HEADER_SIZE - MIC_SIZE;
+  mic = payload + payload_size;
+
+  // nonce: priority, A2, PN5..PN0
+  nonce[0] = hdr.qos ? data[hdr.qos_offset] & 0x0f : 0;
+  std::copy_n(data + 10, 6, nonce.begin() + 1);
+  for (int i = 0; i < 6; i++) nonce[7 + i] = frame.pn >> (8 * (5 - i));
+
+  // AAD: masked frame control, A1 to A3, masked sequence control, A4 and
+  // masked QoS control
+  std::array<std::uint8_t, 30> aad = {};
+  std::size_t aad_size = 0;
+  aad[aad_size++] = hdr.data ? data[0] & ~FC_SUBTYPE_MASK_BITS : data[0];
+  std::uint8_t flags = data[1] & ~(FC_RETRY | FC_PWR_MGT | FC_MORE_DATA);
+  if (hdr.qos) flags &= ~FC_ORDER;
+  aad[aad_size++] = flags | FC_PROTECTED;
+  std::copy_n(data + 4, 18, aad.begin() + aad_size);
+  aad_size += 18;
+  aad[aad_size++] = data[22] & 0x0f;
+  aad[aad_size++] = 0;
+  if (hdr.a4) {
+    std::copy_n(data + 24, 6, aad.begin() + aad_size);
+    aad_size += 6;
+  }
+  if (hdr.qos) {
+    aad[aad_size++] = data[hdr.qos_offset] & 0x0f;
+    aad[aad_size++] = 0;
+  }
+
+  prefix.fill(0);
+  prefix[0] = B0_FLAGS;
+  std::copy(nonce.begin(), nonce.end(), prefix.begin() + 1);
+  prefix[14] = payload_size >> 8;
+  prefix[15] = payload_size;
+  prefix[16] = aad_size >> 8;
+  prefix[17] = aad_size;
+  std::copy_n(aad.begin(), aad_size, prefix.begin() + 18);
+  prefix_blocks = 1 + blocks(2 + aad_size);
+
+  mac.fill(0);
+  return true;
+}
+
+CcmpEngine::CcmpEngine(std::array<std::uint8_t, 16> const& temporal_key)
+    : m_aes(temporal_key.data(), temporal_key.size()) {}
+
+// Advances the CBC-MAC of every job one block at a time, all jobs sharing a
+// single AES call per step.
+void CcmpEngine::cbc_mac(std::vector<job>& jobs) const {
+  std::size_t steps = 0;
+  for (auto const& j : jobs) steps = std::max(steps, j.mac_blocks());
+
+  std::vector<std::uint8_t> in(jobs.size() * BLOCK_SIZE);
+  std::vector<job*> active;
+  active.reserve(jobs.size());
+
+  for (std::size_t k = 0; k < steps; k++) {
+    active.clear();
+    for (auto& j : jobs) {
+      if (k >= j.mac_blocks()) continue;
+
+      std::uint8_t* block = in.data() + active.size() * BLOCK_SIZE;
+      j.mac_block(k, block);
+      for (std::size_t i = 0; i < BLOCK_SIZE; i++) block[i] ^= j.mac[i];
+      active.push_back(&j);
+    }
+
+    m_aes.AdvancedProcessBlocks(in.data(), nullptr, in.data(),
+                                active.size() * BLOCK_SIZE,
+                                BlockTransformation::BT_AllowParallel);
+
+    for (std::size_t n = 0; n < active.size(); n++)
+      std::copy_n(in.data() + n * BLOCK_SIZE, BLOCK_SIZE,
+                  active[n]->mac.begin());
+  }
+}
+
+// Produces the A_0..A_m keystream of every job with a single AES call.
+void CcmpEngine::keystream(std::vector<job>& jobs,
+                           std::vector<std::uint8_t>& stream) const {
+  std::size_t total = 0;
+  for (auto& j : jobs) {
+    j.stream_offset = total;
+    total += (1 + blocks(j.payload_size)) * BLOCK_SIZE;
+  }
+
+  stream.assign(total, 0);
+  for (auto const& j : jobs) {
+    std::size_t count = 1 + blocks(j.payload_size);
+    for (std::size_t i = 0; i < count; i++) {
+      std::uint8_t* ctr = stream.data() + j.stream_offset + i * BLOCK_SIZE;
+      ctr[0] = CTR_FLAGS;
+      std::copy(j.nonce.begin(), j.nonce.end(), ctr + 1);
+      ctr[14] = i >> 8;
+      ctr[15] = i;
+    }
+  }
+
+  if (total)
+    m_aes.AdvancedProcessBlocks(stream.data(), nullptr, stream.data(), total,
+                                BlockTransformation::BT_AllowParallel);
+}
+
+void CcmpEngine::process(std::vector<ccmp_frame>& frames, std::size_t first,
+                         std::size_t count, bool encrypt) const {
+  std::vector<job> jobs;
+  std::vector<ccmp_frame*> owners;
+  jobs.reserve(count);
+  for (std::size_t i = first; i < first + count; i++) {
+    job j;
+    frames[i].valid = false;
+    if (!j.setup(frames[i], encrypt)) continue;
+    jobs.push_back(j);
+    owners.push_back(&frames[i]);
+  }
+
+  std::vector<std::uint8_t> stream;
+  keystream(jobs, stream);
+
+  auto apply_keystream = [&stream](job const& j) {
+    const std::uint8_t* ks = stream.data() + j.stream_offset + BLOCK_SIZE;
+    for (std::size_t i = 0; i < j.payload_size; i++) j.payload[i] ^= ks[i];
+  };
+
+  // the MIC always covers the plaintext
+  if (!encrypt)
+    for (auto const& j : jobs) apply_keystream(j);
+
+  cbc_mac(jobs);
+
+  for (std::size_t n = 0; n < jobs.size(); n++) {
+    job const& j = jobs[n];
+    const std::uint8_t* s0 = stream.data() + j.stream_offset;
+
+    if (encrypt) {
+      for (std::size_t i = 0; i < MIC_SIZE; i++) j.mic[i] = j.mac[i] ^ s0[i];
+      apply_keystream(j);
+      owners[n]->valid = true;
+      continue;
+    }
+
+    std::uint8_t diff = 0;
+    for (std::size_t i = 0; i < MIC_SIZE; i++)
+      diff |= j.mic[i] ^ j.mac[i] ^ s0[i];
+
+    if (diff == 0)
+      owners[n]->valid = true;
+    else
+      apply_keystream(j);  // leave forged frames as they were
+  }
+}
+
+bool CcmpEngine::decrypt(ccmp_frame& frame) const {
+  std::vector<ccmp_frame> frames = {frame};
+  process(frames, 0, 1, false);
+  frame = frames[0];
+  return frame.valid;
+}
+
+bool CcmpEngine::encrypt(ccmp_frame& frame) const {
+  std::vector<ccmp_frame> frames = {frame};
+  process(frames, 0, 1, true);
+  frame = frames[0];
+  return frame.valid;
+}
+
+std::size_t CcmpEngine::decrypt_many(std::vector<ccmp_frame>& frames) const {
+  for (std::size_t i = 0; i < frames.size(); i += BATCH_SIZE)
+    process(frames, i, std::min(BATCH_SIZE, frames.size() - i), false);
+
+  return std::count_if(frames.begin(), frames.end(),
+                       [](auto const& f) { return f.valid; });
+}
+
+std::size_t CcmpEngine::encrypt_many(std::vector<ccmp_frame>& frames) const {
+  for (std::size_t i = 0; i < frames.size(); i += BATCH_SIZE)
+    process(frames, i, std::min(BATCH_SIZE, frames.size() - i), true);
+
+  return std::count_if(frames.begin(), frames.end(),
+                       [](auto const& f) { return f.valid; });
+}
+}  // namespace streetpass::crypto
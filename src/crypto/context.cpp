@@ -0,0 +1,61 @@
+#include "crypto/context.hpp"
+
+#include <cryptopp/files.h>
+#include <cryptopp/filters.h>
+#include <cryptopp/hmac.h>
+#include <cryptopp/sha.h>
+
+#include "metrics/registry.hpp"
+
+namespace streetpass::crypto {
+using namespace CryptoPP;
+
+namespace {
+metrics::Counter& key_derivations() {
+  static auto& counter = metrics::registry().counter(
+      "streetpass_key_derivations_total", "CCMP keys derived.");
+  return counter;
+}
+}  // namespace
+
+CryptoContext::CryptoContext(std::array<std::uint8_t, 16> const& normal_key,
+                             std::array<std::uint8_t, 17> const& cecd_key)
+    : m_normal_key(normal_key),
+      m_cecd_key(cecd_key),
+      m_aes(m_normal_key.data(), m_normal_key.size()) {}
+
+CryptoContext CryptoContext::from_files(std::string const& normal_key_path,
+                                        std::string const& cecd_key_path) {
+  std::array<std::uint8_t, 16> normal_key = {};
+  FileSource fs1(normal_key_path.c_str(), true,
+                 new ArraySink(normal_key.data(), normal_key.size()));
+
+  std::array<std::uint8_t, 17> cecd_key = {};
+  FileSource fs2(cecd_key_path.c_str(), true,
+                 new ArraySink(cecd_key.data(), cecd_key.size()));
+
+  return CryptoContext(normal_key, cecd_key);
+}
+
+std::array<std::uint8_t, 16> CryptoContext::streetpass_ccmp_key(
+    std::array<std::uint8_t, 8> const& master_key,
+    std::array<std::uint8_t, 6> const& master_mac,
+    std::array<std::uint8_t, 8> const& client_key,
+    std::array<std::uint8_t, 6> const& client_mac) const {
+  // the HMAC object is stateful, each derivation keys its own
+  HMAC<SHA1> hmac(m_cecd_key.data(), m_cecd_key.size());
+  hmac.Update(master_key.data(), master_key.size());
+  hmac.Update(client_key.data(), client_key.size());
+  hmac.Update(master_mac.data(), master_mac.size());
+  hmac.Update(client_mac.data(), client_mac.size());
+
+  std::array<std::uint8_t, AES::BLOCKSIZE> ctr = {};
+  hmac.TruncatedFinal(ctr.data(), ctr.size());
+
+  // CTR keystream of a single zero block
+  std::array<std::uint8_t, AES::BLOCKSIZE> ccmp_key = {};
+  m_aes.ProcessBlock(ctr.data(), ccmp_key.data());
+  key_derivations().inc();
+  return ccmp_key;
+}
+}  // namespace streetpass::crypto
@@ -1,38 +1,64 @@
 #include "crypto/crypto.hpp"
 
-#include <cryptopp/aes.h>
 #include <cryptopp/files.h>
 #include <cryptopp/filters.h>
-#include <cryptopp/hex.h>
-#include <cryptopp/hmac.h>
-#include <cryptopp/modes.h>
-#include <cryptopp/secblock.h>
-#include <cryptopp/sha.h>
+
+#include <atomic>
+#include <mutex>
 
 namespace streetpass::crypto {
 using namespace CryptoPP;
 
-SecByteBlock normal_key(0x00, AES::BLOCKSIZE);
-SecByteBlock cecd_key(0x00, 17);
+namespace {
+std::shared_ptr<const CryptoContext> current_context =
+    std::make_shared<const CryptoContext>(std::array<std::uint8_t, 16>{},
+                                          std::array<std::uint8_t, 17>{});
+std::atomic<std::uint64_t> generation(0);
+// serializes the updates, readers only load current_context
+std::mutex update_mutex;
+
+void publish(std::shared_ptr<const CryptoContext> context) {
+  std::atomic_store(&current_context, std::move(context));
+  generation++;
+}
+
+template <std::size_t N>
+std::array<std::uint8_t, N> read_key_file(std::string const& filepath) {
+  std::array<std::uint8_t, N> key = {};
+  FileSource fs(filepath.c_str(), true, new ArraySink(key.data(), key.size()));
+  return key;
+}
+}  // namespace
+
+std::shared_ptr<const CryptoContext> default_context() {
+  return std::atomic_load(&current_context);
+}
+
+void set_default_context(std::shared_ptr<const CryptoContext> context) {
+  std::lock_guard<std::mutex> lock(update_mutex);
+  publish(std::move(context));
+}
+
+std::uint64_t key_generation() { return generation; }
 
 void load_normal_key(std::string const& filepath) {
-  FileSource fs(filepath.c_str(), true,
-                new ArraySink(normal_key.begin(), normal_key.size()));
+  load_normal_key(read_key_file<16>(filepath));
 }
 
 void load_normal_key(std::array<std::uint8_t, 16> const& key) {
-  ArraySource as(key.data(), key.size(), true,
-                 new ArraySink(normal_key.begin(), normal_key.size()));
+  std::lock_guard<std::mutex> lock(update_mutex);
+  auto ctx = default_context();
+  publish(std::make_shared<const CryptoContext>(key, ctx->cecd_key()));
 }
 
 void load_cecd_key(std::string const& filepath) {
-  FileSource fs(filepath.c_str(), true,
-                new ArraySink(cecd_key.begin(), cecd_key.size()));
+  load_cecd_key(read_key_file<17>(filepath));
 }
 
 void load_cecd_key(std::array<std::uint8_t, 17> const& key) {
-  ArraySource as(key.data(), key.size(), true,
-                 new ArraySink(cecd_key.begin(), cecd_key.size()));
+  std::lock_guard<std::mutex> lock(update_mutex);
+  auto ctx = default_context();
+  publish(std::make_shared<const CryptoContext>(ctx->normal_key(), key));
 }
 
 std::array<std::uint8_t, 16> streetpass_ccmp_key(
@@ -40,25 +66,7 @@ std::array<std::uint8_t, 16> streetpass_ccmp_key(
     std::array<std::uint8_t, 6> const& master_mac,
     std::array<std::uint8_t, 8> const& client_key,
     std::array<std::uint8_t, 6> const& client_mac) {
-  std::vector<std::uint8_t> hash_block;
-  hash_block.insert(hash_block.end(), master_key.begin(), master_key.end());
-  hash_block.insert(hash_block.end(), client_key.begin(), client_key.end());
-  hash_block.insert(hash_block.end(), master_mac.begin(), master_mac.end());
-  hash_block.insert(hash_block.end(), client_mac.begin(), client_mac.end());
-
-  std::array<std::uint8_t, AES::BLOCKSIZE> ctr = {};
-  HMAC<SHA1> hmac(cecd_key, cecd_key.size());
-  ArraySource as1(hash_block.data(), hash_block.size(), true,
-                  new HashFilter(hmac, new ArraySink(ctr.begin(), ctr.size())));
-
-  std::array<std::uint8_t, AES::BLOCKSIZE> null_block = {};
-  std::array<std::uint8_t, AES::BLOCKSIZE> ccmp_key = {};
-  CTR_Mode<AES>::Encryption e;
-  e.SetKeyWithIV(normal_key, normal_key.size(), ctr.data());
-
-  ArraySource as2(null_block.data(), null_block.size(), true,
-                  new StreamTransformationFilter(
-                      e, new ArraySink(ccmp_key.begin(), ccmp_key.size())));
-  return ccmp_key;
+  return default_context()->streetpass_ccmp_key(master_key, master_mac,
+                                                client_key, client_mac);
 }
 }  // namespace streetpass::crypto
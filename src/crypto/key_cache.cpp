@@ -0,0 +1,103 @@
+#include "crypto/key_cache.hpp"
+
+#include <algorithm>
+
+#include "crypto/crypto.hpp"
+#include "metrics/registry.hpp"
+
+namespace streetpass::crypto {
+
+namespace {
+metrics::Counter& lookups(const char* result) {
+  return metrics::registry().counter("streetpass_key_cache_lookups_total",
+                                     "Key cache lookups, by result.",
+                                     {{"result", result}});
+}
+}  // namespace
+
+KeyCache::KeyCache(std::size_t capacity)
+    : m_capacity(std::max<std::size_t>(capacity, 1)),
+      m_generation(key_generation()),
+      m_hits(0),
+      m_misses(0) {}
+
+std::size_t KeyCache::tuple_hash::operator()(
+    tuple_type const& t) const noexcept {
+  // FNV-1a
+  std::uint64_t h = 0xcbf29ce484222325;
+  for (auto b : t) {
+    h ^= b;
+    h *= 0x100000001b3;
+  }
+  return h;
+}
+
+void KeyCache::check_generation() {
+  std::uint64_t generation = key_generation();
+  if (generation == m_generation) return;
+
+  m_entries.clear();
+  m_index.clear();
+  m_generation = generation;
+}
+
+KeyCache::ccmp_key_type KeyCache::streetpass_ccmp_key(
+    std::array<std::uint8_t, 8> const& master_key,
+    std::array<std::uint8_t, 6> const& master_mac,
+    std::array<std::uint8_t, 8> const& client_key,
+    std::array<std::uint8_t, 6> const& client_mac) {
+  tuple_type t;
+  auto it = std::copy(master_key.begin(), master_key.end(), t.begin());
+  it = std::copy(master_mac.begin(), master_mac.end(), it);
+  it = std::copy(client_key.begin(), client_key.end(), it);
+  std::copy(client_mac.begin(), client_mac.end(), it);
+
+  std::uint64_t generation;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    check_generation();
+    generation = m_generation;
+
+    auto entry = m_index.find(t);
+    if (entry != m_index.end()) {
+      m_entries.splice(m_entries.begin(), m_entries, entry->second);
+      m_hits++;
+      static auto& hits = lookups("hit");
+      hits.inc();
+      return entry->second->second;
+    }
+  }
+
+  m_misses++;
+  static auto& misses = lookups("miss");
+  misses.inc();
+  ccmp_key_type key = crypto::streetpass_ccmp_key(master_key, master_mac,
+                                                  client_key, client_mac);
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  check_generation();
+  // derived from keys reloaded since, must not outlive this call
+  if (m_generation != generation) return key;
+  if (m_index.find(t) != m_index.end()) return key;
+
+  m_entries.emplace_front(t, key);
+  m_index[t] = m_entries.begin();
+  if (m_entries.size() > m_capacity) {
+    m_index.erase(m_entries.back().first);
+    m_entries.pop_back();
+  }
+
+  return key;
+}
+
+std::size_t KeyCache::size() const {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_entries.size();
+}
+
+void KeyCache::clear() {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_entries.clear();
+  m_index.clear();
+}
+}  // namespace streetpass::crypto
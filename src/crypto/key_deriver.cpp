@@ -0,0 +1,73 @@
+#include "crypto/key_deriver.hpp"
+
+#include "crypto/crypto.hpp"
+#include "metrics/registry.hpp"
+
+namespace streetpass::crypto {
+using namespace CryptoPP;
+
+namespace {
+metrics::Counter& key_derivations() {
+  static auto& counter = metrics::registry().counter(
+      "streetpass_key_derivations_total", "CCMP keys derived.");
+  return counter;
+}
+}  // namespace
+
+KeyDeriver::KeyDeriver() : KeyDeriver(*default_context()) {}
+
+KeyDeriver::KeyDeriver(CryptoContext const& context)
+    : KeyDeriver(context.normal_key(), context.cecd_key()) {}
+
+KeyDeriver::KeyDeriver(std::array<std::uint8_t, 16> const& normal_key,
+                       std::array<std::uint8_t, 17> const& cecd_key)
+    : m_hmac(cecd_key.data(), cecd_key.size()),
+      m_aes(normal_key.data(), normal_key.size()) {}
+
+// The CTR keystream of a single zero block is the AES encryption of the
+// counter, i.e. of the truncated HMAC digest.
+void KeyDeriver::hash_peer(peer_tuple const& peer, std::uint8_t* ctr) {
+  m_hmac.Update(peer.master_key.data(), peer.master_key.size());
+  m_hmac.Update(peer.client_key.data(), peer.client_key.size());
+  m_hmac.Update(peer.master_mac.data(), peer.master_mac.size());
+  m_hmac.Update(peer.client_mac.data(), peer.client_mac.size());
+  m_hmac.TruncatedFinal(ctr, AES::BLOCKSIZE);
+}
+
+KeyDeriver::ccmp_key_type KeyDeriver::derive(
+    std::array<std::uint8_t, 8> const& master_key,
+    std::array<std::uint8_t, 6> const& master_mac,
+    std::array<std::uint8_t, 8> const& client_key,
+    std::array<std::uint8_t, 6> const& client_mac) {
+  return derive({master_key, master_mac, client_key, client_mac});
+}
+
+KeyDeriver::ccmp_key_type KeyDeriver::derive(peer_tuple const& peer) {
+  ccmp_key_type ctr;
+  hash_peer(peer, ctr.data());
+
+  ccmp_key_type ccmp_key;
+  m_aes.ProcessBlock(ctr.data(), ccmp_key.data());
+  key_derivations().inc();
+  return ccmp_key;
+}
+
+std::vector<KeyDeriver::ccmp_key_type> KeyDeriver::derive_many(
+    std::vector<peer_tuple> const& peers) {
+  std::vector<ccmp_key_type> ctrs(peers.size());
+  for (std::size_t i = 0; i < peers.size(); i++)
+    hash_peer(peers[i], ctrs[i].data());
+
+  // a single call lets Crypto++ pipeline the blocks through AES-NI when the
+  // CPU has it
+  std::vector<ccmp_key_type> ccmp_keys(peers.size());
+  if (!peers.empty())
+    m_aes.AdvancedProcessBlocks(ctrs.data()->data(), nullptr,
+                                ccmp_keys.data()->data(),
+                                peers.size() * AES::BLOCKSIZE,
+                                BlockTransformation::BT_AllowParallel);
+  key_derivations().inc(peers.size());
+
+  return ccmp_keys;
+}
+}  // namespace streetpass::crypto
@@ -0,0 +1,306 @@
+#include "history/peer_store.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <stdexcept>
+#include <system_error>
+#include <vector>
+
+namespace streetpass::history {
+
+struct PeerStore::header {
+  std::uint64_t magic;
+  std::uint32_t version;
+  std::uint32_t record_size;
+  std::uint32_t index_capacity;
+  std::uint32_t reserved;
+  std::uint64_t record_count;     // committed records
+  std::uint64_t record_capacity;  // records the file has room for
+  std::uint8_t padding[24];
+};
+
+struct PeerStore::record {
+  std::uint64_t mac;
+  std::int64_t time_ms;  // unix time
+  std::uint64_t module_filter_hash;
+  std::uint32_t prev;  // previous record of the bucket + 1, 0 ends the chain
+  std::uint8_t result;
+  std::uint8_t padding[3];
+};
+
+namespace {
+constexpr std::uint64_t MAGIC = 0x5453494850535453;  // "STSPHIST"
+constexpr std::uint32_t VERSION = 1;
+constexpr std::uint64_t INITIAL_RECORD_CAPACITY = 1024;
+
+[[noreturn]] void throw_errno(std::string const& what) {
+  throw std::system_error(errno, std::generic_category(), what);
+}
+
+std::uint32_t round_up_pow2(std::uint32_t v) {
+  std::uint32_t p = 1;
+  while (p < v) p <<= 1;
+  return p;
+}
+
+std::size_t file_size(std::uint32_t index_capacity,
+                      std::uint64_t record_capacity, std::size_t header_size,
+                      std::size_t record_size) {
+  return header_size + index_capacity * sizeof(std::uint32_t) +
+         record_capacity * record_size;
+}
+
+std::uint32_t bucket(std::uint64_t mac, std::uint32_t capacity) {
+  // MACs of the same vendor share their upper bits, mix before masking
+  mac ^= mac >> 33;
+  mac *= 0xff51afd7ed558ccdULL;
+  mac ^= mac >> 33;
+  return mac & (capacity - 1);
+}
+}  // namespace
+
+PeerStore::PeerStore(std::string const& path, std::uint32_t index_capacity)
+    : m_path(path) {
+  static_assert(sizeof(header) == 64);
+  static_assert(sizeof(record) == 32);
+  if (index_capacity == 0)
+    throw std::invalid_argument("Index capacity must not be null");
+
+  open(round_up_pow2(index_capacity));
+}
+
+PeerStore::~PeerStore() { close(); }
+
+void PeerStore::open(std::uint32_t index_capacity) {
+  m_fd = ::open(m_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (m_fd < 0) throw_errno("Failed to open peer store " + m_path);
+
+  struct stat st;
+  if (fstat(m_fd, &st) < 0) throw_errno("Failed to stat peer store");
+
+  bool created = st.st_size == 0;
+  if (created) {
+    m_map_size = file_size(index_capacity, INITIAL_RECORD_CAPACITY,
+                           sizeof(header), sizeof(record));
+    if (ftruncate(m_fd, m_map_size) < 0)
+      throw_errno("Failed to size peer store");
+  } else {
+    m_map_size = st.st_size;
+    if (m_map_size < sizeof(header))
+      throw std::runtime_error("Peer store is truncated");
+  }
+
+  void* map =
+      mmap(nullptr, m_map_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+  if (map == MAP_FAILED) throw_errno("Failed to map peer store");
+  m_map = static_cast<std::uint8_t*>(map);
+
+  header* h = hdr();
+  if (created) {
+    std::memset(h, 0, sizeof(header));
+    h->magic = MAGIC;
+    h->version = VERSION;
+    h->record_size = sizeof(record);
+    h->index_capacity = index_capacity;
+    h->record_capacity = INITIAL_RECORD_CAPACITY;
+    return;
+  }
+
+  if (h->magic != MAGIC || h->version != VERSION ||
+      h->record_size != sizeof(record))
+    throw std::runtime_error("Not a peer store or unsupported version");
+  if ((h->index_capacity & (h->index_capacity - 1)) != 0 ||
+      h->record_count > h->record_capacity ||
+      m_map_size < file_size(h->index_capacity, h->record_capacity,
+                             sizeof(header), sizeof(record)))
+    throw std::runtime_error("Peer store is corrupted");
+
+  // An append interrupted between the index and the count stores leaves a
+  // head on an uncommitted record. Unwind it now: the next append reuses
+  // that record slot, which would otherwise splice another bucket's chain
+  // into this one.
+  std::uint32_t* idx = index();
+  for (std::uint32_t b = 0; b < h->index_capacity; ++b) {
+    while (idx[b] > h->record_count) {
+      if (idx[b] > h->record_capacity)
+        throw std::runtime_error("Peer store is corrupted");
+      idx[b] = records()[idx[b] - 1].prev;
+    }
+  }
+}
+
+void PeerStore::close() noexcept {
+  if (m_map != nullptr) munmap(m_map, m_map_size);
+  if (m_fd >= 0) ::close(m_fd);
+  m_map = nullptr;
+  m_map_size = 0;
+  m_fd = -1;
+}
+
+void PeerStore::grow() {
+  header* h = hdr();
+  std::uint64_t record_capacity = h->record_capacity * 2;
+  std::size_t new_size = file_size(h->index_capacity, record_capacity,
+                                   sizeof(header), sizeof(record));
+
+  if (ftruncate(m_fd, new_size) < 0) throw_errno("Failed to grow peer store");
+
+  void* map = mremap(m_map, m_map_size, new_size, MREMAP_MAYMOVE);
+  if (map == MAP_FAILED) throw_errno("Failed to remap peer store");
+
+  m_map = static_cast<std::uint8_t*>(map);
+  m_map_size = new_size;
+  hdr()->record_capacity = record_capacity;
+}
+
+PeerStore::header* PeerStore::hdr() const {
+  return reinterpret_cast<header*>(m_map);
+}
+
+std::uint32_t* PeerStore::index() const {
+  return reinterpret_cast<std::uint32_t*>(m_map + sizeof(header));
+}
+
+PeerStore::record* PeerStore::records() const {
+  return reinterpret_cast<record*>(m_map + sizeof(header) +
+                                   hdr()->index_capacity *
+                                       sizeof(std::uint32_t));
+}
+
+// bucket head, open() unwound those left by an interrupted append
+std::uint32_t PeerStore::committed_head(std::uint64_t mac) const {
+  return index()[bucket(mac, hdr()->index_capacity)];
+}
+
+PeerStore::record const* PeerStore::find(std::uint64_t mac) const {
+  record const* recs = records();
+  for (std::uint32_t i = committed_head(mac); i != 0; i = recs[i - 1].prev)
+    if (recs[i - 1].mac == mac) return &recs[i - 1];
+
+  return nullptr;
+}
+
+void PeerStore::append(encounter const& e) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  if (hdr()->record_count >= hdr()->record_capacity) grow();
+  if (hdr()->record_count >= UINT32_MAX)
+    throw std::length_error("Peer store is full, compact it");
+
+  header* h = hdr();
+  std::uint32_t n = h->record_count;
+  std::uint32_t head = committed_head(e.mac);
+
+  record& r = records()[n];
+  std::memset(&r, 0, sizeof(record));
+  r.mac = e.mac;
+  r.time_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                  e.time.time_since_epoch())
+                  .count();
+  r.module_filter_hash = e.module_filter_hash;
+  r.prev = head;
+  r.result = static_cast<std::uint8_t>(e.result);
+
+  // publish the record to the index, then commit it, in that order in the
+  // mapping whatever the compiler and CPU would rather do
+  std::atomic_thread_fence(std::memory_order_release);
+  index()[bucket(e.mac, h->index_capacity)] = n + 1;
+  std::atomic_thread_fence(std::memory_order_release);
+  h->record_count = n + 1;
+}
+
+std::optional<encounter> PeerStore::last(std::uint64_t mac) const {
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  record const* r = find(mac);
+  if (r == nullptr) return std::nullopt;
+
+  return encounter{r->mac,
+                   std::chrono::system_clock::time_point(
+                       std::chrono::milliseconds(r->time_ms)),
+                   r->module_filter_hash, static_cast<outcome>(r->result)};
+}
+
+bool PeerStore::seen_since(std::uint64_t mac,
+                           std::chrono::system_clock::time_point since) const {
+  auto e = last(mac);
+  return e && e->time >= since;
+}
+
+void PeerStore::compact(std::chrono::system_clock::time_point keep_since) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  auto limit = std::chrono::duration_cast<std::chrono::milliseconds>(
+                   keep_since.time_since_epoch())
+                   .count();
+
+  // latest record of every peer, kept in log order
+  std::map<std::uint64_t, std::uint32_t> latest;
+  record const* recs = records();
+  for (std::uint32_t i = 0; i < hdr()->record_count; ++i)
+    if (recs[i].time_ms >= limit) latest[recs[i].mac] = i;
+
+  std::vector<std::uint32_t> kept;
+  kept.reserve(latest.size());
+  for (auto const& [mac, i] : latest) kept.push_back(i);
+  std::sort(kept.begin(), kept.end());
+
+  std::uint32_t index_capacity =
+      round_up_pow2(std::max<std::uint32_t>(2 * kept.size(), 64));
+  std::string tmp_path = m_path + ".compact";
+  std::remove(tmp_path.c_str());
+  {
+    PeerStore compacted(tmp_path, index_capacity);
+    for (std::uint32_t i : kept) {
+      auto const& r = recs[i];
+      compacted.append({r.mac,
+                        std::chrono::system_clock::time_point(
+                            std::chrono::milliseconds(r.time_ms)),
+                        r.module_filter_hash, static_cast<outcome>(r.result)});
+    }
+    compacted.flush();
+  }
+
+  if (std::rename(tmp_path.c_str(), m_path.c_str()) < 0)
+    throw_errno("Failed to replace peer store");
+
+  close();
+  open(index_capacity);
+}
+
+void PeerStore::flush() {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (msync(m_map, m_map_size, MS_SYNC) < 0)
+    throw_errno("Failed to sync peer store");
+}
+
+std::size_t PeerStore::size() const {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return hdr()->record_count;
+}
+
+std::uint64_t PeerStore::pack_mac(std::array<std::uint8_t, 6> const& mac) {
+  std::uint64_t packed = 0;
+  for (auto b : mac) packed = (packed << 8) | b;
+  return packed;
+}
+
+std::uint64_t PeerStore::hash(cec::ModuleFilter const& module_filter) {
+  // FNV-1a over the serialized filter
+  std::uint64_t h = 0xcbf29ce484222325ULL;
+  for (auto b : cec::bytes(module_filter)) {
+    h ^= b;
+    h *= 0x100000001b3ULL;
+  }
+  return h;
+}
+}  // namespace streetpass::history
@@ -0,0 +1,318 @@
+#include "iface/association.hpp"
+
+#include <poll.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <stdexcept>
+#include <system_error>
+
+#include "iface/streetpass.hpp"
+#include "metrics/latency.hpp"
+#include "metrics/registry.hpp"
+#include "nl80211/commands.hpp"
+#include "nl80211/error.hpp"
+#include "nl80211/message.hpp"
+#include "trace/trace.hpp"
+
+namespace streetpass::iface {
+
+namespace {
+using steady_clock = std::chrono::steady_clock;
+
+// frame status events also expire on their own, bound the sleep meanwhile
+constexpr std::chrono::milliseconds TX_POLL_INTERVAL(50);
+
+void wait_readable(int rx_fd, int tx_fd, std::chrono::milliseconds timeout) {
+  pollfd pfds[] = {{rx_fd, POLLIN, 0}, {tx_fd, POLLIN, 0}};
+  if (poll(pfds, 2, timeout.count()) < 0 && errno != EINTR)
+    throw std::system_error(errno, std::generic_category());
+}
+
+metrics::Gauge& tracked_peers() {
+  static auto& gauge = metrics::registry().gauge(
+      "streetpass_association_peers", "Peers tracked by association engines.");
+  return gauge;
+}
+
+metrics::Counter& associations(const char* result) {
+  return metrics::registry().counter("streetpass_associations_total",
+                                     "Finished associations, by result.",
+                                     {{"result", result}});
+}
+
+KeySlotManager::mac_type to_mac(Tins::HWAddress<6> const& addr) {
+  KeySlotManager::mac_type mac;
+  std::copy(addr.begin(), addr.end(), mac.begin());
+  return mac;
+}
+}  // namespace
+
+AssociationEngine::AssociationEngine(StreetpassInterface& iface,
+                                     cec::ModuleFilter const& module_filter,
+                                     key_fn key,
+                                     std::chrono::milliseconds peer_timeout,
+                                     std::size_t max_peers)
+    : m_iface(iface),
+      m_proberesp(iface.make_initial_proberesp(Tins::HWAddress<6>(),
+                                               module_filter)
+                      .serialize()),
+      m_key_fn(std::move(key)),
+      m_peer_timeout(peer_timeout),
+      m_max_peers(max_peers),
+      m_tx(iface.m_index, StreetpassInterface::CHANNEL_FREQ),
+      m_own_addr(iface.get_mac_addr()) {
+  if (peer_timeout.count() <= 0)
+    throw std::invalid_argument("Peer timeout must be positive");
+
+  nl80211::commands::register_frame(
+      m_rx_sock, m_iface.m_index,
+      Tins::Dot11::Types::MANAGEMENT |
+          (Tins::Dot11::ManagementSubtypes::PROBE_REQ << 4));
+}
+
+AssociationEngine::~AssociationEngine() {
+  // peers left over when run() stopped early
+  tracked_peers().add(-static_cast<std::int64_t>(m_peers.size()));
+}
+
+void AssociationEngine::on_frame(std::vector<std::uint8_t> const& data,
+                                 steady_clock::time_point rx,
+                                 accept_fn const& accept) {
+  Tins::Dot11ProbeRequest probereq(data.data(), data.size());
+  auto addr = probereq.addr2();
+  auto it = m_peers.find(addr);
+  auto& latency = metrics::response_latency();
+  STREETPASS_TRACE_EVENT(RECEIVED, addr.begin(), 0);
+
+  bool streetpass = StreetpassInterface::is_streetpass_scan_probereq(probereq);
+  STREETPASS_TRACE_EVENT(CLASSIFIED, addr.begin(), streetpass);
+  if (streetpass) {
+    latency.mark(metrics::stage::CLASSIFIED, rx);
+    if (it != m_peers.end()) {
+      // the peer missed our response and is still scanning, answer again
+      if (it->second.current == state::RESPONDED) {
+        it->second.current = state::PROBE_SEEN;
+        it->second.last_rx = rx;
+      }
+      return;
+    }
+    if (m_peers.size() >= m_max_peers) return;
+
+    auto module_filter = StreetpassInterface::parse_module_filter(probereq);
+    if (!module_filter) return;
+    latency.mark(metrics::stage::PARSED, rx);
+
+    bool accepted = accept(addr, *module_filter);
+    STREETPASS_TRACE_EVENT(MATCHED, addr.begin(), accepted);
+    if (!accepted) return;
+    latency.mark(metrics::stage::MATCHED, rx);
+
+    m_peers.emplace(addr, peer{state::PROBE_SEEN, *module_filter, rx, rx,
+                               rx + m_peer_timeout, {}});
+    tracked_peers().add(1);
+    return;
+  }
+
+  // association probe request, directed to us
+  if (it == m_peers.end() || it->second.current != state::RESPONDED ||
+      probereq.addr1() != m_own_addr)
+    return;
+
+  it->second.current = state::KEYING;
+  it->second.last_rx = rx;
+  it->second.assoc_probereq = probereq;
+}
+
+void AssociationEngine::send_proberesp(Tins::HWAddress<6> const& addr,
+                                       steady_clock::time_point rx,
+                                       bool confirm) {
+  // Known limitation: the association probe request gets the same response
+  // as the scan one. Whether a 3DS expects different contents at that point
+  // has not been checked against real traffic.
+  m_tx.submit(m_proberesp.for_peer(addr),
+              [this, addr, rx,
+               confirm](nl80211::TxQueue::tx_status const& status) {
+                STREETPASS_TRACE_EVENT(TX_DONE, addr.begin(), status.error);
+                if (status.error < 0) {
+                  m_tx_failed.push_back(addr);
+                  return;
+                }
+                metrics::response_latency().mark(metrics::stage::TX_DONE, rx);
+                if (confirm) m_tx_confirmed.push_back(addr);
+              });
+}
+
+// Removes the keys installed for peers that did not complete, keeping the
+// slots for the others.
+void AssociationEngine::remove_keys(
+    std::vector<Tins::HWAddress<6>> const& addrs) {
+  std::vector<KeySlotManager::mac_type> peers;
+  for (auto const& addr : addrs) {
+    auto it = m_peers.find(addr);
+    if (it != m_peers.end() && it->second.current == state::CONFIRMING)
+      peers.push_back(to_mac(addr));
+  }
+  if (peers.empty()) return;
+
+  try {
+    m_iface.key_slots().remove(peers);
+  } catch (nl80211::NlError&) {
+    // left to expire with the other stale keys
+  }
+}
+
+bool AssociationEngine::finish(Tins::HWAddress<6> const& addr,
+                               state final_state, result_fn const& on_result) {
+  auto it = m_peers.find(addr);
+  result r = {addr, final_state, steady_clock::now() - it->second.start};
+  m_peers.erase(it);
+  tracked_peers().add(-1);
+
+  static auto& associated = associations("associated");
+  static auto& failed = associations("failed");
+  (final_state == state::ASSOCIATED ? associated : failed).inc();
+
+  return on_result(r);
+}
+
+bool AssociationEngine::advance(result_fn const& on_result) {
+  auto now = steady_clock::now();
+  std::vector<Tins::HWAddress<6>> keying;
+
+  // responses the radio could not send
+  std::vector<Tins::HWAddress<6>> failed;
+  for (auto const& addr : m_tx_failed)
+    if (m_peers.count(addr) != 0 &&
+        std::find(failed.begin(), failed.end(), addr) == failed.end())
+      failed.push_back(addr);
+  m_tx_failed.clear();
+
+  // association responses the radio sent
+  std::vector<Tins::HWAddress<6>> confirmed;
+  for (auto const& addr : m_tx_confirmed) {
+    auto it = m_peers.find(addr);
+    if (it != m_peers.end() && it->second.current == state::CONFIRMING &&
+        std::find(failed.begin(), failed.end(), addr) == failed.end() &&
+        std::find(confirmed.begin(), confirmed.end(), addr) ==
+            confirmed.end())
+      confirmed.push_back(addr);
+  }
+  m_tx_confirmed.clear();
+
+  std::vector<std::pair<KeySlotManager::mac_type, KeySlotManager::key_type>>
+      keys;
+
+  for (auto& [addr, p] : m_peers) {
+    if (std::find(failed.begin(), failed.end(), addr) != failed.end() ||
+        std::find(confirmed.begin(), confirmed.end(), addr) !=
+            confirmed.end())
+      continue;
+
+    switch (p.current) {
+      case state::PROBE_SEEN:
+        send_proberesp(addr, p.last_rx, false);
+        p.current = state::RESPONDED;
+        p.deadline = now + m_peer_timeout;
+        break;
+      case state::RESPONDED:
+      case state::CONFIRMING:
+        if (now >= p.deadline) failed.push_back(addr);
+        break;
+      case state::KEYING:
+        try {
+          keys.emplace_back(to_mac(addr), m_key_fn(addr, p.assoc_probereq));
+        } catch (...) {
+          // no key for this peer, the others of the round still get theirs
+          failed.push_back(addr);
+          break;
+        }
+        send_proberesp(addr, p.last_rx, true);
+        keying.push_back(addr);
+        break;
+      default:
+        break;
+    }
+  }
+
+  // every key reached in this round goes in a single batch
+  if (!keys.empty()) {
+    try {
+      m_iface.key_slots().install(keys);
+    } catch (nl80211::NlError&) {
+      // installed keys are recorded, the others are checked below
+    }
+  }
+
+  // installed peers wait for the TX status of their response
+  for (auto const& addr : keying) {
+    if (!m_iface.key_slots().key_index(to_mac(addr))) {
+      failed.push_back(addr);
+      continue;
+    }
+    auto& p = m_peers.at(addr);
+    p.current = state::CONFIRMING;
+    p.deadline = now + m_peer_timeout;
+  }
+
+  remove_keys(failed);
+
+  // on_result is not called again once it asked to stop, the peers left
+  // are still tracked
+  for (auto const& addr : confirmed)
+    if (!finish(addr, state::ASSOCIATED, on_result)) return false;
+  for (auto const& addr : failed)
+    if (!finish(addr, state::FAILED, on_result)) return false;
+
+  return true;
+}
+
+void AssociationEngine::run(std::chrono::milliseconds duration,
+                            accept_fn const& accept,
+                            result_fn const& on_result) {
+  auto end = steady_clock::now() + duration;
+
+  auto handler = [this, &accept](nl80211::Attributes& msg_attrs, void*) {
+    auto rx = steady_clock::now();
+    std::vector<std::uint8_t> data;
+    try {
+      data =
+          msg_attrs.get<std::vector<std::uint8_t>>(NL80211_ATTR_FRAME).value();
+      on_frame(data, rx, accept);
+    } catch (...) {
+      // not a frame notification or a malformed frame
+    }
+    return true;
+  };
+
+  while (true) {
+    auto now = steady_clock::now();
+    if (now >= end) break;
+
+    // wake up for the closest peer deadline, right away if a peer is ready
+    auto wake = end;
+    for (auto const& [addr, p] : m_peers) {
+      if (p.current == state::PROBE_SEEN || p.current == state::KEYING)
+        wake = now;
+      else
+        wake = std::min(wake, p.deadline);
+    }
+
+    if (m_tx.in_flight() != 0) wake = std::min(wake, now + TX_POLL_INTERVAL);
+
+    auto timeout = std::chrono::ceil<std::chrono::milliseconds>(wake - now);
+    wait_readable(m_rx_sock.get_fd(), m_tx.get_fd(), timeout);
+    m_rx_sock.recv_pending(handler, nullptr);
+    m_tx.process();
+
+    if (!advance(on_result)) return;
+  }
+
+  // whatever is left did not complete in time
+  std::vector<Tins::HWAddress<6>> pending;
+  for (auto const& [addr, p] : m_peers) pending.push_back(addr);
+  remove_keys(pending);
+  for (auto const& addr : pending)
+    if (!finish(addr, state::FAILED, on_result)) break;
+}
+}  // namespace streetpass::iface
@@ -0,0 +1,130 @@
+#include "iface/info_cache.hpp"
+
+#include "nl80211/error.hpp"
+#include "nl80211/message.hpp"
+
+namespace streetpass::iface {
+
+InfoCache::InfoCache() {
+  m_event_sock.add_membership("config");
+  m_link_sock.add_membership(RTNLGRP_LINK);
+}
+
+InfoCache& InfoCache::instance() {
+  static InfoCache cache;
+  return cache;
+}
+
+void InfoCache::process_events() {
+  auto handler = [this](nl80211::Attributes& msg_attrs, void*) {
+    switch (msg_attrs.command()) {
+      case NL80211_CMD_NEW_WIPHY: {
+        auto index = msg_attrs.get<std::uint32_t>(NL80211_ATTR_WIPHY).value();
+        try {
+          m_wiphy_names[index] =
+              msg_attrs.get<std::string>(NL80211_ATTR_WIPHY_NAME).value();
+        } catch (...) {
+          m_wiphy_names.erase(index);
+        }
+        break;
+      }
+      case NL80211_CMD_DEL_WIPHY: {
+        auto index = msg_attrs.get<std::uint32_t>(NL80211_ATTR_WIPHY).value();
+        m_wiphy_names.erase(index);
+        for (auto it = m_wifaces.begin(); it != m_wifaces.end();) {
+          if (it->second.wiphy == index)
+            it = m_wifaces.erase(it);
+          else
+            ++it;
+        }
+        break;
+      }
+      case NL80211_CMD_NEW_INTERFACE:
+      case NL80211_CMD_SET_INTERFACE: {
+        auto index =
+            msg_attrs.get<std::uint32_t>(NL80211_ATTR_IFINDEX).value();
+        nl80211::wiface w = {};
+        try {
+          nl80211::commands::parse_interface_message(msg_attrs, &w);
+          m_wifaces[index] = w;
+        } catch (...) {
+          // incomplete notification, refetch on next lookup
+          m_wifaces.erase(index);
+        }
+        break;
+      }
+      case NL80211_CMD_DEL_INTERFACE: {
+        auto index =
+            msg_attrs.get<std::uint32_t>(NL80211_ATTR_IFINDEX).value();
+        m_wifaces.erase(index);
+        break;
+      }
+      default:
+        break;
+    }
+    return true;
+  };
+
+  auto link_handler = [this](std::uint16_t type, rtnl::link const& l) {
+    auto it = m_wifaces.find(l.index);
+    if (it == m_wifaces.end()) return true;
+    if (type == RTM_DELLINK)
+      m_wifaces.erase(it);
+    else
+      it->second.name = l.name;
+    return true;
+  };
+
+  try {
+    m_event_sock.recv_pending(handler, nullptr);
+    m_link_sock.recv_pending(link_handler);
+  } catch (...) {
+    // events may have been dropped (e.g. socket buffer overrun), the
+    // snapshot cannot be trusted anymore
+    m_wiphy_names.clear();
+    m_wifaces.clear();
+  }
+}
+
+std::string InfoCache::get_wiphy_name(std::uint32_t index) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  process_events();
+
+  auto it = m_wiphy_names.find(index);
+  if (it != m_wiphy_names.end()) return it->second;
+
+  nl80211::wiphy w = nl80211::commands::get_wiphy(m_query_sock, index);
+  m_wiphy_names[index] = w.name;
+  return w.name;
+}
+
+nl80211::wiface InfoCache::get_interface(std::uint32_t if_idx) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  process_events();
+
+  auto it = m_wifaces.find(if_idx);
+  if (it != m_wifaces.end()) return it->second;
+
+  nl80211::wiface w = nl80211::commands::get_interface(m_query_sock, if_idx);
+  m_wifaces[if_idx] = w;
+  return w;
+}
+
+void InfoCache::update(nl80211::wiphy const& w) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  process_events();
+  m_wiphy_names[w.index] = w.name;
+}
+
+void InfoCache::update(nl80211::wiface const& w) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  process_events();
+  m_wifaces[w.index] = w;
+}
+
+void InfoCache::invalidate() {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_wiphy_names.clear();
+  m_wifaces.clear();
+}
+}  // namespace streetpass::iface
@@ -0,0 +1,153 @@
+#include "iface/key_slots.hpp"
+
+#include <netlink/errno.h>
+
+#include <algorithm>
+#include <set>
+#include <stdexcept>
+
+#include "nl80211/commands.hpp"
+#include "nl80211/error.hpp"
+
+namespace streetpass::iface {
+
+const std::uint32_t KeySlotManager::CIPHER = 0x000fac04;  // CCMP-128
+const std::uint8_t KeySlotManager::KEY_IDX = 0;
+
+namespace {
+// first failure worth reporting, a key that is already gone is not one
+void keep_error(int& first_err, int res) {
+  if (first_err == 0 && res < 0 && res != -NLE_OBJ_NOTFOUND) first_err = res;
+}
+}  // namespace
+
+KeySlotManager::KeySlotManager(std::uint32_t if_idx, std::size_t capacity,
+                               clock::duration ttl)
+    : m_if_idx(if_idx), m_capacity(capacity), m_ttl(ttl) {
+  if (capacity == 0)
+    throw std::invalid_argument("Key slot capacity must not be null");
+}
+
+std::vector<KeySlotManager::mac_type> KeySlotManager::pick_evictions(
+    std::size_t needed,
+    std::vector<std::pair<mac_type, key_type>> const& keys) const {
+  std::set<mac_type> installing;
+  for (auto const& k : keys) installing.insert(k.first);
+
+  std::vector<std::pair<clock::time_point, mac_type>> candidates;
+  for (auto const& [mac, s] : m_slots)
+    if (installing.count(mac) == 0) candidates.emplace_back(s.last_seen, mac);
+
+  // cannot happen while keys fit in the capacity
+  if (candidates.size() < needed)
+    throw std::length_error("Not enough key slots to evict");
+
+  std::partial_sort(candidates.begin(), candidates.begin() + needed,
+                    candidates.end());
+
+  std::vector<mac_type> evicted;
+  for (std::size_t i = 0; i < needed; ++i)
+    evicted.push_back(candidates[i].second);
+  return evicted;
+}
+
+void KeySlotManager::install(
+    std::vector<std::pair<mac_type, key_type>> const& keys) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto now = clock::now();
+
+  if (keys.size() > m_capacity)
+    throw std::length_error("Too many peers for the available key slots");
+
+  std::vector<nl80211::pairwise_key> removed;
+  std::vector<nl80211::pairwise_key> added;
+  std::size_t fresh = 0;
+  for (auto const& [mac, key] : keys) {
+    if (m_slots.count(mac))
+      removed.push_back({mac, KEY_IDX, {}});
+    else
+      ++fresh;
+    added.push_back({mac, KEY_IDX, {key.begin(), key.end()}});
+  }
+
+  // the key table of the driver is bounded, make room in the same batch
+  if (m_slots.size() + fresh > m_capacity)
+    for (auto const& mac :
+         pick_evictions(m_slots.size() + fresh - m_capacity, keys))
+      removed.push_back({mac, KEY_IDX, {}});
+
+  auto results = nl80211::commands::replace_keys(m_nlsock, m_if_idx, CIPHER,
+                                                 removed, added);
+
+  // a deleted key is gone whether or not its peer gets a new one
+  int first_err = 0;
+  for (std::size_t i = 0; i < removed.size(); ++i) {
+    keep_error(first_err, results[i]);
+    m_slots.erase(removed[i].mac);
+  }
+  for (std::size_t i = 0; i < added.size(); ++i) {
+    int res = results[removed.size() + i];
+    if (res < 0)
+      keep_error(first_err, res);
+    else
+      m_slots[added[i].mac] = slot{now};
+  }
+
+  if (first_err < 0)
+    throw nl80211::NlError(first_err, "Failed to install keys");
+}
+
+void KeySlotManager::remove(std::vector<mac_type> const& peers) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  std::vector<nl80211::pairwise_key> keys;
+  for (auto const& mac : peers) {
+    auto it = m_slots.find(mac);
+    if (it == m_slots.end()) continue;
+
+    keys.push_back({mac, KEY_IDX, {}});
+    m_slots.erase(it);
+  }
+  if (keys.empty()) return;
+
+  int first_err = 0;
+  for (int res : nl80211::commands::del_keys(m_nlsock, m_if_idx, keys))
+    keep_error(first_err, res);
+
+  if (first_err < 0)
+    throw nl80211::NlError(first_err, "Failed to remove keys");
+}
+
+void KeySlotManager::touch(mac_type const& peer) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto it = m_slots.find(peer);
+  if (it != m_slots.end()) it->second.last_seen = clock::now();
+}
+
+std::size_t KeySlotManager::expire() {
+  std::vector<mac_type> expired;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto limit = clock::now() - m_ttl;
+    for (auto const& [mac, s] : m_slots)
+      if (s.last_seen < limit) expired.push_back(mac);
+  }
+
+  remove(expired);
+  return expired.size();
+}
+
+std::optional<std::uint8_t> KeySlotManager::key_index(
+    mac_type const& peer) const {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto it = m_slots.find(peer);
+  if (it == m_slots.end()) return std::nullopt;
+
+  return KEY_IDX;
+}
+
+std::size_t KeySlotManager::size() const {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_slots.size();
+}
+}  // namespace streetpass::iface
@@ -3,16 +3,16 @@
 #include <algorithm>
 #include <iostream>
 
+#include "iface/info_cache.hpp"
 #include "iface/streetpass.hpp"
 #include "iface/virtual.hpp"
 
 namespace streetpass::iface {
 
 PhysicalInterface::PhysicalInterface(nl80211::wiphy wiphy)
-    : m_index(wiphy.index),
-      m_supported_cmds(wiphy.supported_cmds),
-      m_supported_iftypes(wiphy.supported_iftypes),
-      m_supported_ciphers(wiphy.supported_ciphers) {}
+    : m_index(wiphy.index), m_capabilities(wiphy.capabilities) {
+  InfoCache::instance().update(wiphy);
+}
 
 PhysicalInterface::PhysicalInterface(std::uint32_t index)
     : PhysicalInterface(get_all_info(index)) {}
@@ -23,20 +23,34 @@ nl80211::wiphy PhysicalInterface::get_all_info(std::uint32_t index) {
 }
 
 std::string PhysicalInterface::get_name() const {
-  return get_all_info(m_index).name;
+  return InfoCache::instance().get_wiphy_name(m_index);
 }
 
-StreetpassInterface PhysicalInterface::setup_streetpass_interface(
-    std::string const& name) const {
+void PhysicalInterface::prepare_streetpass_interface() const {
   check_supported();
   auto virt_list = find_all_virtual();
   // TODO: exception handling
-  for (auto virt : virt_list) virt.down();
+  VirtualInterface::down(virt_list);
+}
+
+StreetpassInterface PhysicalInterface::setup_streetpass_interface(
+    std::string const& name) const {
+  prepare_streetpass_interface();
 
   // TODO: implement!
   return StreetpassInterface(*this, name);
 }
 
+std::future<std::unique_ptr<StreetpassInterface>>
+PhysicalInterface::setup_streetpass_interface_async(
+    std::string const& name) const {
+  return std::async(std::launch::async, [phys = *this, name]() {
+    phys.prepare_streetpass_interface();
+    return std::unique_ptr<StreetpassInterface>(
+        new StreetpassInterface(phys, name));
+  });
+}
+
 bool PhysicalInterface::is_supported() const noexcept {
   try {
     check_supported();
@@ -61,18 +75,15 @@ constexpr std::uint32_t CIPHER_CCMP_128 = 0x000fac04;
 }  // namespace
 
 void PhysicalInterface::check_supported() const {
-  auto type_it = m_supported_iftypes.find(NL80211_IFTYPE_ADHOC);
-  if (type_it == m_supported_iftypes.end())
+  if (!m_capabilities.supports_iftype(NL80211_IFTYPE_ADHOC))
     throw UnsupportedPhysicalInterface("Interface does not support adhoc mode");
 
   for (const auto& req : required_cmds) {
-    auto cmd_it = m_supported_cmds.find(req.cmd);
-    if (cmd_it == m_supported_cmds.end())
+    if (!m_capabilities.supports_command(req.cmd))
       throw UnsupportedPhysicalInterface(req.error_msg);
   }
 
-  auto cipher_it = m_supported_ciphers.find(CIPHER_CCMP_128);
-  if (cipher_it == m_supported_ciphers.end())
+  if (!m_capabilities.supports_cipher(CIPHER_CCMP_128))
     throw UnsupportedPhysicalInterface(
         "Interface does not support AES-CCMP-128 cipher");
 }
@@ -84,7 +95,10 @@ std::vector<VirtualInterface> PhysicalInterface::find_all_virtual() const {
   std::vector<nl80211::wiface> wifaces =
       nl80211::commands::get_interface_list(nlsock, m_index);
   std::transform(wifaces.begin(), wifaces.end(), std::back_inserter(res),
-                 [](auto x) { return VirtualInterface(x.index); });
+                 [](auto x) {
+                   InfoCache::instance().update(x);
+                   return VirtualInterface(x.index);
+                 });
 
   return res;
 }
@@ -110,6 +124,19 @@ std::vector<PhysicalInterface> PhysicalInterface::find_all_supported() {
   return res;
 }
 
+std::map<std::uint32_t, std::future<std::unique_ptr<StreetpassInterface>>>
+PhysicalInterface::setup_all_streetpass_interfaces(std::string const& prefix) {
+  std::map<std::uint32_t, std::future<std::unique_ptr<StreetpassInterface>>>
+      res;
+
+  for (auto const& phys : find_all_supported()) {
+    auto name = prefix + std::to_string(phys.get_id());
+    res.emplace(phys.get_id(), phys.setup_streetpass_interface_async(name));
+  }
+
+  return res;
+}
+
 UnsupportedPhysicalInterface::UnsupportedPhysicalInterface(
     std::string const& msg)
     : m_msg(msg) {}
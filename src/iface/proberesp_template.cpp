@@ -0,0 +1,26 @@
+#include "iface/proberesp_template.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace streetpass::iface {
+
+ProbeResponseTemplate::ProbeResponseTemplate(std::vector<std::uint8_t> frame)
+    : m_frame(std::move(frame)) {
+  if (m_frame.size() < SEQ_CTRL_OFFSET + 2)
+    throw std::invalid_argument("Frame too short for a management header");
+}
+
+std::vector<std::uint8_t> const& ProbeResponseTemplate::for_peer(
+    Tins::HWAddress<6> const& peer) {
+  std::copy(peer.begin(), peer.end(), m_frame.begin() + ADDR1_OFFSET);
+
+  // sequence number in the upper 12 bits, fragment number 0, little endian
+  std::uint16_t seq_ctrl = static_cast<std::uint16_t>(m_seq_num << 4);
+  m_frame[SEQ_CTRL_OFFSET] = seq_ctrl & 0xff;
+  m_frame[SEQ_CTRL_OFFSET + 1] = seq_ctrl >> 8;
+  m_seq_num = (m_seq_num + 1) & 0xfff;
+
+  return m_frame;
+}
+}  // namespace streetpass::iface
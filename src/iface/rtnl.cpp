@@ -0,0 +1,231 @@
+#include "iface/rtnl.hpp"
+
+#include <linux/if_link.h>
+#include <net/if.h>
+#include <netlink/msg.h>
+#include <poll.h>
+
+#include <map>
+#include <system_error>
+
+#include "nl80211/error.hpp"
+
+using streetpass::nl80211::NlError;
+
+namespace streetpass::rtnl {
+
+Socket::Socket()
+    : m_nlsock(nl_socket_alloc(), nl_socket_free),
+      m_transport(nl80211::make_transport()) {
+  if (m_nlsock.get() == nullptr) throw std::bad_alloc();
+
+  int res = m_transport->connect(m_nlsock.get(), NETLINK_ROUTE);
+  if (res < 0) throw NlError(res, "Failed to connect rtnetlink socket");
+}
+
+int Socket::get_fd() const { return m_transport->fd(); }
+
+void Socket::add_membership(rtnetlink_groups group) {
+  int res = m_transport->add_membership(group);
+  if (res < 0) throw NlError(res, "Failed to join rtnetlink multicast group");
+}
+
+bool Socket::wait_readable(std::chrono::milliseconds timeout) const {
+  pollfd pfd = {get_fd(), POLLIN, 0};
+  int ret = poll(&pfd, 1, timeout.count());
+  if (ret < 0 && errno != EINTR)
+    throw std::system_error(errno, std::generic_category());
+
+  return ret > 0;
+}
+
+namespace {
+link parse_link_message(nlmsghdr* hdr) {
+  auto ifi = static_cast<ifinfomsg*>(nlmsg_data(hdr));
+
+  link l = {ifi->ifi_index, ifi->ifi_flags, ""};
+  nlattr* name_attr = nlmsg_find_attr(hdr, sizeof(ifinfomsg), IFLA_IFNAME);
+  if (name_attr != nullptr) l.name = nla_get_string(name_attr);
+
+  return l;
+}
+}  // namespace
+
+// Processes every link notification already queued on the socket without
+// blocking. The callback receives the message type (RTM_NEWLINK or
+// RTM_DELLINK) and returns false to stop.
+void Socket::recv_pending(
+    std::function<bool(std::uint16_t, link const&)> const& callback) {
+  nl_cb* cb = nl_cb_alloc(NL_CB_DEFAULT);
+  if (cb == nullptr) throw std::bad_alloc();
+  m_transport->attach(cb);
+
+  std::exception_ptr ex;
+  bool stop = false;
+
+  auto recv_msg_cb = [&callback, &ex, &stop](nl_msg* nlmsg) -> int {
+    nlmsghdr* hdr = nlmsg_hdr(nlmsg);
+    if (hdr->nlmsg_type != RTM_NEWLINK && hdr->nlmsg_type != RTM_DELLINK)
+      return NL_OK;
+    if (!nlmsg_valid_hdr(hdr, sizeof(ifinfomsg))) return NL_OK;
+
+    try {
+      stop = !callback(hdr->nlmsg_type, parse_link_message(hdr));
+      return stop ? NL_STOP : NL_OK;
+    } catch (...) {
+      ex = std::current_exception();
+      stop = true;
+      return NL_STOP;
+    }
+  };
+
+  auto valid_handler = [](nl_msg* nlmsg, void* arg) {
+    return (*static_cast<decltype(recv_msg_cb)*>(arg))(nlmsg);
+  };
+
+  auto no_seq_check = [](nl_msg*, void*) -> int { return NL_OK; };
+
+  nl_cb_set(cb, NL_CB_SEQ_CHECK, NL_CB_CUSTOM, no_seq_check, nullptr);
+  nl_cb_set(cb, NL_CB_VALID, NL_CB_CUSTOM, valid_handler, &recv_msg_cb);
+
+  int res = 0;
+  while (!stop && res >= 0 && wait_readable(std::chrono::milliseconds(0)))
+    res = nl_recvmsgs(m_nlsock.get(), cb);
+
+  nl_cb_put(cb);
+  if (ex) std::rethrow_exception(ex);
+  if (res < 0) throw NlError(res, "Failed to receive pending messages");
+}
+
+namespace {
+using msg_ptr = std::unique_ptr<nl_msg, decltype(&nlmsg_free)>;
+
+msg_ptr make_link_message(int type, int flags, int if_idx) {
+  msg_ptr msg(nlmsg_alloc_simple(type, flags), nlmsg_free);
+  if (msg.get() == nullptr) throw std::bad_alloc();
+
+  ifinfomsg ifi = {};
+  ifi.ifi_family = AF_UNSPEC;
+  ifi.ifi_index = if_idx;
+  int res = nlmsg_append(msg.get(), &ifi, sizeof(ifi), NLMSG_ALIGNTO);
+  if (res < 0) throw NlError(res, "Failed to build link message");
+
+  return msg;
+}
+
+// Sends all requests in a single datagram and collects one ACK per request,
+// so that the cost of the batch is a single kernel round-trip.
+void transact(Socket& sock, std::vector<msg_ptr> const& msgs,
+              std::function<void(nlmsghdr*)> const& on_reply = nullptr) {
+  std::vector<std::uint8_t> buffer;
+  std::map<std::uint32_t, int> pending;
+  for (auto const& msg : msgs) {
+    nl_complete_msg(sock.get(), msg.get());
+    nlmsghdr* hdr = nlmsg_hdr(msg.get());
+    auto data = reinterpret_cast<std::uint8_t*>(hdr);
+    buffer.insert(buffer.end(), data, data + hdr->nlmsg_len);
+    buffer.resize(NLMSG_ALIGN(buffer.size()), 0);
+
+    auto ifi = static_cast<ifinfomsg*>(nlmsg_data(hdr));
+    pending[hdr->nlmsg_seq] = ifi->ifi_index;
+  }
+
+  int res = sock.transport().sendto(buffer.data(), buffer.size());
+  if (res < 0) throw NlError(res, "Failed to send link messages");
+
+  struct state {
+    std::map<std::uint32_t, int>& pending;
+    std::function<void(nlmsghdr*)> const& on_reply;
+    int err;
+    int err_index;
+  } st = {pending, on_reply, 0, 0};
+
+  auto ack_handler = [](nl_msg* nlmsg, void* arg) -> int {
+    auto st = static_cast<state*>(arg);
+    st->pending.erase(nlmsg_hdr(nlmsg)->nlmsg_seq);
+    return NL_OK;
+  };
+
+  auto error_handler = [](sockaddr_nl*, nlmsgerr* err, void* arg) -> int {
+    auto st = static_cast<state*>(arg);
+    auto it = st->pending.find(err->msg.nlmsg_seq);
+    if (it == st->pending.end()) return NL_SKIP;
+
+    if (st->err == 0) {
+      st->err = -nl_syserr2nlerr(err->error);
+      st->err_index = it->second;
+    }
+    st->pending.erase(it);
+    return NL_SKIP;
+  };
+
+  auto valid_handler = [](nl_msg* nlmsg, void* arg) -> int {
+    auto st = static_cast<state*>(arg);
+    if (st->on_reply) st->on_reply(nlmsg_hdr(nlmsg));
+    return NL_OK;
+  };
+
+  auto no_seq_check = [](nl_msg*, void*) -> int { return NL_OK; };
+
+  nl_cb* cb = nl_cb_alloc(NL_CB_DEFAULT);
+  if (cb == nullptr) throw std::bad_alloc();
+  sock.transport().attach(cb);
+
+  nl_cb_err(cb, NL_CB_CUSTOM, error_handler, &st);
+  nl_cb_set(cb, NL_CB_ACK, NL_CB_CUSTOM, ack_handler, &st);
+  nl_cb_set(cb, NL_CB_VALID, NL_CB_CUSTOM, valid_handler, &st);
+  nl_cb_set(cb, NL_CB_SEQ_CHECK, NL_CB_CUSTOM, no_seq_check, nullptr);
+
+  res = 0;
+  while (!pending.empty() && res >= 0) res = nl_recvmsgs(sock.get(), cb);
+
+  nl_cb_put(cb);
+  if (res < 0) throw NlError(res, "Failed to receive link messages");
+  if (st.err < 0)
+    throw NlError(st.err, "Failed to change state of interface " +
+                              std::to_string(st.err_index));
+}
+}  // namespace
+
+link get_link(Socket& sock, int if_idx) {
+  std::vector<msg_ptr> msgs;
+  msgs.push_back(make_link_message(RTM_GETLINK, NLM_F_REQUEST, if_idx));
+
+  link l = {if_idx, 0, ""};
+  transact(sock, msgs, [&l](nlmsghdr* hdr) {
+    if (hdr->nlmsg_type == RTM_NEWLINK &&
+        nlmsg_valid_hdr(hdr, sizeof(ifinfomsg)))
+      l = parse_link_message(hdr);
+  });
+
+  return l;
+}
+
+bool is_link_up(Socket& sock, int if_idx) {
+  return get_link(sock, if_idx).flags & IFF_UP;
+}
+
+void set_link_up(Socket& sock, int if_idx) {
+  set_links_state(sock, {if_idx}, true);
+}
+
+void set_link_down(Socket& sock, int if_idx) {
+  set_links_state(sock, {if_idx}, false);
+}
+
+void set_links_state(Socket& sock, std::vector<int> const& if_indices,
+                     bool up) {
+  if (if_indices.empty()) return;
+
+  std::vector<msg_ptr> msgs;
+  for (int if_idx : if_indices) {
+    msg_ptr msg = make_link_message(RTM_NEWLINK, NLM_F_REQUEST, if_idx);
+    auto ifi = static_cast<ifinfomsg*>(nlmsg_data(nlmsg_hdr(msg.get())));
+    ifi->ifi_change = IFF_UP;
+    ifi->ifi_flags = up ? IFF_UP : 0;
+    msgs.push_back(std::move(msg));
+  }
+
+  transact(sock, msgs);
+}
+}  // namespace streetpass::rtnl
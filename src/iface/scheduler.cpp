@@ -0,0 +1,159 @@
+#include "iface/scheduler.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "metrics/registry.hpp"
+
+namespace streetpass::iface {
+
+namespace {
+// a peer never met outranks any number of titles from one met recently
+constexpr double NOVELTY_WEIGHT = 16.0;
+constexpr double TITLE_WEIGHT = 1.0;
+constexpr unsigned MAX_SCORED_TITLES = 8;
+constexpr double FRESHNESS_WEIGHT = 4.0;
+// share of the cooldown a peer must wait before it can be exchanged with
+// again at all
+constexpr double MIN_NOVELTY = 0.25;
+
+void publish(std::size_t active, std::size_t queued) {
+  static auto& active_gauge = metrics::registry().gauge(
+      "streetpass_exchanges_active", "Exchanges admitted and in progress.");
+  static auto& queued_gauge = metrics::registry().gauge(
+      "streetpass_exchanges_queued", "Peers waiting for an exchange slot.");
+  active_gauge.set(active);
+  queued_gauge.set(queued);
+}
+
+double ratio(ExchangeScheduler::clock::duration part,
+             ExchangeScheduler::clock::duration whole) {
+  return std::clamp(std::chrono::duration<double>(part) /
+                        std::chrono::duration<double>(whole),
+                    0.0, 1.0);
+}
+}  // namespace
+
+ExchangeScheduler::ExchangeScheduler(cec::ModuleFilter const& module_filter,
+                                     std::size_t max_concurrent,
+                                     std::size_t max_queued,
+                                     clock::duration cooldown,
+                                     clock::duration stale_after)
+    : m_module_filter(module_filter),
+      m_max_concurrent(max_concurrent),
+      m_max_queued(max_queued),
+      m_cooldown(cooldown),
+      m_stale_after(stale_after) {
+  if (max_concurrent == 0)
+    throw std::invalid_argument("At least one exchange must be allowed");
+  if (cooldown.count() <= 0 || stale_after.count() <= 0)
+    throw std::invalid_argument("Durations must be positive");
+}
+
+double ExchangeScheduler::novelty(Tins::HWAddress<6> const& addr,
+                                  clock::time_point now) const {
+  auto it = m_exchanged.find(addr);
+  return it == m_exchanged.end() ? 1.0 : ratio(now - it->second, m_cooldown);
+}
+
+double ExchangeScheduler::score(Tins::HWAddress<6> const& addr,
+                                candidate const& c,
+                                clock::time_point now) const {
+  double titles = std::min(c.matching_titles, MAX_SCORED_TITLES);
+  double freshness = 1.0 - ratio(now - c.last_seen, m_stale_after);
+
+  return NOVELTY_WEIGHT * novelty(addr, now) + TITLE_WEIGHT * titles +
+         FRESHNESS_WEIGHT * freshness;
+}
+
+void ExchangeScheduler::prune(clock::time_point now) {
+  // peers not heard from for a while have most likely walked away
+  for (auto it = m_queue.begin(); it != m_queue.end();) {
+    if (now - it->second.last_seen > m_stale_after)
+      it = m_queue.erase(it);
+    else
+      ++it;
+  }
+
+  for (auto it = m_exchanged.begin(); it != m_exchanged.end();) {
+    if (now - it->second > m_cooldown)
+      it = m_exchanged.erase(it);
+    else
+      ++it;
+  }
+}
+
+bool ExchangeScheduler::admit(Tins::HWAddress<6> const& addr,
+                              cec::ModuleFilter const& module_filter) {
+  if (m_active.count(addr) != 0) return true;
+  if (!m_module_filter.match(module_filter)) return false;
+
+  auto now = clock::now();
+  prune(now);
+
+  m_queue[addr] = {m_module_filter.matching_titles(module_filter), now};
+
+  // scores decay with time, so they are computed on each decision
+  std::vector<std::pair<double, Tins::HWAddress<6>>> ranked;
+  ranked.reserve(m_queue.size());
+  for (auto const& [a, c] : m_queue) ranked.emplace_back(score(a, c, now), a);
+  std::sort(ranked.begin(), ranked.end(),
+            [](auto const& lhs, auto const& rhs) {
+              return lhs.first > rhs.first;
+            });
+
+  while (ranked.size() > m_max_queued) {
+    m_queue.erase(ranked.back().second);
+    ranked.pop_back();
+    m_shed++;
+    static auto& shed = metrics::registry().counter(
+        "streetpass_exchanges_shed_total",
+        "Peers dropped from a full exchange queue.");
+    shed.inc();
+  }
+
+  // peers still cooling down only get the slots nobody new is waiting for,
+  // and none at all right after an exchange
+  bool novel_waiting = std::any_of(
+      ranked.begin(), ranked.end(),
+      [&](auto const& r) { return novelty(r.second, now) >= 1.0; });
+  ranked.erase(std::remove_if(ranked.begin(), ranked.end(),
+                              [&](auto const& r) {
+                                double n = novelty(r.second, now);
+                                return n < MIN_NOVELTY ||
+                                       (n < 1.0 && novel_waiting);
+                              }),
+               ranked.end());
+
+  std::size_t free_slots =
+      m_max_concurrent > m_active.size() ? m_max_concurrent - m_active.size()
+                                         : 0;
+  for (std::size_t i = 0; i < std::min(free_slots, ranked.size()); ++i) {
+    if (ranked[i].second != addr) continue;
+
+    m_queue.erase(addr);
+    m_active.insert(addr);
+    publish(m_active.size(), m_queue.size());
+    return true;
+  }
+  publish(m_active.size(), m_queue.size());
+  return false;
+}
+
+void ExchangeScheduler::complete(Tins::HWAddress<6> const& addr,
+                                 bool exchanged) {
+  if (m_active.erase(addr) == 0) return;
+  if (exchanged) m_exchanged[addr] = clock::now();
+  publish(m_active.size(), m_queue.size());
+}
+
+void ExchangeScheduler::remember(Tins::HWAddress<6> const& addr,
+                                 clock::time_point when) {
+  if (clock::now() - when > m_cooldown) return;
+
+  auto [it, inserted] = m_exchanged.try_emplace(addr, when);
+  if (!inserted) it->second = std::max(it->second, when);
+}
+}  // namespace streetpass::iface
@@ -2,10 +2,20 @@
 
 #include <tins/tins.h>
 
-#include <chrono>
-#include <thread>
+#include <net/if.h>
 
+#include <chrono>
+#include <functional>
+#include <ostream>
+#include <system_error>
+
+#include "iface/rtnl.hpp"
+#include "metrics/histogram.hpp"
+#include "metrics/latency.hpp"
+#include "metrics/registry.hpp"
+#include "nl80211/error.hpp"
 #include "nl80211/message.hpp"
+#include "trace/trace.hpp"
 
 namespace streetpass::iface {
 
@@ -18,39 +28,210 @@ const Tins::Dot11ManagementFrame::rates_type
     StreetpassInterface::EXT_SUPPORTED_RATES({24.0, 36.0, 48.0, 54.0});
 const int StreetpassInterface::CHANNEL_FREQ = 2412;
 
+namespace {
+using steady_clock = std::chrono::steady_clock;
+
+// time from the start of the setup to the IBSS being joined, in nanoseconds,
+// exported as a summary
+metrics::Histogram& ready_histogram() {
+  static auto* histogram = [] {
+    auto h = new metrics::Histogram();
+    metrics::registry().add_collector([h](std::ostream& os) {
+      static const char* NAME = "streetpass_interface_ready_seconds";
+      os << "# HELP " << NAME
+         << " Time for a StreetPass interface to be ready to scan.\n"
+         << "# TYPE " << NAME << " summary\n";
+      for (double q : {0.5, 0.99})
+        os << NAME << "{quantile=\"" << q << "\"} "
+           << h->percentile(q * 100) / 1e9 << "\n";
+      os << NAME << "_sum " << h->mean() * h->count() / 1e9 << "\n"
+         << NAME << "_count " << h->count() << "\n";
+    });
+    return h;
+  }();
+  return *histogram;
+}
+
+metrics::Counter& rejected_frames(const char* reason) {
+  return metrics::registry().counter(
+      "streetpass_frames_rejected_total",
+      "StreetPass probe requests without a usable module filter, by reason.",
+      {{"reason", reason}});
+}
+
+std::chrono::milliseconds time_left(steady_clock::time_point deadline,
+                                    const char* what) {
+  auto now = steady_clock::now();
+  if (now >= deadline)
+    throw std::system_error(ETIMEDOUT, std::generic_category(), what);
+
+  return std::chrono::ceil<std::chrono::milliseconds>(deadline - now);
+}
+
+// Drains notifications from an event socket until the predicate accepts one
+// of them or the deadline expires.
+void wait_event(nl80211::Socket& sock, steady_clock::time_point deadline,
+                std::function<bool(nl80211::Attributes&)> const& predicate,
+                const char* what) {
+  bool found = false;
+  auto handler = [&found, &predicate](nl80211::Attributes& msg_attrs, void*) {
+    try {
+      found = predicate(msg_attrs);
+    } catch (std::invalid_argument&) {
+      // notification lacks an attribute the predicate looks at
+      found = false;
+    }
+    return !found;
+  };
+
+  while (!found)
+    if (sock.wait_readable(time_left(deadline, what)))
+      sock.recv_pending(handler, nullptr);
+}
+
+void wait_event(
+    rtnl::Socket& sock, steady_clock::time_point deadline,
+    std::function<bool(std::uint16_t, rtnl::link const&)> const& predicate,
+    const char* what) {
+  bool found = false;
+  auto handler = [&found, &predicate](std::uint16_t type,
+                                      rtnl::link const& l) {
+    found = predicate(type, l);
+    return !found;
+  };
+
+  while (!found)
+    if (sock.wait_readable(time_left(deadline, what)))
+      sock.recv_pending(handler);
+}
+}  // namespace
+
+const std::chrono::milliseconds StreetpassInterface::SETUP_TIMEOUT(5000);
+
 StreetpassInterface::StreetpassInterface(PhysicalInterface const& phys,
                                          std::string const& name) {
+  auto start = steady_clock::now();
+  auto deadline = start + SETUP_TIMEOUT;
+
+  // subscribe before issuing any command so that no notification is missed
+  nl80211::Socket event_sock;
+  event_sock.add_membership("config");
+  event_sock.add_membership("mlme");
+  rtnl::Socket link_sock;
+  link_sock.add_membership(RTNLGRP_LINK);
+
   // TODO: handle exception
   nl80211::wiface w = nl80211::commands::new_interface(
       nlsock, phys.get_id(), NL80211_IFTYPE_ADHOC, name, true);
-  std::this_thread::sleep_for(std::chrono::seconds(1));
   m_index = w.index;
 
+  auto is_own_link = [this](std::uint16_t type, rtnl::link const& l) {
+    return type == RTM_NEWLINK &&
+           static_cast<std::uint32_t>(l.index) == m_index;
+  };
+  wait_event(link_sock, deadline, is_own_link,
+             "Timed out waiting for the interface to be registered");
+
   w = nl80211::commands::get_interface(nlsock, m_index);
   if (w.type != NL80211_IFTYPE_ADHOC) {
     down();
     nl80211::commands::set_interface_mode(nlsock, m_index,
                                           NL80211_IFTYPE_ADHOC);
-    std::this_thread::sleep_for(std::chrono::seconds(1));
+    auto is_adhoc = [this](nl80211::Attributes& msg_attrs) {
+      return msg_attrs.command() == NL80211_CMD_SET_INTERFACE &&
+             msg_attrs.get<std::uint32_t>(NL80211_ATTR_IFINDEX).value() ==
+                 m_index &&
+             msg_attrs.get<std::uint32_t>(NL80211_ATTR_IFTYPE).value() ==
+                 NL80211_IFTYPE_ADHOC;
+    };
+    wait_event(event_sock, deadline, is_adhoc,
+               "Timed out waiting for the interface mode change");
   }
 
-  if (!is_up()) up();
+  if (!is_up()) {
+    up();
+    auto is_own_link_up = [this](std::uint16_t type, rtnl::link const& l) {
+      return type == RTM_NEWLINK &&
+             static_cast<std::uint32_t>(l.index) == m_index &&
+             (l.flags & IFF_UP);
+    };
+    wait_event(link_sock, deadline, is_own_link_up,
+               "Timed out waiting for the interface to come up");
+  }
 
   nl80211::commands::join_ibss(nlsock, m_index, SSID, CHANNEL_FREQ, true,
                                w.mac);
+  auto is_joined = [this](nl80211::Attributes& msg_attrs) {
+    return msg_attrs.command() == NL80211_CMD_JOIN_IBSS &&
+           msg_attrs.get<std::uint32_t>(NL80211_ATTR_IFINDEX).value() ==
+               m_index;
+  };
+  wait_event(event_sock, deadline, is_joined,
+             "Timed out waiting for the IBSS to be joined");
+
+  m_key_slots = std::make_unique<KeySlotManager>(m_index);
+
+  m_ready_latency = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      steady_clock::now() - start);
+  ready_histogram().record(m_ready_latency.count());
 }
 
-namespace {
-bool is_streetpass_scan_probereq(Tins::Dot11ProbeRequest const& probereq) {
+bool StreetpassInterface::is_streetpass_scan_probereq(
+    Tins::Dot11ProbeRequest const& probereq) {
+  static auto& received = metrics::registry().counter(
+      "streetpass_frames_received_total", "Probe requests inspected.");
+  static auto& classified = metrics::registry().counter(
+      "streetpass_frames_classified_total",
+      "Probe requests recognized as StreetPass scans.");
+
+  received.inc();
   try {
-    return probereq.vendor_specific().oui == StreetpassInterface::OUI &&
-           probereq.addr1().is_broadcast() &&
-           probereq.ssid() == StreetpassInterface::SSID;
+    bool streetpass = probereq.vendor_specific().oui == OUI &&
+                      probereq.addr1().is_broadcast() &&
+                      probereq.ssid() == SSID;
+    if (streetpass) classified.inc();
+    return streetpass;
   } catch (Tins::option_not_found&) {
     return false;
   }
 }
-}  // namespace
+
+std::optional<cec::ModuleFilter> StreetpassInterface::parse_module_filter(
+    Tins::Dot11ProbeRequest const& probereq) {
+  try {
+    auto vendor_specific_data = probereq.vendor_specific().data;
+
+    // TODO: first byte of vendor specific data is always 0x01?
+    if (vendor_specific_data.size() == 0 ||
+        vendor_specific_data.at(0) != 0x01) {
+      static auto& bad_prefix = rejected_frames("bad vendor specific data");
+      bad_prefix.inc();
+      STREETPASS_TRACE_EVENT(PARSED, probereq.addr2().begin(),
+                             trace::BAD_VENDOR_DATA);
+      return std::nullopt;
+    }
+
+    auto module_filter_bytes = &vendor_specific_data[1];
+    unsigned module_filter_bytes_size = vendor_specific_data.size() - 1;
+    auto module_filter = cec::Parser<cec::ModuleFilter>::from_bytes(
+        module_filter_bytes, module_filter_bytes_size);
+    STREETPASS_TRACE_EVENT(PARSED, probereq.addr2().begin(), trace::PARSE_OK);
+    return module_filter;
+  } catch (const char*) {
+    // the parser counts its errors in detail
+    static auto& bad_filter = rejected_frames("bad module filter");
+    bad_filter.inc();
+    STREETPASS_TRACE_EVENT(PARSED, probereq.addr2().begin(),
+                           trace::BAD_MODULE_FILTER);
+    return std::nullopt;
+  } catch (...) {
+    static auto& no_vendor = rejected_frames("no vendor specific element");
+    no_vendor.inc();
+    STREETPASS_TRACE_EVENT(PARSED, probereq.addr2().begin(),
+                           trace::NO_VENDOR_ELEMENT);
+    return std::nullopt;
+  }
+}
 
 void StreetpassInterface::scan_with_cb(
     unsigned int timeout,
@@ -63,7 +244,9 @@ void StreetpassInterface::scan_with_cb(
       Tins::Dot11::Types::MANAGEMENT |
           (Tins::Dot11::ManagementSubtypes::PROBE_REQ << 4));
 
-  auto handler = [callback](nl80211::Attributes& msg_attrs, void*) {
+  auto handler = [this, callback](nl80211::Attributes& msg_attrs, void*) {
+    auto rx = std::chrono::steady_clock::now();
+    auto& latency = metrics::response_latency();
     std::vector<std::uint8_t> data;
     try {
       data =
@@ -73,30 +256,41 @@ void StreetpassInterface::scan_with_cb(
     }
 
     Tins::Dot11ProbeRequest probereq(data.data(), data.size());
-    if (!is_streetpass_scan_probereq(probereq)) return true;
+    auto peer_addr = probereq.addr2();
+    STREETPASS_TRACE_EVENT(RECEIVED, peer_addr.begin(), 0);
 
-    auto vendor_specific_data = probereq.vendor_specific().data;
+    bool streetpass = is_streetpass_scan_probereq(probereq);
+    STREETPASS_TRACE_EVENT(CLASSIFIED, peer_addr.begin(), streetpass);
+    if (!streetpass) return true;
+    latency.mark(metrics::stage::CLASSIFIED, rx);
 
-    // TODO: first byte of vendor specific data is always 0x01?
-    if (vendor_specific_data.size() == 0 || vendor_specific_data.at(0) != 0x01)
-      return true;
+    // a peer still scanning keeps its pairwise key alive
+    KeySlotManager::mac_type peer_mac;
+    std::copy(peer_addr.begin(), peer_addr.end(), peer_mac.begin());
+    m_key_slots->touch(peer_mac);
+
+    auto module_filter = parse_module_filter(probereq);
+    if (!module_filter) return true;
+    latency.mark(metrics::stage::PARSED, rx);
 
-    auto module_filter_bytes = &vendor_specific_data[1];
-    unsigned module_filter_bytes_size = vendor_specific_data.size() - 1;
     try {
-      auto peer_addr = probereq.addr2();
-      cec::ModuleFilter module_filter =
-          cec::Parser<cec::ModuleFilter>::from_bytes(module_filter_bytes,
-                                                     module_filter_bytes_size);
-      return callback(peer_addr, module_filter);
+      bool should_continue = callback(peer_addr, *module_filter);
+      latency.mark(metrics::stage::MATCHED, rx);
+      STREETPASS_TRACE_EVENT(DELIVERED, peer_addr.begin(), should_continue);
+      return should_continue;
     } catch (...) {
+      STREETPASS_TRACE_EVENT(DELIVERED, peer_addr.begin(), -1);
       return true;
     }
-
-    return true;
   };
 
   scan_sock.recv_messages(handler, nullptr, true, timeout);
+
+  try {
+    m_key_slots->expire();
+  } catch (nl80211::NlError&) {
+    // not a scan failure, the stale keys go away with the interface
+  }
 }
 
 std::map<Tins::HWAddress<6>, cec::ModuleFilter> StreetpassInterface::scan(
@@ -128,9 +322,11 @@ std::map<Tins::HWAddress<6>, cec::ModuleFilter> StreetpassInterface::scan(
 
 std::map<Tins::HWAddress<6>, cec::ModuleFilter> StreetpassInterface::scan(
     unsigned int timeout, cec::ModuleFilter const& module_filter) {
-  auto filter_match = [module_filter](Tins::HWAddress<6> const&,
+  auto filter_match = [module_filter](Tins::HWAddress<6> const& peer_addr,
                                       cec::ModuleFilter const& other) {
-    return module_filter.match(other);
+    bool matched = module_filter.match(other);
+    STREETPASS_TRACE_EVENT(MATCHED, peer_addr.begin(), matched);
+    return matched;
   };
 
   return scan(timeout, filter_match);
@@ -150,9 +346,14 @@ Tins::Dot11ProbeResponse StreetpassInterface::make_initial_proberesp(
   proberesp.ibss_parameter_set(0);
 
   // TODO: maybe move the byte alias outside the cec namespace
-  cec::bytes vendor_specific_data = cec::bytes(module_filter);
+  cec::bytes module_filter_bytes = cec::bytes(module_filter);
+  cec::bytes vendor_specific_data;
+  vendor_specific_data.reserve(module_filter_bytes.size() + 1);
   // TODO: first byte is always 0x01?
-  vendor_specific_data.insert(vendor_specific_data.begin(), 0x01);
+  vendor_specific_data.push_back(0x01);
+  vendor_specific_data.insert(vendor_specific_data.end(),
+                              module_filter_bytes.begin(),
+                              module_filter_bytes.end());
   Tins::Dot11ManagementFrame::vendor_specific_type nintendo_vendor_ie(
       OUI, vendor_specific_data);
 
@@ -161,32 +362,25 @@ Tins::Dot11ProbeResponse StreetpassInterface::make_initial_proberesp(
   return proberesp;
 }
 
-void StreetpassInterface::associate(unsigned int timeout,
+bool StreetpassInterface::associate(unsigned int timeout,
                                     Tins::HWAddress<6> const& peer_addr,
-                                    cec::ModuleFilter const& module_filter) {
-  // TODO: check timeout nullity & throw exception
-  bool found_peer = false;
-  auto is_peer = [&found_peer, peer_addr, module_filter](
-                     Tins::HWAddress<6> const& other_addr,
-                     cec::ModuleFilter const& other) {
-    if (other_addr == peer_addr /*&& module_filter.match(other)*/) {
-      found_peer = true;
-      return false;
-    }
-    return true;
+                                    cec::ModuleFilter const& module_filter,
+                                    AssociationEngine::key_fn const& key) {
+  if (timeout == 0) return false;
+
+  AssociationEngine engine(*this, module_filter, key);
+  bool associated = false;
+  auto is_peer = [peer_addr](Tins::HWAddress<6> const& other_addr,
+                             cec::ModuleFilter const&) {
+    return other_addr == peer_addr;
+  };
+  auto on_result = [&associated](AssociationEngine::result const& r) {
+    associated = r.final_state == AssociationEngine::state::ASSOCIATED;
+    return false;
   };
 
-  scan(timeout, is_peer);
-  if (!found_peer) {
-    std::cout << "-- Could not find peer --" << std::endl;
-    // TODO: throw exception
-    return;
-  }
-
-  std::cout << "-- Found peer streetpass probe request --" << std::endl;
-  // TODO: send initial probresp
-  // TODO: wait for assoc probereq
-  // TODO: send assoc proberesp
+  engine.run(std::chrono::milliseconds(timeout), is_peer, on_result);
+  return associated;
 }
 
 }  // namespace streetpass::iface
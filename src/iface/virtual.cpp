@@ -1,15 +1,30 @@
 #include "iface/virtual.hpp"
 
-#include "iface/ioctl.hpp"
+#include <algorithm>
+#include <mutex>
+
+#include "iface/info_cache.hpp"
+#include "iface/rtnl.hpp"
 
 namespace streetpass::iface {
+namespace {
+// Link requests of every interface go through one socket, created on first
+// use. A request and its ack must not interleave with another one, errors
+// are thrown as NlError.
+std::mutex link_sock_mutex;
+
+rtnl::Socket& link_sock() {
+  static rtnl::Socket sock;
+  return sock;
+}
+}  // namespace
+
 VirtualInterface::VirtualInterface() : m_index(-1) {}
 
 VirtualInterface::VirtualInterface(std::uint32_t index) : m_index(index) {}
 
 nl80211::wiface VirtualInterface::get_all_info(std::uint32_t index) {
-  nl80211::Socket nlsock;
-  return nl80211::commands::get_interface(nlsock, index);
+  return InfoCache::instance().get_interface(index);
 }
 
 Tins::HWAddress<6> VirtualInterface::get_mac_addr() const {
@@ -21,20 +36,26 @@ std::string VirtualInterface::get_name() const {
 }
 
 bool VirtualInterface::is_up() const {
-  // TODO: exception handling?
-  ioctl::Socket sock;
-  return ioctl::is_interface_up(sock, get_name());
+  std::lock_guard<std::mutex> lock(link_sock_mutex);
+  return rtnl::is_link_up(link_sock(), m_index);
 }
 
 void VirtualInterface::up() const {
-  // TODO: exception handling?
-  ioctl::Socket sock;
-  ioctl::set_interface_up(sock, get_name());
+  std::lock_guard<std::mutex> lock(link_sock_mutex);
+  rtnl::set_link_up(link_sock(), m_index);
 }
 
 void VirtualInterface::down() const {
-  // TODO: exception handling?
-  ioctl::Socket sock;
-  ioctl::set_interface_down(sock, get_name());
+  std::lock_guard<std::mutex> lock(link_sock_mutex);
+  rtnl::set_link_down(link_sock(), m_index);
+}
+
+void VirtualInterface::down(std::vector<VirtualInterface> const& ifaces) {
+  std::vector<int> indices;
+  std::transform(ifaces.begin(), ifaces.end(), std::back_inserter(indices),
+                 [](auto const& x) { return x.m_index; });
+
+  std::lock_guard<std::mutex> lock(link_sock_mutex);
+  rtnl::set_links_state(link_sock(), indices, false);
 }
 }  // namespace streetpass::iface
@@ -1,21 +1,135 @@
 #include <tins/tins.h>
 
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <set>
 
 #include "cec/cec.hpp"
 #include "cec/endian_types.hpp"
 #include "cec/module_filter.hpp"
+#include "crypto/crypto.hpp"
+#include "crypto/key_cache.hpp"
+#include "history/peer_store.hpp"
+#include "iface/association.hpp"
 #include "iface/physical.hpp"
+#include "iface/scheduler.hpp"
 #include "iface/streetpass.hpp"
+#include "metrics/exporter.hpp"
+#include "metrics/latency.hpp"
 #include "nl80211/message.hpp"
 #include "nl80211/socket.hpp"
+#include "trace/trace.hpp"
 
 using namespace streetpass;
 
+namespace {
+std::uint64_t to_mac(Tins::HWAddress<6> const& addr) {
+  std::array<std::uint8_t, 6> mac;
+  std::copy(addr.begin(), addr.end(), mac.begin());
+  return history::PeerStore::pack_mac(mac);
+}
+
+cec::ModuleFilter read_module_filter(const char* path) {
+  std::ifstream f(path, std::ios::binary);
+  cec::bytes data((std::istreambuf_iterator<char>(f)),
+                  std::istreambuf_iterator<char>());
+  return cec::Parser<cec::ModuleFilter>::from_bytes(data);
+}
+
+// Pairs with the peers in range for a while, the scheduler deciding which of
+// them get one of the exchange slots.
+void exchange(iface::StreetpassInterface& siface,
+              cec::ModuleFilter const& own) {
+  if (const char* path = std::getenv("STREETPASS_NORMAL_KEY"))
+    crypto::load_normal_key(path);
+  if (const char* path = std::getenv("STREETPASS_CECD_KEY"))
+    crypto::load_cecd_key(path);
+
+  // exchanges of previous runs, so a restart does not meet everyone again
+  std::unique_ptr<history::PeerStore> store;
+  if (const char* path = std::getenv("STREETPASS_HISTORY_FILE"))
+    store = std::make_unique<history::PeerStore>(path);
+
+  iface::ExchangeScheduler scheduler(own);
+  std::map<Tins::HWAddress<6>, cec::ModuleFilter> admitted;
+  std::set<Tins::HWAddress<6>> looked_up;
+  auto accept = [&store, &scheduler, &admitted, &looked_up](
+                    Tins::HWAddress<6> const& addr,
+                    cec::ModuleFilter const& filter) {
+    if (store && looked_up.insert(addr).second) {
+      auto last = store->last(to_mac(addr));
+      if (last && last->result == history::outcome::EXCHANGED) {
+        auto age = std::chrono::system_clock::now() - last->time;
+        scheduler.remember(
+            addr, iface::ExchangeScheduler::clock::now() -
+                      std::chrono::duration_cast<
+                          iface::ExchangeScheduler::clock::duration>(age));
+      }
+    }
+    if (!scheduler.admit(addr, filter)) return false;
+    admitted.insert_or_assign(addr, filter);
+    return true;
+  };
+
+  // we answer the scan, so we are assumed to be the master of the pair
+  std::array<std::uint8_t, 6> own_mac;
+  auto own_addr = siface.get_mac_addr();
+  std::copy(own_addr.begin(), own_addr.end(), own_mac.begin());
+  // consoles met again skip the HMAC and AES derivation
+  crypto::KeyCache keys(256);
+  auto key = [&own, &own_mac, &admitted, &keys](
+                 Tins::HWAddress<6> const& addr,
+                 Tins::Dot11ProbeRequest const&) {
+    std::array<std::uint8_t, 6> peer_mac;
+    std::copy(addr.begin(), addr.end(), peer_mac.begin());
+    return keys.streetpass_ccmp_key(own.key(), own_mac,
+                                    admitted.at(addr).key(), peer_mac);
+  };
+
+  auto on_result = [&store, &scheduler,
+                    &admitted](iface::AssociationEngine::result const& r) {
+    bool associated =
+        r.final_state == iface::AssociationEngine::state::ASSOCIATED;
+    scheduler.complete(r.peer, associated);
+    if (store)
+      store->append({to_mac(r.peer), std::chrono::system_clock::now(),
+                     history::PeerStore::hash(admitted.at(r.peer)),
+                     associated ? history::outcome::EXCHANGED
+                                : history::outcome::FAILED});
+    admitted.erase(r.peer);
+    std::cout << r.peer << (associated ? " associated" : " failed")
+              << std::endl;
+    return true;
+  };
+
+  iface::AssociationEngine engine(siface, own, key);
+  engine.run(std::chrono::seconds(30), accept, on_result);
+  std::cout << "still queued " << scheduler.queued() << ", shed "
+            << scheduler.shed() << std::endl;
+}
+}  // namespace
+
 int main(int argc, char** argv) {
   /*cec::endian_types::u32be a = 0xAABBCCDD;
   std::cout << std::hex << a << std::endl;*/
+  metrics::dump_response_latency_on_exit();
+
+  // e.g. curl --unix-socket $STREETPASS_METRICS_SOCKET http://localhost/
+  std::unique_ptr<metrics::UnixSocketExporter> exporter;
+  if (const char* path = std::getenv("STREETPASS_METRICS_SOCKET"))
+    exporter = std::make_unique<metrics::UnixSocketExporter>(path);
+  // decode with streetpass_trace_dump, empty unless built with STREETPASS_TRACE
+  if (const char* path = std::getenv("STREETPASS_TRACE_FILE"))
+    trace::dump_on_exit(path);
+
   iface::PhysicalInterface phys(6);
   iface::StreetpassInterface siface = phys.setup_streetpass_interface();
   auto res = siface.scan(5000);
@@ -24,6 +138,10 @@ int main(int argc, char** argv) {
     std::cout << hwaddr << std::endl;
     std::cout << module_filter << std::endl;
   }
+
+  // our own module filter, as serialized in the probe requests
+  if (const char* path = std::getenv("STREETPASS_MODULE_FILTER"))
+    exchange(siface, read_module_filter(path));
   /*std::vector<uint8_t> d = {0x11, 0x0D, 0x00, 0x05, 0x16, 0x00, 0x31,
                             0xFF, 0xEE, 0xDD, 0x00, 0x02, 0x08, 0x00,
                             0x00, 0xf0, 0x08, 0x68, 0xc7, 0x27, 0x39,
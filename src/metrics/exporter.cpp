@@ -0,0 +1,121 @@
+#include "metrics/exporter.hpp"
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <system_error>
+
+namespace streetpass::metrics {
+
+namespace {
+bool write_all(int fd, const char* data, std::size_t size) {
+  while (size > 0) {
+    ssize_t n = send(fd, data, size, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    data += n;
+    size -= n;
+  }
+  return true;
+}
+}  // namespace
+
+UnixSocketExporter::UnixSocketExporter(std::string const& path, Registry& r)
+    : m_path(path), m_registry(r) {
+  sockaddr_un addr = {};
+  addr.sun_family = AF_UNIX;
+  if (m_path.size() >= sizeof(addr.sun_path))
+    throw std::system_error(ENAMETOOLONG, std::generic_category(),
+                            "Metrics socket path too long");
+  std::strcpy(addr.sun_path, m_path.c_str());
+
+  m_listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (m_listen_fd < 0)
+    throw std::system_error(errno, std::generic_category(),
+                            "Failed to create metrics socket");
+
+  // a stale socket from a previous run would make bind fail
+  unlink(m_path.c_str());
+  if (bind(m_listen_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) <
+          0 ||
+      listen(m_listen_fd, 8) < 0) {
+    int err = errno;
+    close(m_listen_fd);
+    throw std::system_error(err, std::generic_category(),
+                            "Failed to listen on " + m_path);
+  }
+
+  m_stop_fd = eventfd(0, EFD_CLOEXEC);
+  if (m_stop_fd < 0) {
+    int err = errno;
+    close(m_listen_fd);
+    unlink(m_path.c_str());
+    throw std::system_error(err, std::generic_category(),
+                            "Failed to create eventfd");
+  }
+
+  m_thread = std::thread(&UnixSocketExporter::serve, this);
+}
+
+UnixSocketExporter::~UnixSocketExporter() {
+  std::uint64_t one = 1;
+  if (write(m_stop_fd, &one, sizeof(one)) < 0) {
+    // the thread is then left polling until the process exits
+  }
+  m_thread.join();
+
+  close(m_stop_fd);
+  close(m_listen_fd);
+  unlink(m_path.c_str());
+}
+
+void UnixSocketExporter::serve() {
+  pollfd fds[2] = {{m_listen_fd, POLLIN, 0}, {m_stop_fd, POLLIN, 0}};
+
+  while (true) {
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR) continue;
+      return;
+    }
+    if (fds[1].revents != 0) return;
+    if ((fds[0].revents & POLLIN) == 0) continue;
+
+    int fd = accept4(m_listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd < 0) continue;
+    reply(fd);
+    close(fd);
+  }
+}
+
+void UnixSocketExporter::reply(int fd) {
+  // drain the request if the client sent one, but never wait long on it
+  timeval timeout = {0, 100000};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  char request[1024];
+  if (recv(fd, request, sizeof(request), 0) < 0) {
+    // plain readers like socat send nothing
+  }
+
+  std::stringstream body;
+  m_registry.write_prometheus(body);
+  std::string text = body.str();
+
+  std::stringstream response;
+  response << "HTTP/1.0 200 OK\r\n"
+           << "Content-Type: text/plain; version=0.0.4\r\n"
+           << "Content-Length: " << text.size() << "\r\n\r\n"
+           << text;
+  std::string out = response.str();
+  // a client that never reads must not block the serve thread, nor the
+  // destructor joining it
+  timeout = {1, 0};
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+  write_all(fd, out.data(), out.size());
+}
+}  // namespace streetpass::metrics
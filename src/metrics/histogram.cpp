@@ -0,0 +1,68 @@
+#include "metrics/histogram.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace streetpass::metrics {
+
+std::size_t Histogram::bucket_index(std::uint64_t value) noexcept {
+  if (value < 2 * SUB_BUCKET_COUNT) return value;
+
+  unsigned msb = 63 - __builtin_clzll(value);
+  if (msb >= MAX_VALUE_BITS) return BUCKET_COUNT - 1;
+
+  // keep the SUB_BUCKET_BITS bits following the most significant one
+  unsigned shift = msb - SUB_BUCKET_BITS;
+  return shift * SUB_BUCKET_COUNT + (value >> shift);
+}
+
+std::uint64_t Histogram::bucket_value(std::size_t index) noexcept {
+  if (index < 2 * SUB_BUCKET_COUNT) return index;
+
+  // inverse of bucket_index(), highest value of the bucket
+  std::size_t shift = index / SUB_BUCKET_COUNT - 1;
+  std::uint64_t sub = index - shift * SUB_BUCKET_COUNT;
+  return ((sub + 1) << shift) - 1;
+}
+
+void Histogram::record(std::uint64_t value) noexcept {
+  m_buckets[bucket_index(value)].fetch_add(1, std::memory_order_relaxed);
+  m_count.fetch_add(1, std::memory_order_relaxed);
+  m_sum.fetch_add(value, std::memory_order_relaxed);
+
+  std::uint64_t max = m_max.load(std::memory_order_relaxed);
+  while (value > max &&
+         !m_max.compare_exchange_weak(max, value, std::memory_order_relaxed))
+    ;
+}
+
+void Histogram::reset() noexcept {
+  for (auto& bucket : m_buckets) bucket.store(0, std::memory_order_relaxed);
+  m_count.store(0, std::memory_order_relaxed);
+  m_sum.store(0, std::memory_order_relaxed);
+  m_max.store(0, std::memory_order_relaxed);
+}
+
+double Histogram::mean() const noexcept {
+  std::uint64_t count = m_count.load(std::memory_order_relaxed);
+  if (count == 0) return 0;
+
+  return static_cast<double>(m_sum.load(std::memory_order_relaxed)) / count;
+}
+
+std::uint64_t Histogram::percentile(double p) const noexcept {
+  std::uint64_t count = m_count.load(std::memory_order_relaxed);
+  if (count == 0) return 0;
+
+  p = std::clamp(p, 0.0, 100.0);
+  auto target = std::max<std::uint64_t>(
+      1, static_cast<std::uint64_t>(std::ceil(p / 100.0 * count)));
+
+  std::uint64_t seen = 0;
+  for (std::size_t i = 0; i < BUCKET_COUNT; ++i) {
+    seen += m_buckets[i].load(std::memory_order_relaxed);
+    if (seen >= target) return std::min(bucket_value(i), max());
+  }
+  return max();
+}
+}  // namespace streetpass::metrics
@@ -0,0 +1,63 @@
+#include "metrics/latency.hpp"
+
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+
+namespace streetpass::metrics {
+
+const char* stage_name(stage s) noexcept {
+  switch (s) {
+    case stage::CLASSIFIED:
+      return "classified";
+    case stage::PARSED:
+      return "parsed";
+    case stage::MATCHED:
+      return "matched";
+    case stage::TX_DONE:
+      return "tx_done";
+    default:
+      return "unknown";
+  }
+}
+
+void ResponseLatency::mark(stage s, clock::time_point rx) noexcept {
+  auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      clock::now() - rx);
+  m_stages[static_cast<std::size_t>(s)].record(elapsed.count());
+}
+
+void ResponseLatency::reset() noexcept {
+  for (auto& h : m_stages) h.reset();
+}
+
+void ResponseLatency::dump(std::ostream& os) const {
+  auto us = [](double ns) { return ns / 1000.0; };
+
+  os << std::fixed << std::setprecision(1);
+  for (std::size_t i = 0; i < m_stages.size(); ++i) {
+    auto const& h = m_stages[i];
+    os << std::left << std::setw(12) << stage_name(static_cast<stage>(i))
+       << " count=" << h.count() << " mean=" << us(h.mean())
+       << "us p50=" << us(h.percentile(50)) << "us p90="
+       << us(h.percentile(90)) << "us p99=" << us(h.percentile(99))
+       << "us p99.9=" << us(h.percentile(99.9)) << "us max=" << us(h.max())
+       << "us" << std::endl;
+  }
+}
+
+ResponseLatency& response_latency() {
+  static ResponseLatency instance;
+  return instance;
+}
+
+void dump_response_latency_on_exit() {
+  // construct the instance first so it outlives the atexit handler
+  response_latency();
+  static bool registered = false;
+  if (registered) return;
+
+  registered = true;
+  std::atexit([] { response_latency().dump(std::cerr); });
+}
+}  // namespace streetpass::metrics
@@ -0,0 +1,146 @@
+#include "metrics/registry.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include <system_error>
+
+#include "metrics/latency.hpp"
+
+namespace streetpass::metrics {
+
+namespace {
+std::string escape(std::string const& value) {
+  std::string escaped;
+  escaped.reserve(value.size());
+  for (char c : value) {
+    if (c == '\\' || c == '"')
+      escaped += {'\\', c};
+    else if (c == '\n')
+      escaped += "\\n";
+    else
+      escaped += c;
+  }
+  return escaped;
+}
+
+std::string render(Registry::labels const& l) {
+  if (l.empty()) return "";
+
+  std::string rendered = "{";
+  for (auto const& [name, value] : l) {
+    if (rendered.size() > 1) rendered += ",";
+    rendered += name + "=\"" + escape(value) + "\"";
+  }
+  return rendered + "}";
+}
+
+void write_response_latency(std::ostream& os) {
+  static const char* NAME = "streetpass_response_latency_seconds";
+  static const double QUANTILES[] = {0.5, 0.9, 0.99, 0.999};
+
+  os << "# HELP " << NAME
+     << " Time from a probe request reception to each response stage.\n"
+     << "# TYPE " << NAME << " summary\n";
+
+  auto& latency = response_latency();
+  for (std::size_t i = 0; i < static_cast<std::size_t>(stage::COUNT); ++i) {
+    auto s = static_cast<stage>(i);
+    auto const& h = latency.histogram(s);
+    std::string label = std::string("stage=\"") + stage_name(s) + "\"";
+
+    for (double q : QUANTILES)
+      os << NAME << "{" << label << ",quantile=\"" << q << "\"} "
+         << h.percentile(q * 100) / 1e9 << "\n";
+    os << NAME << "_sum{" << label << "} " << h.mean() * h.count() / 1e9
+       << "\n";
+    os << NAME << "_count{" << label << "} " << h.count() << "\n";
+  }
+}
+}  // namespace
+
+std::uint64_t Counter::value() const noexcept {
+  std::uint64_t sum = 0;
+  for (auto const& s : m_shards) sum += s.value.load(std::memory_order_relaxed);
+  return sum;
+}
+
+Registry::family& Registry::get_family(std::string const& name,
+                                       std::string const& help, type kind) {
+  auto [it, inserted] = m_families.try_emplace(name);
+  if (inserted) {
+    it->second.kind = kind;
+    it->second.help = help;
+  } else if (it->second.kind != kind) {
+    throw std::invalid_argument("metric " + name +
+                                " registered with another type");
+  }
+  return it->second;
+}
+
+Counter& Registry::counter(std::string const& name, std::string const& help,
+                           labels const& l) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto& slot = get_family(name, help, type::COUNTER).counters[render(l)];
+  if (!slot) slot = std::make_unique<Counter>();
+  return *slot;
+}
+
+Gauge& Registry::gauge(std::string const& name, std::string const& help,
+                       labels const& l) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto& slot = get_family(name, help, type::GAUGE).gauges[render(l)];
+  if (!slot) slot = std::make_unique<Gauge>();
+  return *slot;
+}
+
+void Registry::add_collector(collector c) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_collectors.push_back(std::move(c));
+}
+
+void Registry::write_prometheus(std::ostream& os) const {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  for (auto const& [name, f] : m_families) {
+    os << "# HELP " << name << " " << f.help << "\n"
+       << "# TYPE " << name << " "
+       << (f.kind == type::COUNTER ? "counter" : "gauge") << "\n";
+    for (auto const& [l, c] : f.counters)
+      os << name << l << " " << c->value() << "\n";
+    for (auto const& [l, g] : f.gauges)
+      os << name << l << " " << g->value() << "\n";
+  }
+
+  for (auto const& c : m_collectors) c(os);
+}
+
+void Registry::write_file(std::string const& path) const {
+  std::string tmp_path = path + ".tmp";
+  {
+    std::ofstream file(tmp_path, std::ios::trunc);
+    if (!file)
+      throw std::system_error(errno, std::generic_category(),
+                              "Failed to open " + tmp_path);
+    write_prometheus(file);
+    file.flush();
+    if (!file)
+      throw std::system_error(errno, std::generic_category(),
+                              "Failed to write " + tmp_path);
+  }
+
+  if (std::rename(tmp_path.c_str(), path.c_str()) < 0)
+    throw std::system_error(errno, std::generic_category(),
+                            "Failed to replace " + path);
+}
+
+Registry& registry() {
+  static Registry* instance = [] {
+    // never destroyed: metrics may still be bumped from static destructors
+    auto r = new Registry();
+    r->add_collector(write_response_latency);
+    return r;
+  }();
+  return *instance;
+}
+}  // namespace streetpass::metrics
@@ -8,52 +8,13 @@
 
 namespace streetpass::nl80211::commands {
 
-namespace {
-
 bool parse_wiphy_message(Attributes& msg_attrs, void* arg) {
   auto w = static_cast<struct wiphy*>(arg);
 
   w->index = msg_attrs.get<std::uint32_t>(NL80211_ATTR_WIPHY).value();
   w->name = msg_attrs.get<std::string>(NL80211_ATTR_WIPHY_NAME).value();
 
-  auto cmd_attrs =
-      msg_attrs.get<Attributes>(NL80211_ATTR_SUPPORTED_COMMANDS).value();
-  for (auto attr_type : cmd_attrs.types())
-    w->supported_cmds.insert(cmd_attrs.get<std::uint32_t>(attr_type).value());
-
-  auto iftype_attrs =
-      msg_attrs.get<Attributes>(NL80211_ATTR_SUPPORTED_IFTYPES).value();
-  for (auto attr_type : iftype_attrs.types())
-    w->supported_iftypes.insert(attr_type);
-
-  auto ciphers =
-      msg_attrs.get<std::vector<std::uint32_t>>(NL80211_ATTR_CIPHER_SUITES)
-          .value();
-  for (auto c : ciphers) w->supported_ciphers.insert(c);
-
-  auto bands = msg_attrs.get<Attributes>(NL80211_ATTR_WIPHY_BANDS).value();
-  for (auto id : bands.types()) {
-    struct band b = {};
-
-    auto band_attrs = bands.get<Attributes>(id).value();
-    auto freqs = band_attrs.get<Attributes>(NL80211_BAND_ATTR_FREQS).value();
-    for (auto id : freqs.types()) {
-      auto freq_attrs = freqs.get<Attributes>(id).value();
-      auto freq_value =
-          freq_attrs.get<std::uint32_t>(NL80211_FREQUENCY_ATTR_FREQ).value();
-      b.freqs.insert(freq_value);
-    }
-
-    auto rates = band_attrs.get<Attributes>(NL80211_BAND_ATTR_RATES).value();
-    for (auto id : rates.types()) {
-      auto rate_attrs = rates.get<Attributes>(id).value();
-      auto rate_value =
-          rate_attrs.get<std::uint32_t>(NL80211_BITRATE_ATTR_RATE).value();
-      b.bitrates.insert(0.1f * rate_value);
-    }
-
-    w->bands.push_back(b);
-  }
+  w->capabilities = WiphyCapabilities(msg_attrs);
 
   return true;
 }
@@ -75,33 +36,90 @@ bool parse_interface_message(Attributes& msg_attrs, void* arg) {
 
   return true;
 }
+
+namespace {
+std::unique_ptr<Message> make_new_key_message(
+    Socket& nlsock, std::uint32_t if_idx, std::uint8_t key_idx,
+    std::uint32_t cipher, std::array<std::uint8_t, 6> const& mac,
+    std::vector<std::uint8_t> const& key) {
+  auto msg = std::make_unique<Message>(NL80211_CMD_NEW_KEY,
+                                       nlsock.get_driver_id());
+  msg->put(NL80211_ATTR_IFINDEX, if_idx);
+  msg->put(NL80211_ATTR_KEY_DATA, key);
+  msg->put(NL80211_ATTR_KEY_CIPHER, cipher);
+  msg->put(NL80211_ATTR_MAC,
+           std::vector<std::uint8_t>(mac.begin(), mac.end()));
+  msg->put(NL80211_ATTR_KEY_TYPE,
+           static_cast<std::uint32_t>(NL80211_KEYTYPE_PAIRWISE));
+  msg->put(NL80211_ATTR_KEY_IDX, key_idx);
+  return msg;
+}
+
+std::unique_ptr<Message> make_del_key_message(
+    Socket& nlsock, std::uint32_t if_idx, std::uint8_t key_idx,
+    std::array<std::uint8_t, 6> const& mac) {
+  auto msg = std::make_unique<Message>(NL80211_CMD_DEL_KEY,
+                                       nlsock.get_driver_id());
+  msg->put(NL80211_ATTR_IFINDEX, if_idx);
+  msg->put(NL80211_ATTR_MAC,
+           std::vector<std::uint8_t>(mac.begin(), mac.end()));
+  msg->put(NL80211_ATTR_KEY_IDX, key_idx);
+  return msg;
+}
 }  // namespace
 
 void new_key(Socket& nlsock, std::uint32_t if_idx, std::uint8_t key_idx,
              std::uint32_t cipher, std::array<std::uint8_t, 6> const& mac,
              std::vector<std::uint8_t> const& key) {
-  Message msg(NL80211_CMD_NEW_KEY, nlsock.get_driver_id());
-  msg.put(NL80211_ATTR_IFINDEX, if_idx);
-  msg.put(NL80211_ATTR_KEY_DATA, key);
-  msg.put(NL80211_ATTR_KEY_CIPHER, cipher);
-  msg.put(NL80211_ATTR_MAC, std::vector<std::uint8_t>(mac.begin(), mac.end()));
-  msg.put(NL80211_ATTR_KEY_TYPE,
-          static_cast<std::uint32_t>(NL80211_KEYTYPE_PAIRWISE));
-  msg.put(NL80211_ATTR_KEY_IDX, key_idx);
-  nlsock.send_message(msg);
+  auto msg = make_new_key_message(nlsock, if_idx, key_idx, cipher, mac, key);
+  nlsock.send_message(*msg);
   nlsock.recv_messages();
 }
 
 void del_key(Socket& nlsock, std::uint32_t if_idx, std::uint8_t key_idx,
              std::array<std::uint8_t, 6> const& mac) {
-  Message msg(NL80211_CMD_DEL_KEY, nlsock.get_driver_id());
-  msg.put(NL80211_ATTR_IFINDEX, if_idx);
-  msg.put(NL80211_ATTR_MAC, std::vector<std::uint8_t>(mac.begin(), mac.end()));
-  msg.put(NL80211_ATTR_KEY_IDX, key_idx);
-  nlsock.send_message(msg);
+  auto msg = make_del_key_message(nlsock, if_idx, key_idx, mac);
+  nlsock.send_message(*msg);
   nlsock.recv_messages();
 }
 
+std::vector<int> new_keys(Socket& nlsock, std::uint32_t if_idx,
+                          std::uint32_t cipher,
+                          std::vector<pairwise_key> const& keys) {
+  std::vector<std::unique_ptr<Message>> msgs;
+  msgs.reserve(keys.size());
+  for (auto const& k : keys)
+    msgs.push_back(
+        make_new_key_message(nlsock, if_idx, k.key_idx, cipher, k.mac, k.key));
+
+  return nlsock.send_batch(msgs);
+}
+
+std::vector<int> del_keys(Socket& nlsock, std::uint32_t if_idx,
+                          std::vector<pairwise_key> const& keys) {
+  std::vector<std::unique_ptr<Message>> msgs;
+  msgs.reserve(keys.size());
+  for (auto const& k : keys)
+    msgs.push_back(make_del_key_message(nlsock, if_idx, k.key_idx, k.mac));
+
+  return nlsock.send_batch(msgs);
+}
+
+std::vector<int> replace_keys(Socket& nlsock, std::uint32_t if_idx,
+                              std::uint32_t cipher,
+                              std::vector<pairwise_key> const& removed,
+                              std::vector<pairwise_key> const& added) {
+  std::vector<std::unique_ptr<Message>> msgs;
+  msgs.reserve(removed.size() + added.size());
+  for (auto const& k : removed)
+    msgs.push_back(make_del_key_message(nlsock, if_idx, k.key_idx, k.mac));
+  for (auto const& k : added)
+    msgs.push_back(
+        make_new_key_message(nlsock, if_idx, k.key_idx, cipher, k.mac, k.key));
+
+  return nlsock.send_batch(msgs);
+}
+
 void set_interface_mode(Socket& nlsock, std::uint32_t if_idx,
                         nl80211_iftype mode) {
   Message msg(NL80211_CMD_SET_INTERFACE, nlsock.get_driver_id());
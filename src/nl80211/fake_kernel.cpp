@@ -0,0 +1,932 @@
+#include "nl80211/fake_kernel.hpp"
+
+#include <linux/nl80211.h>
+#include <linux/rtnetlink.h>
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <netlink/genl/genl.h>
+#include <netlink/msg.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <shared_mutex>
+#include <stdexcept>
+#include <system_error>
+#include <unordered_map>
+
+namespace streetpass::nl80211 {
+
+struct FakeKernel::connection {
+  struct registration {
+    std::uint32_t if_idx;
+    std::uint16_t type;
+    bytes match;
+  };
+
+  int fd;  // kernel end of the socketpair
+  int protocol;
+  std::atomic<std::uint64_t> groups{0};
+
+  // server thread only
+  std::deque<bytes> out;
+  std::vector<registration> registrations;
+  bool closed = false;
+
+  connection(int fd, int protocol) : fd(fd), protocol(protocol) {}
+  ~connection() { ::close(fd); }
+};
+
+namespace {
+using msg_ptr = std::unique_ptr<nl_msg, decltype(&nlmsg_free)>;
+
+constexpr std::size_t RECV_BUFFER_SIZE = 64 * 1024;
+// events queued at once for a receiver of an unpaced injection
+constexpr std::size_t INJECT_BATCH = 64;
+constexpr std::uint16_t FRAME_TYPE_MASK = 0x00fc;
+constexpr std::size_t FRAME_HEADER_SIZE = 24;
+
+struct group {
+  const char* name;
+  int id;
+};
+constexpr group NL80211_GROUPS[] = {{"config", 1},     {"scan", 2},
+                                    {"regulatory", 3}, {"mlme", 4},
+                                    {"vendor", 5},     {"nan", 6},
+                                    {"testmode", 7}};
+constexpr int CONFIG_GROUP = 1;
+constexpr int MLME_GROUP = 4;
+
+constexpr std::uint32_t CIPHER_SUITES[] = {0x000fac01, 0x000fac05, 0x000fac02,
+                                           0x000fac04, 0x000fac06};
+constexpr std::uint32_t BITRATES[] = {10,  20,  55,  110, 60,  90,
+                                      120, 180, 240, 360, 480, 540};
+constexpr nl80211_commands WIPHY_COMMANDS[] = {
+    NL80211_CMD_NEW_INTERFACE, NL80211_CMD_SET_INTERFACE,
+    NL80211_CMD_NEW_KEY,       NL80211_CMD_DEL_KEY,
+    NL80211_CMD_JOIN_IBSS,     NL80211_CMD_REGISTER_FRAME,
+    NL80211_CMD_FRAME};
+constexpr nl80211_iftype WIPHY_IFTYPES[] = {
+    NL80211_IFTYPE_ADHOC, NL80211_IFTYPE_STATION, NL80211_IFTYPE_AP,
+    NL80211_IFTYPE_MONITOR};
+
+// sockets handed to the fake, looked up from the libnl overrides which
+// carry no user argument
+std::shared_mutex registry_mutex;
+std::unordered_map<nl_sock*, int> registry;
+
+int registered_fd(nl_sock* sk) {
+  std::shared_lock<std::shared_mutex> lock(registry_mutex);
+  auto it = registry.find(sk);
+  return it == registry.end() ? -1 : it->second;
+}
+
+int fake_send(nl_sock* sk, nl_msg* msg) {
+  int fd = registered_fd(sk);
+  if (fd < 0) return -NLE_BAD_SOCK;
+
+  nlmsghdr* hdr = nlmsg_hdr(msg);
+  ssize_t n = ::send(fd, hdr, hdr->nlmsg_len, MSG_NOSIGNAL);
+  return n < 0 ? -nl_syserr2nlerr(errno) : n;
+}
+
+int fake_recv(nl_sock* sk, sockaddr_nl* nla, unsigned char** buf, ucred**) {
+  int fd = registered_fd(sk);
+  if (fd < 0) return -NLE_BAD_SOCK;
+
+  ssize_t size;
+  do {
+    size = ::recv(fd, nullptr, 0, MSG_PEEK | MSG_TRUNC);
+  } while (size < 0 && errno == EINTR);
+  if (size < 0) return -nl_syserr2nlerr(errno);
+  // the fake kernel went away
+  if (size == 0) return -NLE_BAD_SOCK;
+
+  *buf = static_cast<unsigned char*>(std::malloc(size));
+  if (*buf == nullptr) return -NLE_NOMEM;
+
+  ssize_t n;
+  do {
+    n = ::recv(fd, *buf, size, 0);
+  } while (n < 0 && errno == EINTR);
+  if (n <= 0) {
+    int err = n < 0 ? -nl_syserr2nlerr(errno) : -NLE_BAD_SOCK;
+    std::free(*buf);
+    *buf = nullptr;
+    return err;
+  }
+
+  std::memset(nla, 0, sizeof(*nla));
+  nla->nl_family = AF_NETLINK;
+  return n;
+}
+
+std::vector<std::uint8_t> to_bytes(nl_msg* msg) {
+  auto hdr = nlmsg_hdr(msg);
+  auto data = reinterpret_cast<std::uint8_t*>(hdr);
+  return std::vector<std::uint8_t>(data, data + hdr->nlmsg_len);
+}
+
+void append(std::vector<std::uint8_t>& buffer,
+            std::vector<std::uint8_t> const& message) {
+  buffer.insert(buffer.end(), message.begin(), message.end());
+  buffer.resize(NLMSG_ALIGN(buffer.size()), 0);
+}
+
+msg_ptr make_msg() {
+  msg_ptr msg(nlmsg_alloc(), nlmsg_free);
+  if (msg.get() == nullptr) throw std::bad_alloc();
+  return msg;
+}
+
+// replies echo the request port and sequence, events have neither
+msg_ptr make_genl(nlmsghdr const* req, int flags, std::uint8_t cmd) {
+  msg_ptr msg = make_msg();
+  if (genlmsg_put(msg.get(), req ? req->nlmsg_pid : 0,
+                  req ? req->nlmsg_seq : 0, FakeKernel::FAMILY_ID, 0, flags,
+                  cmd, 0) == nullptr)
+    throw std::bad_alloc();
+  return msg;
+}
+
+std::vector<std::uint8_t> make_status(nlmsghdr const* req, int error) {
+  std::vector<std::uint8_t> message(NLMSG_HDRLEN + sizeof(nlmsgerr), 0);
+  auto hdr = reinterpret_cast<nlmsghdr*>(message.data());
+  hdr->nlmsg_len = message.size();
+  hdr->nlmsg_type = NLMSG_ERROR;
+  hdr->nlmsg_seq = req->nlmsg_seq;
+  hdr->nlmsg_pid = req->nlmsg_pid;
+
+  auto err = static_cast<nlmsgerr*>(NLMSG_DATA(hdr));
+  err->error = error;
+  err->msg = *req;
+  return message;
+}
+
+std::vector<std::uint8_t> make_done(nlmsghdr const* req) {
+  std::vector<std::uint8_t> message(NLMSG_HDRLEN + sizeof(int), 0);
+  auto hdr = reinterpret_cast<nlmsghdr*>(message.data());
+  hdr->nlmsg_len = message.size();
+  hdr->nlmsg_type = NLMSG_DONE;
+  hdr->nlmsg_flags = NLM_F_MULTI;
+  hdr->nlmsg_seq = req->nlmsg_seq;
+  hdr->nlmsg_pid = req->nlmsg_pid;
+  return message;
+}
+
+std::vector<std::uint8_t> make_wiphy(nlmsghdr const* req, int flags,
+                                     std::uint32_t index) {
+  msg_ptr msg = make_genl(req, flags, NL80211_CMD_NEW_WIPHY);
+  nl_msg* m = msg.get();
+  nla_put_u32(m, NL80211_ATTR_WIPHY, index);
+  nla_put_string(m, NL80211_ATTR_WIPHY_NAME,
+                 ("phy" + std::to_string(index)).c_str());
+
+  nlattr* iftypes = nla_nest_start(m, NL80211_ATTR_SUPPORTED_IFTYPES);
+  for (auto iftype : WIPHY_IFTYPES) nla_put_flag(m, iftype);
+  nla_nest_end(m, iftypes);
+
+  nlattr* cmds = nla_nest_start(m, NL80211_ATTR_SUPPORTED_COMMANDS);
+  int i = 0;
+  for (auto cmd : WIPHY_COMMANDS) nla_put_u32(m, ++i, cmd);
+  nla_nest_end(m, cmds);
+
+  nla_put(m, NL80211_ATTR_CIPHER_SUITES, sizeof(CIPHER_SUITES), CIPHER_SUITES);
+
+  // 2.4 GHz only, channels 1 to 13
+  nlattr* bands = nla_nest_start(m, NL80211_ATTR_WIPHY_BANDS);
+  nlattr* band = nla_nest_start(m, NL80211_BAND_2GHZ);
+  nlattr* freqs = nla_nest_start(m, NL80211_BAND_ATTR_FREQS);
+  for (int channel = 0; channel < 13; ++channel) {
+    nlattr* freq = nla_nest_start(m, channel);
+    nla_put_u32(m, NL80211_FREQUENCY_ATTR_FREQ, 2412 + 5 * channel);
+    nla_nest_end(m, freq);
+  }
+  nla_nest_end(m, freqs);
+  nlattr* rates = nla_nest_start(m, NL80211_BAND_ATTR_RATES);
+  i = 0;
+  for (auto bitrate : BITRATES) {
+    nlattr* rate = nla_nest_start(m, i++);
+    nla_put_u32(m, NL80211_BITRATE_ATTR_RATE, bitrate);
+    nla_nest_end(m, rate);
+  }
+  nla_nest_end(m, rates);
+  nla_nest_end(m, band);
+  nla_nest_end(m, bands);
+
+  return to_bytes(m);
+}
+
+std::uint32_t get_u32(nlattr* tb[], int attr, std::uint32_t def) {
+  return tb[attr] ? nla_get_u32(tb[attr]) : def;
+}
+}  // namespace
+
+// The transport of a single socket: a socketpair to the fake kernel, with
+// libnl's send and receive replaced by plain socket calls on it.
+class FakeTransport : public Transport {
+ private:
+  FakeKernel& m_kernel;
+  nl_sock* m_sock = nullptr;
+  int m_fd = -1;
+  std::shared_ptr<FakeKernel::connection> m_conn;
+
+ public:
+  explicit FakeTransport(FakeKernel& kernel) : m_kernel(kernel) {}
+
+  ~FakeTransport() override {
+    if (m_sock != nullptr) {
+      std::unique_lock<std::shared_mutex> lock(registry_mutex);
+      registry.erase(m_sock);
+    }
+    if (m_fd >= 0) ::close(m_fd);
+  }
+
+  FakeTransport(const FakeTransport&) = delete;
+  FakeTransport& operator=(const FakeTransport&) = delete;
+
+  int connect(nl_sock* sock, int protocol) override {
+    if (protocol != NETLINK_GENERIC && protocol != NETLINK_ROUTE)
+      return -NLE_PROTO_MISMATCH;
+    if (m_sock != nullptr) return -NLE_BAD_SOCK;
+
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) < 0)
+      return -nl_syserr2nlerr(errno);
+
+    m_sock = sock;
+    m_fd = fds[0];
+    m_conn = std::make_shared<FakeKernel::connection>(fds[1], protocol);
+    {
+      std::unique_lock<std::shared_mutex> lock(registry_mutex);
+      registry[m_sock] = m_fd;
+    }
+
+    nl_cb* cb = nl_socket_get_cb(m_sock);
+    nl_cb_overwrite_send(cb, fake_send);
+    nl_cb_put(cb);
+
+    // adopted before any request can be sent on the socket
+    m_kernel.adopt(m_conn);
+    return 0;
+  }
+
+  int resolve_family(std::string const& family) override {
+    return family == "nl80211" ? FakeKernel::FAMILY_ID : -NLE_OBJ_NOTFOUND;
+  }
+
+  int resolve_group(std::string const& family,
+                    std::string const& name) override {
+    if (family != "nl80211") return -NLE_OBJ_NOTFOUND;
+    for (auto const& g : NL80211_GROUPS)
+      if (name == g.name) return g.id;
+    return -NLE_OBJ_NOTFOUND;
+  }
+
+  // applied right away, so that no event sent afterwards is missed
+  int add_membership(int group) override {
+    if (m_conn == nullptr) return -NLE_BAD_SOCK;
+    if (group <= 0 || group >= 64) return -NLE_INVAL;
+    m_conn->groups |= std::uint64_t(1) << group;
+    return 0;
+  }
+
+  int fd() const override { return m_fd; }
+
+  int sendto(void* buf, std::size_t size) override {
+    ssize_t n = ::send(m_fd, buf, size, MSG_NOSIGNAL);
+    return n < 0 ? -nl_syserr2nlerr(errno) : n;
+  }
+
+  void attach(nl_cb* cb) override { nl_cb_overwrite_recv(cb, fake_recv); }
+};
+
+FakeKernel::FakeKernel(std::uint32_t wiphys) : m_wiphys(wiphys) {
+  m_wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (m_wake_fd < 0)
+    throw std::system_error(errno, std::generic_category(),
+                            "Failed to create fake kernel eventfd");
+
+  m_thread = std::thread(&FakeKernel::run, this);
+}
+
+FakeKernel::~FakeKernel() {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  std::uint64_t one = 1;
+  if (write(m_wake_fd, &one, sizeof(one)) < 0) {
+    // the thread still wakes up on its next event
+  }
+  m_thread.join();
+
+  // sockets still connected see the kernel go away
+  for (auto& conn : m_connections) ::shutdown(conn->fd, SHUT_RDWR);
+  for (auto& conn : m_adopted) ::shutdown(conn->fd, SHUT_RDWR);
+  ::close(m_wake_fd);
+}
+
+transport_factory FakeKernel::factory() {
+  return [this]() { return std::make_unique<FakeTransport>(*this); };
+}
+
+void FakeKernel::adopt(std::shared_ptr<connection> conn) {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_adopted.push_back(std::move(conn));
+  }
+  std::uint64_t one = 1;
+  if (write(m_wake_fd, &one, sizeof(one)) < 0) {
+    // already signaled, the counter is saturated
+  }
+}
+
+void FakeKernel::inject(std::uint32_t if_idx, std::vector<frame> const& frames,
+                        double rate, std::uint64_t count) {
+  if (frames.empty()) throw std::invalid_argument("No frame to inject");
+  for (auto const& f : frames)
+    if (f.size() < FRAME_HEADER_SIZE)
+      throw std::invalid_argument("Frame is shorter than an 802.11 header");
+  if (rate < 0) throw std::invalid_argument("Negative injection rate");
+
+  injection inj;
+  inj.frames = frames;
+  inj.period = rate > 0 ? std::chrono::duration_cast<clock::duration>(
+                              std::chrono::duration<double>(1.0 / rate))
+                        : clock::duration::zero();
+  inj.remaining = count;
+  inj.forever = count == 0;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_injections[if_idx] = std::move(inj);
+  }
+  std::uint64_t one = 1;
+  if (write(m_wake_fd, &one, sizeof(one)) < 0) {
+    // already signaled, the counter is saturated
+  }
+}
+
+void FakeKernel::stop_injecting(std::uint32_t if_idx) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_injections.erase(if_idx);
+}
+
+bool FakeKernel::injecting(std::uint32_t if_idx) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_injections.count(if_idx) != 0;
+}
+
+FakeKernel::stats FakeKernel::get_stats() const {
+  return {m_requests.load(), m_frames_injected.load(), m_frames_dropped.load(),
+          m_frames_sent.load(), m_backlog_max.load()};
+}
+
+void FakeKernel::run() {
+  std::vector<pollfd> pfds;
+  clock::duration sleep = clock::duration::max();
+
+  while (true) {
+    pfds.clear();
+    pfds.push_back({m_wake_fd, POLLIN, 0});
+    for (auto const& conn : m_connections) {
+      short events = POLLIN | (conn->out.empty() ? 0 : POLLOUT);
+      pfds.push_back({conn->fd, events, 0});
+    }
+
+    timespec ts;
+    timespec* timeout = nullptr;
+    if (sleep != clock::duration::max()) {
+      auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(sleep);
+      ts.tv_sec = ns.count() / 1000000000;
+      ts.tv_nsec = ns.count() % 1000000000;
+      timeout = &ts;
+    }
+    if (ppoll(pfds.data(), pfds.size(), timeout, nullptr) < 0 &&
+        errno != EINTR)
+      continue;
+
+    if (pfds[0].revents & POLLIN) {
+      std::uint64_t value;
+      if (read(m_wake_fd, &value, sizeof(value)) < 0) {
+        // spurious wake up
+      }
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if (m_stop) return;
+      for (auto& conn : m_adopted) m_connections.push_back(std::move(conn));
+      m_adopted.clear();
+    }
+
+    // connections adopted above were not polled, they come last
+    for (std::size_t i = 1; i < pfds.size(); ++i) {
+      auto& conn = *m_connections[i - 1];
+      if (pfds[i].revents & POLLIN)
+        receive(conn);
+      else if (pfds[i].revents & (POLLHUP | POLLERR))
+        conn.closed = true;
+    }
+
+    for (auto& conn : m_connections)
+      if (conn->closed) close(*conn);
+    m_connections.erase(
+        std::remove_if(m_connections.begin(), m_connections.end(),
+                       [](auto const& conn) { return conn->closed; }),
+        m_connections.end());
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto now = clock::now();
+    inject_due(now);
+    for (auto& conn : m_connections) flush(*conn);
+    sleep = next_wakeup(now);
+  }
+}
+
+void FakeKernel::receive(connection& conn) {
+  std::vector<std::uint8_t> buffer(RECV_BUFFER_SIZE);
+  while (true) {
+    ssize_t n = ::recv(conn.fd, buffer.data(), buffer.size(),
+                       MSG_DONTWAIT | MSG_TRUNC);
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+    if (n <= 0) {
+      conn.closed = true;
+      return;
+    }
+
+    int len = std::min<std::size_t>(n, buffer.size());
+    for (auto hdr = reinterpret_cast<nlmsghdr*>(buffer.data());
+         nlmsg_ok(hdr, len); hdr = nlmsg_next(hdr, &len)) {
+      if (!(hdr->nlmsg_flags & NLM_F_REQUEST)) continue;
+      ++m_requests;
+      if (conn.protocol == NETLINK_GENERIC)
+        handle_nl80211(conn, hdr);
+      else
+        handle_rtnl(conn, hdr);
+    }
+  }
+}
+
+void FakeKernel::handle_nl80211(connection& conn, nlmsghdr* hdr) {
+  nlattr* tb[NL80211_ATTR_MAX + 1];
+  if (hdr->nlmsg_type != FAMILY_ID || !nlmsg_valid_hdr(hdr, GENL_HDRLEN) ||
+      nlmsg_parse(hdr, GENL_HDRLEN, tb, NL80211_ATTR_MAX, nullptr) < 0) {
+    send(conn, make_status(hdr, -EINVAL));
+    return;
+  }
+
+  auto gnlh = static_cast<genlmsghdr*>(nlmsg_data(hdr));
+  bool dump = (hdr->nlmsg_flags & NLM_F_DUMP) == NLM_F_DUMP;
+  auto find_iface = [this, &tb]() -> iface* {
+    if (tb[NL80211_ATTR_IFINDEX] == nullptr) return nullptr;
+    auto it = m_ifaces.find(nla_get_u32(tb[NL80211_ATTR_IFINDEX]));
+    return it == m_ifaces.end() ? nullptr : &it->second;
+  };
+  auto iface_message = [](nlmsghdr const* req, int flags, std::uint8_t cmd,
+                          iface const& i) {
+    msg_ptr msg = make_genl(req, flags, cmd);
+    nla_put_u32(msg.get(), NL80211_ATTR_IFINDEX, i.index);
+    nla_put_string(msg.get(), NL80211_ATTR_IFNAME, i.name.c_str());
+    nla_put_u32(msg.get(), NL80211_ATTR_WIPHY, i.wiphy);
+    nla_put_u64(msg.get(), NL80211_ATTR_WDEV,
+                (std::uint64_t(i.wiphy) << 32) | i.index);
+    nla_put_u32(msg.get(), NL80211_ATTR_IFTYPE, i.type);
+    nla_put(msg.get(), NL80211_ATTR_MAC, i.mac.size(), i.mac.data());
+    return to_bytes(msg.get());
+  };
+
+  int err = 0;
+  bytes reply;
+  switch (gnlh->cmd) {
+    case NL80211_CMD_GET_WIPHY: {
+      if (dump) {
+        for (std::uint32_t w = 0; w < m_wiphys; ++w)
+          append(reply, make_wiphy(hdr, NLM_F_MULTI, w));
+        append(reply, make_done(hdr));
+        send(conn, std::move(reply));
+        return;
+      }
+      std::uint32_t w = get_u32(tb, NL80211_ATTR_WIPHY, m_wiphys);
+      if (w >= m_wiphys)
+        err = -ENODEV;
+      else
+        append(reply, make_wiphy(hdr, 0, w));
+      break;
+    }
+    case NL80211_CMD_GET_INTERFACE: {
+      if (dump) {
+        for (auto const& [index, i] : m_ifaces)
+          if (tb[NL80211_ATTR_WIPHY] == nullptr ||
+              nla_get_u32(tb[NL80211_ATTR_WIPHY]) == i.wiphy)
+            append(reply,
+                   iface_message(hdr, NLM_F_MULTI, NL80211_CMD_NEW_INTERFACE,
+                                 i));
+        append(reply, make_done(hdr));
+        send(conn, std::move(reply));
+        return;
+      }
+      iface* i = find_iface();
+      if (i == nullptr)
+        err = -ENODEV;
+      else
+        append(reply, iface_message(hdr, 0, NL80211_CMD_NEW_INTERFACE, *i));
+      break;
+    }
+    case NL80211_CMD_NEW_INTERFACE: {
+      std::uint32_t w = get_u32(tb, NL80211_ATTR_WIPHY, m_wiphys);
+      if (w >= m_wiphys) {
+        err = -ENODEV;
+        break;
+      }
+      if (tb[NL80211_ATTR_IFNAME] == nullptr) {
+        err = -EINVAL;
+        break;
+      }
+
+      std::uint32_t index = m_next_ifindex++;
+      iface i = {index,
+                 w,
+                 get_u32(tb, NL80211_ATTR_IFTYPE, NL80211_IFTYPE_STATION),
+                 nla_get_string(tb[NL80211_ATTR_IFNAME]),
+                 {0x02, 0x00, std::uint8_t(w), 0x00, std::uint8_t(index >> 8),
+                  std::uint8_t(index)},
+                 0,
+                 0,
+                 tb[NL80211_ATTR_SOCKET_OWNER] ? &conn : nullptr};
+      m_ifaces[index] = i;
+
+      append(reply, iface_message(hdr, 0, NL80211_CMD_NEW_INTERFACE, i));
+      multicast(NETLINK_GENERIC, CONFIG_GROUP,
+                iface_message(nullptr, 0, NL80211_CMD_NEW_INTERFACE, i));
+      set_link_flags(m_ifaces[index], 0, 0);
+      break;
+    }
+    case NL80211_CMD_SET_INTERFACE: {
+      iface* i = find_iface();
+      if (i == nullptr) {
+        err = -ENODEV;
+        break;
+      }
+      i->type = get_u32(tb, NL80211_ATTR_IFTYPE, i->type);
+      multicast(NETLINK_GENERIC, CONFIG_GROUP,
+                iface_message(nullptr, 0, NL80211_CMD_SET_INTERFACE, *i));
+      break;
+    }
+    case NL80211_CMD_DEL_INTERFACE: {
+      iface* i = find_iface();
+      if (i == nullptr)
+        err = -ENODEV;
+      else
+        remove_iface(i->index);
+      break;
+    }
+    case NL80211_CMD_JOIN_IBSS: {
+      iface* i = find_iface();
+      if (i == nullptr) {
+        err = -ENODEV;
+        break;
+      }
+      if (!(i->flags & IFF_UP)) {
+        err = -ENETDOWN;
+        break;
+      }
+      if (tb[NL80211_ATTR_SSID] == nullptr ||
+          tb[NL80211_ATTR_WIPHY_FREQ] == nullptr) {
+        err = -EINVAL;
+        break;
+      }
+      i->freq = nla_get_u32(tb[NL80211_ATTR_WIPHY_FREQ]);
+
+      msg_ptr event = make_genl(nullptr, 0, NL80211_CMD_JOIN_IBSS);
+      nla_put_u32(event.get(), NL80211_ATTR_WIPHY, i->wiphy);
+      nla_put_u32(event.get(), NL80211_ATTR_IFINDEX, i->index);
+      if (tb[NL80211_ATTR_MAC] != nullptr)
+        nla_put(event.get(), NL80211_ATTR_MAC, nla_len(tb[NL80211_ATTR_MAC]),
+                nla_data(tb[NL80211_ATTR_MAC]));
+      else
+        nla_put(event.get(), NL80211_ATTR_MAC, i->mac.size(), i->mac.data());
+      multicast(NETLINK_GENERIC, MLME_GROUP, to_bytes(event.get()));
+      break;
+    }
+    case NL80211_CMD_REGISTER_FRAME: {
+      iface* i = find_iface();
+      if (i == nullptr) {
+        err = -ENODEV;
+        break;
+      }
+
+      connection::registration r = {i->index, 0x00d0, {}};
+      if (tb[NL80211_ATTR_FRAME_TYPE] != nullptr)
+        r.type = nla_get_u16(tb[NL80211_ATTR_FRAME_TYPE]);
+      if (tb[NL80211_ATTR_FRAME_MATCH] != nullptr) {
+        auto data =
+            static_cast<std::uint8_t*>(nla_data(tb[NL80211_ATTR_FRAME_MATCH]));
+        r.match.assign(data, data + nla_len(tb[NL80211_ATTR_FRAME_MATCH]));
+      }
+      conn.registrations.push_back(std::move(r));
+      break;
+    }
+    case NL80211_CMD_FRAME: {
+      iface* i = find_iface();
+      if (i == nullptr) {
+        err = -ENODEV;
+        break;
+      }
+      if (tb[NL80211_ATTR_FRAME] == nullptr) {
+        err = -EINVAL;
+        break;
+      }
+      ++m_frames_sent;
+
+      // no cookie and no status when the sender does not wait for the ACK
+      if (tb[NL80211_ATTR_DONT_WAIT_FOR_ACK] != nullptr) break;
+
+      std::uint64_t cookie = m_next_cookie++;
+      msg_ptr msg = make_genl(hdr, 0, NL80211_CMD_FRAME);
+      nla_put_u64(msg.get(), NL80211_ATTR_COOKIE, cookie);
+      append(reply, to_bytes(msg.get()));
+
+      msg_ptr event = make_genl(nullptr, 0, NL80211_CMD_FRAME_TX_STATUS);
+      nla_put_u32(event.get(), NL80211_ATTR_WIPHY, i->wiphy);
+      nla_put_u32(event.get(), NL80211_ATTR_IFINDEX, i->index);
+      nla_put_u64(event.get(), NL80211_ATTR_COOKIE, cookie);
+      nla_put(event.get(), NL80211_ATTR_FRAME, nla_len(tb[NL80211_ATTR_FRAME]),
+              nla_data(tb[NL80211_ATTR_FRAME]));
+      nla_put_flag(event.get(), NL80211_ATTR_ACK);
+      multicast(NETLINK_GENERIC, MLME_GROUP, to_bytes(event.get()));
+      break;
+    }
+    case NL80211_CMD_NEW_KEY:
+    case NL80211_CMD_DEL_KEY:
+      if (find_iface() == nullptr) err = -ENODEV;
+      break;
+    default:
+      err = -EOPNOTSUPP;
+      break;
+  }
+
+  if (err != 0)
+    reply = make_status(hdr, err);
+  else if (hdr->nlmsg_flags & NLM_F_ACK)
+    append(reply, make_status(hdr, 0));
+  if (!reply.empty()) send(conn, std::move(reply));
+}
+
+void FakeKernel::handle_rtnl(connection& conn, nlmsghdr* hdr) {
+  if (!nlmsg_valid_hdr(hdr, sizeof(ifinfomsg))) {
+    send(conn, make_status(hdr, -EINVAL));
+    return;
+  }
+
+  auto ifi = static_cast<ifinfomsg*>(nlmsg_data(hdr));
+  auto it = m_ifaces.find(ifi->ifi_index);
+
+  int err = 0;
+  bytes reply;
+  switch (hdr->nlmsg_type) {
+    case RTM_GETLINK: {
+      if ((hdr->nlmsg_flags & NLM_F_DUMP) == NLM_F_DUMP) {
+        err = -EOPNOTSUPP;
+        break;
+      }
+      if (it == m_ifaces.end()) {
+        err = -ENODEV;
+        break;
+      }
+
+      msg_ptr msg = make_msg();
+      nlmsghdr* rh = nlmsg_put(msg.get(), hdr->nlmsg_pid, hdr->nlmsg_seq,
+                               RTM_NEWLINK, sizeof(ifinfomsg), 0);
+      if (rh == nullptr) throw std::bad_alloc();
+      auto r = static_cast<ifinfomsg*>(nlmsg_data(rh));
+      r->ifi_family = AF_UNSPEC;
+      r->ifi_type = ARPHRD_ETHER;
+      r->ifi_index = it->second.index;
+      r->ifi_flags = it->second.flags;
+      nla_put_string(msg.get(), IFLA_IFNAME, it->second.name.c_str());
+      append(reply, to_bytes(msg.get()));
+      break;
+    }
+    case RTM_NEWLINK:
+    case RTM_SETLINK:
+      if (it == m_ifaces.end()) {
+        err = -ENODEV;
+        break;
+      }
+      set_link_flags(it->second, ifi->ifi_flags,
+                     ifi->ifi_change ? ifi->ifi_change : ~0u);
+      break;
+    default:
+      err = -EOPNOTSUPP;
+      break;
+  }
+
+  if (err != 0)
+    reply = make_status(hdr, err);
+  else if (hdr->nlmsg_flags & NLM_F_ACK)
+    append(reply, make_status(hdr, 0));
+  send(conn, std::move(reply));
+}
+
+void FakeKernel::close(connection& conn) {
+  std::vector<std::uint32_t> owned;
+  for (auto const& [index, i] : m_ifaces)
+    if (i.owner == &conn) owned.push_back(index);
+  for (auto index : owned) remove_iface(index);
+
+  conn.out.clear();
+  conn.registrations.clear();
+}
+
+void FakeKernel::remove_iface(std::uint32_t if_idx) {
+  auto it = m_ifaces.find(if_idx);
+  if (it == m_ifaces.end()) return;
+  iface const& i = it->second;
+
+  msg_ptr event = make_genl(nullptr, 0, NL80211_CMD_DEL_INTERFACE);
+  nla_put_u32(event.get(), NL80211_ATTR_IFINDEX, i.index);
+  nla_put_u32(event.get(), NL80211_ATTR_WIPHY, i.wiphy);
+  multicast(NETLINK_GENERIC, CONFIG_GROUP, to_bytes(event.get()));
+
+  msg_ptr link = make_msg();
+  nlmsghdr* hdr =
+      nlmsg_put(link.get(), 0, 0, RTM_DELLINK, sizeof(ifinfomsg), 0);
+  if (hdr == nullptr) throw std::bad_alloc();
+  auto ifi = static_cast<ifinfomsg*>(nlmsg_data(hdr));
+  ifi->ifi_family = AF_UNSPEC;
+  ifi->ifi_type = ARPHRD_ETHER;
+  ifi->ifi_index = i.index;
+  nla_put_string(link.get(), IFLA_IFNAME, i.name.c_str());
+  multicast(NETLINK_ROUTE, RTNLGRP_LINK, to_bytes(link.get()));
+
+  for (auto& conn : m_connections) {
+    auto& regs = conn->registrations;
+    regs.erase(std::remove_if(regs.begin(), regs.end(),
+                              [if_idx](auto const& r) {
+                                return r.if_idx == if_idx;
+                              }),
+               regs.end());
+  }
+  m_ifaces.erase(it);
+}
+
+// Applies an IFF_UP change and notifies the link group, as the kernel does
+// on registration (change of 0) and on every flag change.
+void FakeKernel::set_link_flags(iface& i, unsigned int flags,
+                                unsigned int change) {
+  change &= IFF_UP;
+  unsigned int new_flags = (i.flags & ~change) | (flags & change);
+  bool registration = change == 0;
+  if (!registration && new_flags == i.flags) return;
+  i.flags = new_flags;
+
+  msg_ptr link = make_msg();
+  nlmsghdr* hdr =
+      nlmsg_put(link.get(), 0, 0, RTM_NEWLINK, sizeof(ifinfomsg), 0);
+  if (hdr == nullptr) throw std::bad_alloc();
+  auto ifi = static_cast<ifinfomsg*>(nlmsg_data(hdr));
+  ifi->ifi_family = AF_UNSPEC;
+  ifi->ifi_type = ARPHRD_ETHER;
+  ifi->ifi_index = i.index;
+  ifi->ifi_flags = i.flags;
+  ifi->ifi_change = registration ? ~0u : change;
+  nla_put_string(link.get(), IFLA_IFNAME, i.name.c_str());
+  multicast(NETLINK_ROUTE, RTNLGRP_LINK, to_bytes(link.get()));
+}
+
+void FakeKernel::multicast(int protocol, int group, bytes const& message) {
+  std::uint64_t bit = std::uint64_t(1) << group;
+  for (auto& conn : m_connections)
+    if (!conn->closed && conn->protocol == protocol && (conn->groups & bit))
+      send(*conn, message);
+}
+
+// the first socket registered for the frame, as cfg80211 only reports a
+// received management frame once
+FakeKernel::connection* FakeKernel::frame_receiver(std::uint32_t if_idx,
+                                                   frame const& f) const {
+  std::uint16_t type = f[0] & FRAME_TYPE_MASK;
+  for (auto const& conn : m_connections) {
+    if (conn->closed) continue;
+    for (auto const& r : conn->registrations)
+      if (r.if_idx == if_idx && r.type == type &&
+          f.size() >= FRAME_HEADER_SIZE + r.match.size() &&
+          std::equal(r.match.begin(), r.match.end(),
+                     f.begin() + FRAME_HEADER_SIZE))
+        return conn.get();
+  }
+  return nullptr;
+}
+
+void FakeKernel::inject_due(clock::time_point now) {
+  for (auto it = m_injections.begin(); it != m_injections.end();) {
+    std::uint32_t if_idx = it->first;
+    injection& inj = it->second;
+    auto iface_it = m_ifaces.find(if_idx);
+    if (iface_it == m_ifaces.end()) {
+      ++it;
+      continue;
+    }
+
+    if (!inj.started) {
+      if (frame_receiver(if_idx, inj.frames[inj.next]) == nullptr) {
+        ++it;
+        continue;
+      }
+
+      iface const& i = iface_it->second;
+      for (auto const& f : inj.frames) {
+        msg_ptr event = make_genl(nullptr, 0, NL80211_CMD_FRAME);
+        nla_put_u32(event.get(), NL80211_ATTR_WIPHY, i.wiphy);
+        nla_put_u32(event.get(), NL80211_ATTR_IFINDEX, i.index);
+        nla_put_u64(event.get(), NL80211_ATTR_WDEV,
+                    (std::uint64_t(i.wiphy) << 32) | i.index);
+        nla_put_u32(event.get(), NL80211_ATTR_WIPHY_FREQ,
+                    i.freq ? i.freq : 2412);
+        nla_put_u32(event.get(), NL80211_ATTR_RX_SIGNAL_DBM, -40);
+        nla_put(event.get(), NL80211_ATTR_FRAME, f.size(), f.data());
+        inj.events.push_back(to_bytes(event.get()));
+      }
+      inj.started = true;
+      inj.due = now;
+    }
+
+    bool paced = inj.period != clock::duration::zero();
+    while (inj.forever || inj.remaining > 0) {
+      if (paced && inj.due > now) break;
+
+      connection* conn = frame_receiver(if_idx, inj.frames[inj.next]);
+      if (!paced && (conn == nullptr || conn->out.size() >= INJECT_BATCH))
+        break;
+
+      if (conn != nullptr) {
+        send(*conn, inj.events[inj.next]);
+        ++m_frames_injected;
+      } else {
+        ++m_frames_dropped;
+      }
+
+      inj.next = (inj.next + 1) % inj.frames.size();
+      if (!inj.forever) --inj.remaining;
+      inj.due += inj.period;
+    }
+
+    if (!inj.forever && inj.remaining == 0)
+      it = m_injections.erase(it);
+    else
+      ++it;
+  }
+}
+
+FakeKernel::clock::duration FakeKernel::next_wakeup(
+    clock::time_point now) const {
+  auto sleep = clock::duration::max();
+  for (auto const& [if_idx, inj] : m_injections) {
+    if (!inj.started) continue;
+    if (inj.period != clock::duration::zero()) {
+      sleep = std::min(sleep, std::max(inj.due - now, clock::duration::zero()));
+      continue;
+    }
+
+    // unpaced: top the receiver up again once it drained its queue, a full
+    // queue wakes the loop up through POLLOUT instead
+    connection* conn = frame_receiver(if_idx, inj.frames[inj.next]);
+    if (conn != nullptr && conn->out.empty()) sleep = clock::duration::zero();
+  }
+  return sleep;
+}
+
+void FakeKernel::send(connection& conn, bytes message) {
+  if (conn.closed) return;
+  conn.out.push_back(std::move(message));
+
+  std::uint64_t backlog = conn.out.size();
+  std::uint64_t max = m_backlog_max.load(std::memory_order_relaxed);
+  while (backlog > max && !m_backlog_max.compare_exchange_weak(max, backlog)) {
+  }
+}
+
+void FakeKernel::flush(connection& conn) {
+  while (!conn.out.empty()) {
+    bytes const& message = conn.out.front();
+    ssize_t n = ::send(conn.fd, message.data(), message.size(),
+                       MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+    if (n < 0) {
+      conn.closed = true;
+      conn.out.clear();
+      return;
+    }
+    conn.out.pop_front();
+  }
+}
+}  // namespace streetpass::nl80211
@@ -45,6 +45,8 @@ Message::Message(nl80211_commands cmd, int driver_id, int flags)
 Attributes::Attributes(nl_msg* nlmsg) {
   if (nlmsg == nullptr) throw std::invalid_argument("Message pointer is null");
   genlmsghdr* gnlh = static_cast<genlmsghdr*>(nlmsg_data(nlmsg_hdr(nlmsg)));
+  m_cmd = gnlh->cmd;
+  m_seq = nlmsg_hdr(nlmsg)->nlmsg_seq;
 
   nlattr* current_attr = nullptr;
   int rem = 0;
@@ -134,6 +136,7 @@ template class Attribute<bool>;
 template class Attribute<std::uint8_t>;
 template class Attribute<std::uint16_t>;
 template class Attribute<std::uint32_t>;
+template class Attribute<std::uint64_t>;
 template class Attribute<std::string>;
 template class Attribute<std::vector<std::uint8_t>>;
 template class Attribute<std::vector<std::uint16_t>>;
@@ -1,30 +1,95 @@
 #include "nl80211/socket.hpp"
 
+#include <poll.h>
+
 #include <chrono>
+#include <map>
+#include <system_error>
 
+#include "metrics/registry.hpp"
 #include "nl80211/error.hpp"
 #include "nl80211/message.hpp"
 
 namespace streetpass::nl80211 {
 
-Socket::Socket() : m_nlsock(nl_socket_alloc(), nl_socket_free) {
+namespace {
+metrics::Counter &messages_received() {
+  static auto &counter = metrics::registry().counter(
+      "streetpass_netlink_messages_received_total",
+      "Netlink messages handed to a receive callback.");
+  return counter;
+}
+
+// called from libnl callbacks, must not throw
+void count_error(int nlerr) noexcept {
+  try {
+    // resolve each error code once per thread, not on every reply
+    thread_local std::map<int, metrics::Counter *> counters;
+    auto &counter = counters[nlerr];
+    if (counter == nullptr)
+      counter = &metrics::registry().counter(
+          "streetpass_netlink_errors_total",
+          "Error replies received from the kernel, by libnl error.",
+          {{"error", nl_geterror(nlerr)}});
+    counter->inc();
+  } catch (...) {
+  }
+}
+}  // namespace
+
+Socket::Socket() : Socket(make_transport()) {}
+
+Socket::Socket(std::unique_ptr<Transport> transport)
+    : m_nlsock(nl_socket_alloc(), nl_socket_free),
+      m_transport(std::move(transport)) {
+  // register outside of the libnl callbacks, where throwing is not an option
+  messages_received();
+
   if (m_nlsock.get() == nullptr) {
     throw std::bad_alloc();
   }
 
-  int res = genl_connect(m_nlsock.get());
+  int res = m_transport->connect(m_nlsock.get(), NETLINK_GENERIC);
   if (res < 0) {
     throw NlError(res, "Failed to connect socket");
   }
 
-  m_driver_id = genl_ctrl_resolve(m_nlsock.get(), "nl80211");
+  m_driver_id = m_transport->resolve_family("nl80211");
   if (m_driver_id < 0) {
-    throw NlError(res, "Failed to resolve nl80211 family");
+    throw NlError(m_driver_id, "Failed to resolve nl80211 family");
   }
 }
 
+nl_cb *Socket::alloc_cb() const {
+  nl_cb *cb = nl_cb_alloc(NL_CB_DEFAULT);
+  if (cb == nullptr) throw std::bad_alloc();
+
+  m_transport->attach(cb);
+  return cb;
+}
+
 int Socket::get_driver_id() const { return m_driver_id; }
 
+int Socket::get_fd() const { return m_transport->fd(); }
+
+void Socket::add_membership(std::string const &group) {
+  int group_id = m_transport->resolve_group("nl80211", group);
+  if (group_id < 0)
+    throw NlError(group_id, "Failed to resolve nl80211 multicast group");
+
+  int res = m_transport->add_membership(group_id);
+  if (res < 0) throw NlError(res, "Failed to join nl80211 multicast group");
+}
+
+bool Socket::wait_readable(std::chrono::milliseconds timeout) const {
+  pollfd pfd = {get_fd(), POLLIN, 0};
+  int ret = poll(&pfd, 1, timeout.count());
+  if (ret < 0 && errno != EINTR)
+    throw std::system_error(errno, std::generic_category());
+
+  return ret > 0;
+}
+
 void Socket::send_message(Message &msg) {
   int ret;
   try {
@@ -38,6 +103,73 @@ void Socket::send_message(Message &msg) {
   if (ret < 0) throw NlError(ret, "Failed to send message");
 }
 
+std::uint32_t Socket::send_async(Message &msg) {
+  int ret = nl_send_auto(m_nlsock.get(), msg.m_nl_msg.get());
+  if (ret < 0) throw NlError(ret, "Failed to send message");
+
+  return nlmsg_hdr(msg.m_nl_msg.get())->nlmsg_seq;
+}
+
+std::vector<int> Socket::send_batch(
+    std::vector<std::unique_ptr<Message>> const &msgs) {
+  std::vector<int> results(msgs.size(), 0);
+  if (msgs.empty()) return results;
+
+  std::vector<std::uint8_t> buffer;
+  std::map<std::uint32_t, std::size_t> pending;
+  for (std::size_t i = 0; i < msgs.size(); ++i) {
+    nl_msg *msg = msgs[i]->m_nl_msg.get();
+    nl_complete_msg(m_nlsock.get(), msg);
+    nlmsghdr *hdr = nlmsg_hdr(msg);
+    auto data = reinterpret_cast<std::uint8_t *>(hdr);
+    buffer.insert(buffer.end(), data, data + hdr->nlmsg_len);
+    buffer.resize(NLMSG_ALIGN(buffer.size()), 0);
+    pending[hdr->nlmsg_seq] = i;
+  }
+
+  int res = m_transport->sendto(buffer.data(), buffer.size());
+  if (res < 0) throw NlError(res, "Failed to send message batch");
+
+  struct state {
+    std::map<std::uint32_t, std::size_t> &pending;
+    std::vector<int> &results;
+  } st = {pending, results};
+
+  auto ack_handler = [](nl_msg *nlmsg, void *arg) -> int {
+    auto st = static_cast<state *>(arg);
+    st->pending.erase(nlmsg_hdr(nlmsg)->nlmsg_seq);
+    return NL_OK;
+  };
+
+  auto error_handler = [](sockaddr_nl *, nlmsgerr *err, void *arg) -> int {
+    auto st = static_cast<state *>(arg);
+    auto it = st->pending.find(err->msg.nlmsg_seq);
+    if (it == st->pending.end()) return NL_SKIP;
+
+    st->results[it->second] = -nl_syserr2nlerr(err->error);
+    count_error(st->results[it->second]);
+    st->pending.erase(it);
+    return NL_SKIP;
+  };
+
+  // multicast notifications may be interleaved with the ACKs
+  auto no_seq_check = [](nl_msg *, void *) -> int { return NL_OK; };
+
+  nl_cb *cb = alloc_cb();
+
+  nl_cb_err(cb, NL_CB_CUSTOM, error_handler, &st);
+  nl_cb_set(cb, NL_CB_ACK, NL_CB_CUSTOM, ack_handler, &st);
+  nl_cb_set(cb, NL_CB_SEQ_CHECK, NL_CB_CUSTOM, no_seq_check, nullptr);
+
+  res = 0;
+  while (!pending.empty() && res >= 0) res = nl_recvmsgs(m_nlsock.get(), cb);
+
+  nl_cb_put(cb);
+  if (res < 0) throw NlError(res, "Failed to receive batch acknowledgements");
+
+  return results;
+}
+
 namespace {
 int finish_handler(nl_msg *, void *arg) {
   int *ret = static_cast<int *>(arg);
@@ -54,13 +186,42 @@ int ack_handler(nl_msg *, void *arg) {
 int error_handler(sockaddr_nl *, nlmsgerr *err, void *arg) {
   int *ret = static_cast<int *>(arg);
   *ret = -nl_syserr2nlerr(err->error);
+  count_error(*ret);
   return NL_STOP;
 }
+
+struct status_report {
+  std::function<void(std::uint32_t, int)> &on_status;
+  std::exception_ptr &ex;
+  bool &stop;
+};
+
+int report_status(status_report *st, std::uint32_t seq, int err) {
+  try {
+    st->on_status(seq, err);
+    return NL_OK;
+  } catch (...) {
+    st->ex = std::current_exception();
+    st->stop = true;
+    return NL_STOP;
+  }
+}
+
+int status_ack_handler(nl_msg *nlmsg, void *arg) {
+  return report_status(static_cast<status_report *>(arg),
+                       nlmsg_hdr(nlmsg)->nlmsg_seq, 0);
+}
+
+int status_error_handler(sockaddr_nl *, nlmsgerr *err, void *arg) {
+  int nlerr = -nl_syserr2nlerr(err->error);
+  count_error(nlerr);
+  return report_status(static_cast<status_report *>(arg), err->msg.nlmsg_seq,
+                       nlerr);
+}
 }  // namespace
 
 void Socket::recv_messages() {
-  nl_cb *cb = nl_cb_alloc(NL_CB_DEFAULT);
-  if (cb == nullptr) throw std::bad_alloc();
+  nl_cb *cb = alloc_cb();
 
   int err = 1;
 
@@ -84,8 +245,7 @@ void Socket::recv_messages() {
 void Socket::recv_messages(std::function<bool(Attributes &, void *)> callback,
                            void *arg, bool disable_seq_check,
                            unsigned int timeout) {
-  nl_cb *cb = nl_cb_alloc(NL_CB_DEFAULT);
-  if (cb == nullptr) throw std::bad_alloc();
+  nl_cb *cb = alloc_cb();
 
   std::exception_ptr ex;
   int err = 1;
@@ -106,6 +266,7 @@ void Socket::recv_messages(std::function<bool(Attributes &, void *)> callback,
   };
 
   auto valid_handler = [](nl_msg *nlmsg, void *arg) {
+    messages_received().inc();
     return (*static_cast<decltype(recv_msg_cb) *>(arg))(nlmsg);
   };
 
@@ -139,4 +300,56 @@ void Socket::recv_messages(std::function<bool(Attributes &, void *)> callback,
   if (ex) std::rethrow_exception(ex);
   if (err < 0) throw NlError(err, "An error occured while receiving messages");
 }
+
+// Processes every message already queued on the socket without blocking,
+// meant for multicast event sockets where no ACK ever ends the exchange.
+void Socket::recv_pending(std::function<bool(Attributes &, void *)> callback,
+                          void *arg) {
+  recv_pending(callback, nullptr, arg);
+}
+
+void Socket::recv_pending(std::function<bool(Attributes &, void *)> callback,
+                          std::function<void(std::uint32_t, int)> on_status,
+                          void *arg) {
+  nl_cb *cb = alloc_cb();
+
+  std::exception_ptr ex;
+  bool stop = false;
+
+  auto recv_msg_cb = [callback, arg, &ex, &stop](nl_msg *nlmsg) -> int {
+    Attributes msg_attrs(nlmsg);
+    try {
+      stop = !callback(msg_attrs, arg);
+      return stop ? NL_STOP : NL_OK;
+    } catch (...) {
+      ex = std::current_exception();
+      stop = true;
+      return NL_STOP;
+    }
+  };
+
+  status_report st = {on_status, ex, stop};
+
+  auto valid_handler = [](nl_msg *nlmsg, void *arg) {
+    messages_received().inc();
+    return (*static_cast<decltype(recv_msg_cb) *>(arg))(nlmsg);
+  };
+
+  auto no_seq_check = [](nl_msg *, void *) -> int { return NL_OK; };
+
+  nl_cb_set(cb, NL_CB_SEQ_CHECK, NL_CB_CUSTOM, no_seq_check, nullptr);
+  nl_cb_set(cb, NL_CB_VALID, NL_CB_CUSTOM, valid_handler, &recv_msg_cb);
+  if (on_status) {
+    nl_cb_set(cb, NL_CB_ACK, NL_CB_CUSTOM, status_ack_handler, &st);
+    nl_cb_err(cb, NL_CB_CUSTOM, status_error_handler, &st);
+  }
+
+  int res = 0;
+  while (!stop && res >= 0 && wait_readable(std::chrono::milliseconds(0)))
+    res = nl_recvmsgs(m_nlsock.get(), cb);
+
+  nl_cb_put(cb);
+  if (ex) std::rethrow_exception(ex);
+  if (res < 0) throw NlError(res, "Failed to receive pending messages");
+}
 }  // namespace streetpass::nl80211
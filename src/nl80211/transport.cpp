@@ -0,0 +1,58 @@
+#include "nl80211/transport.hpp"
+
+#include <netlink/genl/ctrl.h>
+#include <netlink/genl/genl.h>
+
+#include <mutex>
+
+namespace streetpass::nl80211 {
+
+namespace {
+class KernelTransport : public Transport {
+ private:
+  nl_sock* m_sock = nullptr;
+
+ public:
+  int connect(nl_sock* sock, int protocol) override {
+    m_sock = sock;
+    return nl_connect(m_sock, protocol);
+  }
+
+  int resolve_family(std::string const& family) override {
+    return genl_ctrl_resolve(m_sock, family.c_str());
+  }
+
+  int resolve_group(std::string const& family,
+                    std::string const& group) override {
+    return genl_ctrl_resolve_grp(m_sock, family.c_str(), group.c_str());
+  }
+
+  int add_membership(int group) override {
+    return nl_socket_add_membership(m_sock, group);
+  }
+
+  int fd() const override { return nl_socket_get_fd(m_sock); }
+
+  int sendto(void* buf, std::size_t size) override {
+    return nl_sendto(m_sock, buf, size);
+  }
+
+  // libnl reads from the socket itself
+  void attach(nl_cb*) override {}
+};
+
+std::mutex factory_mutex;
+transport_factory factory;
+}  // namespace
+
+void set_transport_factory(transport_factory f) {
+  std::lock_guard<std::mutex> lock(factory_mutex);
+  factory = std::move(f);
+}
+
+std::unique_ptr<Transport> make_transport() {
+  std::lock_guard<std::mutex> lock(factory_mutex);
+  if (factory) return factory();
+  return std::make_unique<KernelTransport>();
+}
+}  // namespace streetpass::nl80211
@@ -0,0 +1,135 @@
+#include "nl80211/tx_queue.hpp"
+
+#include <netlink/errno.h>
+
+#include <memory>
+#include <stdexcept>
+
+#include "nl80211/error.hpp"
+#include "nl80211/message.hpp"
+
+namespace streetpass::nl80211 {
+
+TxQueue::TxQueue(std::uint32_t if_idx, std::uint32_t freq,
+                 std::size_t max_in_flight,
+                 std::chrono::milliseconds status_timeout)
+    : m_if_idx(if_idx),
+      m_freq(freq),
+      m_max_in_flight(max_in_flight),
+      m_status_timeout(status_timeout) {
+  if (max_in_flight == 0)
+    throw std::invalid_argument("At least one frame must be in flight");
+
+  m_nlsock.add_membership("mlme");
+}
+
+void TxQueue::submit(std::vector<std::uint8_t> frame, callback done) {
+  m_backlog.push_back({std::move(frame), std::move(done), {}});
+  flush();
+}
+
+std::future<TxQueue::tx_status> TxQueue::submit(
+    std::vector<std::uint8_t> frame) {
+  auto promise = std::make_shared<std::promise<tx_status>>();
+  submit(std::move(frame),
+         [promise](tx_status const& status) { promise->set_value(status); });
+  return promise->get_future();
+}
+
+void TxQueue::complete(request& req, tx_status const& status) {
+  m_completed.emplace_back(std::move(req.done), status);
+}
+
+void TxQueue::flush() {
+  while (in_flight() < m_max_in_flight && !m_backlog.empty()) {
+    request req = std::move(m_backlog.front());
+    m_backlog.pop_front();
+
+    try {
+      Message msg(NL80211_CMD_FRAME, m_nlsock.get_driver_id());
+      msg.put(NL80211_ATTR_IFINDEX, m_if_idx);
+      msg.put(NL80211_ATTR_WIPHY_FREQ, m_freq);
+      msg.put(NL80211_ATTR_FRAME, req.frame);
+
+      std::uint32_t seq = m_nlsock.send_async(msg);
+      req.sent = clock::now();
+      m_awaiting_cookie.emplace(seq, std::move(req));
+    } catch (NlError& e) {
+      complete(req, {0, false, e.code()});
+    }
+  }
+}
+
+void TxQueue::process() {
+  auto handler = [this](Attributes& msg_attrs, void*) {
+    if (msg_attrs.command() == NL80211_CMD_FRAME) {
+      // reply to one of our requests, carrying the cookie
+      auto it = m_awaiting_cookie.find(msg_attrs.sequence());
+      if (it == m_awaiting_cookie.end() ||
+          msg_attrs.find(NL80211_ATTR_COOKIE) == nullptr)
+        return true;
+
+      auto cookie = msg_attrs.get<std::uint64_t>(NL80211_ATTR_COOKIE).value();
+      auto early = m_early_status.find(cookie);
+      if (early != m_early_status.end()) {
+        complete(it->second, {cookie, early->second.acked, 0});
+        m_early_status.erase(early);
+      } else {
+        m_awaiting_status.emplace(cookie, std::move(it->second));
+      }
+      m_awaiting_cookie.erase(it);
+    } else if (msg_attrs.command() == NL80211_CMD_FRAME_TX_STATUS) {
+      // other sockets' frames are reported on the same group
+      if (msg_attrs.find(NL80211_ATTR_COOKIE) == nullptr) return true;
+      auto cookie = msg_attrs.get<std::uint64_t>(NL80211_ATTR_COOKIE).value();
+      bool acked = msg_attrs.find(NL80211_ATTR_ACK) != nullptr;
+      auto it = m_awaiting_status.find(cookie);
+      if (it != m_awaiting_status.end()) {
+        complete(it->second, {it->first, acked, 0});
+        m_awaiting_status.erase(it);
+      } else if (!m_awaiting_cookie.empty()) {
+        // fast radios may report the frame before the cookie reply reaches
+        // us, keep the status until the reply or the timeout
+        m_early_status.emplace(cookie, early_status{acked, clock::now()});
+      }
+    }
+    return true;
+  };
+
+  auto on_status = [this](std::uint32_t seq, int err) {
+    auto it = m_awaiting_cookie.find(seq);
+    if (it == m_awaiting_cookie.end()) return;
+
+    // an ACK still waiting for its cookie means the frame got no reply
+    complete(it->second, {0, false, err});
+    m_awaiting_cookie.erase(it);
+  };
+
+  m_nlsock.recv_pending(handler, on_status, nullptr);
+
+  auto limit = clock::now() - m_status_timeout;
+  for (auto it = m_awaiting_status.begin(); it != m_awaiting_status.end();) {
+    if (it->second.sent < limit) {
+      complete(it->second, {it->first, false, -NLE_AGAIN});
+      it = m_awaiting_status.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  // statuses of other sockets' frames never get a reply here
+  for (auto it = m_early_status.begin(); it != m_early_status.end();) {
+    if (it->second.received < limit)
+      it = m_early_status.erase(it);
+    else
+      ++it;
+  }
+
+  flush();
+
+  // callbacks may submit more frames, only run them once the state is settled
+  auto completed = std::move(m_completed);
+  m_completed.clear();
+  for (auto& [done, status] : completed)
+    if (done) done(status);
+}
+}  // namespace streetpass::nl80211
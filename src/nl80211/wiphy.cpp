@@ -0,0 +1,136 @@
+#include "nl80211/wiphy.hpp"
+
+#include <algorithm>
+
+#include "nl80211/message.hpp"
+
+namespace streetpass::nl80211 {
+
+namespace {
+constexpr std::uint32_t IEEE_CIPHER_OUI = 0x000fac00;
+}  // namespace
+
+WiphyCapabilities::WiphyCapabilities(Attributes const& msg_attrs)
+    : m_cmds_offset(keep(msg_attrs, NL80211_ATTR_SUPPORTED_COMMANDS)),
+      m_iftypes_offset(keep(msg_attrs, NL80211_ATTR_SUPPORTED_IFTYPES)),
+      m_ciphers_offset(keep(msg_attrs, NL80211_ATTR_CIPHER_SUITES)),
+      m_bands_offset(keep(msg_attrs, NL80211_ATTR_WIPHY_BANDS)) {}
+
+std::size_t WiphyCapabilities::keep(Attributes const& msg_attrs, int attr) {
+  nlattr* attr_ptr = msg_attrs.find(attr);
+  if (attr_ptr == nullptr) return NOT_PRESENT;
+
+  std::size_t offset = m_raw.size();
+  auto data = reinterpret_cast<std::uint8_t*>(attr_ptr);
+  m_raw.insert(m_raw.end(), data, data + nla_total_size(nla_len(attr_ptr)));
+  return offset;
+}
+
+nlattr* WiphyCapabilities::raw(std::size_t offset) const {
+  auto data = const_cast<std::uint8_t*>(m_raw.data()) + offset;
+  return reinterpret_cast<nlattr*>(data);
+}
+
+void WiphyCapabilities::decode(field f) const {
+  if (m_decoded & f) return;
+
+  nlattr* current_attr = nullptr;
+  int rem = 0;
+
+  switch (f) {
+    case COMMANDS:
+      if (m_cmds_offset == NOT_PRESENT) break;
+      nla_for_each_nested(current_attr, raw(m_cmds_offset), rem) {
+        std::uint32_t cmd = nla_get_u32(current_attr);
+        if (cmd < m_cmds.size()) m_cmds.set(cmd);
+      }
+      break;
+    case IFTYPES:
+      if (m_iftypes_offset == NOT_PRESENT) break;
+      nla_for_each_nested(current_attr, raw(m_iftypes_offset), rem) {
+        int iftype = nla_type(current_attr);
+        if (static_cast<std::size_t>(iftype) < m_iftypes.size())
+          m_iftypes.set(iftype);
+      }
+      break;
+    case CIPHERS: {
+      if (m_ciphers_offset == NOT_PRESENT) break;
+      nlattr* ciphers = raw(m_ciphers_offset);
+      auto suites = static_cast<std::uint32_t*>(nla_data(ciphers));
+      int count = nla_len(ciphers) / sizeof(std::uint32_t);
+      for (int i = 0; i < count; i++) {
+        std::uint32_t suite = suites[i];
+        std::uint32_t suite_type = suite & 0xff;
+        if ((suite & ~0xffu) == IEEE_CIPHER_OUI &&
+            suite_type < m_ieee_ciphers.size())
+          m_ieee_ciphers.set(suite_type);
+        else
+          m_other_ciphers.push_back(suite);
+      }
+      break;
+    }
+    case BANDS: {
+      if (m_bands_offset == NOT_PRESENT) break;
+      // decoded aside, so that a malformed band leaves nothing behind and
+      // the next access retries
+      std::vector<band> decoded;
+      Attributes bands(raw(m_bands_offset));
+      for (auto id : bands.types()) {
+        struct band b = {};
+
+        auto band_attrs = bands.get<Attributes>(id).value();
+        auto freqs =
+            band_attrs.get<Attributes>(NL80211_BAND_ATTR_FREQS).value();
+        for (auto id : freqs.types()) {
+          auto freq_attrs = freqs.get<Attributes>(id).value();
+          auto freq_value =
+              freq_attrs.get<std::uint32_t>(NL80211_FREQUENCY_ATTR_FREQ)
+                  .value();
+          b.freqs.insert(freq_value);
+        }
+
+        auto rates =
+            band_attrs.get<Attributes>(NL80211_BAND_ATTR_RATES).value();
+        for (auto id : rates.types()) {
+          auto rate_attrs = rates.get<Attributes>(id).value();
+          auto rate_value =
+              rate_attrs.get<std::uint32_t>(NL80211_BITRATE_ATTR_RATE).value();
+          b.bitrates.insert(0.1f * rate_value);
+        }
+
+        decoded.push_back(b);
+      }
+      m_bands.swap(decoded);
+      break;
+    }
+  }
+
+  m_decoded |= f;
+}
+
+bool WiphyCapabilities::supports_command(std::uint32_t cmd) const {
+  decode(COMMANDS);
+  return cmd < m_cmds.size() && m_cmds.test(cmd);
+}
+
+bool WiphyCapabilities::supports_iftype(std::uint32_t iftype) const {
+  decode(IFTYPES);
+  return iftype < m_iftypes.size() && m_iftypes.test(iftype);
+}
+
+bool WiphyCapabilities::supports_cipher(std::uint32_t cipher) const {
+  decode(CIPHERS);
+  std::uint32_t suite_type = cipher & 0xff;
+  if ((cipher & ~0xffu) == IEEE_CIPHER_OUI &&
+      suite_type < m_ieee_ciphers.size())
+    return m_ieee_ciphers.test(suite_type);
+
+  return std::find(m_other_ciphers.begin(), m_other_ciphers.end(), cipher) !=
+         m_other_ciphers.end();
+}
+
+std::vector<band> const& WiphyCapabilities::bands() const {
+  decode(BANDS);
+  return m_bands;
+}
+}  // namespace streetpass::nl80211
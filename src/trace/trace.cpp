@@ -0,0 +1,216 @@
+#include "trace/trace.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <system_error>
+
+namespace streetpass::trace {
+
+namespace {
+constexpr char MAGIC[8] = {'S', 'P', 'T', 'R', 'A', 'C', 'E', '\0'};
+constexpr std::uint32_t VERSION = 1;
+
+// host endianness, dumps are decoded on the machine that wrote them
+struct file_header {
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t event_size;
+  std::uint32_t ring_count;
+  std::uint32_t padding;
+  // two (ticks, ns) samples to convert timestamps
+  std::uint64_t base_ticks;
+  std::uint64_t base_ns;
+  std::uint64_t dump_ticks;
+  std::uint64_t dump_ns;
+};
+
+struct ring_header {
+  std::uint32_t thread_index;
+  std::uint32_t event_count;
+};
+
+std::uint64_t steady_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+struct state {
+  std::mutex mutex;
+  std::vector<std::unique_ptr<Ring>> rings;
+  std::uint64_t base_ticks = ticks();
+  std::uint64_t base_ns = steady_ns();
+};
+
+state& global() {
+  // never destroyed: threads may still record during static destruction
+  static state* s = new state();
+  return *s;
+}
+}  // namespace
+
+const char* stage_name(stage s) noexcept {
+  switch (s) {
+    case stage::RECEIVED:
+      return "received";
+    case stage::CLASSIFIED:
+      return "classified";
+    case stage::PARSED:
+      return "parsed";
+    case stage::MATCHED:
+      return "matched";
+    case stage::DELIVERED:
+      return "delivered";
+    case stage::TX_DONE:
+      return "tx_done";
+    default:
+      return "unknown";
+  }
+}
+
+const char* parse_result_name(std::int32_t r) noexcept {
+  switch (r) {
+    case PARSE_OK:
+      return "ok";
+    case NO_VENDOR_ELEMENT:
+      return "no vendor specific element";
+    case BAD_VENDOR_DATA:
+      return "bad vendor specific data";
+    case BAD_MODULE_FILTER:
+      return "bad module filter";
+    default:
+      return "unknown";
+  }
+}
+
+std::vector<event> Ring::snapshot() const {
+  std::uint64_t end = m_head.load(std::memory_order_acquire);
+  std::array<event, CAPACITY> copy = m_events;
+  // keeps the copy from being reordered after the head read below
+  std::atomic_thread_fence(std::memory_order_acquire);
+  std::uint64_t head = m_head.load(std::memory_order_relaxed);
+
+  // slots rewritten during the copy, plus the one possibly being written
+  std::uint64_t begin = head + 1 > CAPACITY ? head + 1 - CAPACITY : 0;
+
+  std::vector<event> events;
+  events.reserve(end > begin ? end - begin : 0);
+  for (std::uint64_t i = begin; i < end; ++i) {
+    event const& e = copy[i & (CAPACITY - 1)];
+    if (e.sequence == static_cast<std::uint32_t>(i)) events.push_back(e);
+  }
+  return events;
+}
+
+Ring& thread_ring() {
+  auto& s = global();
+  std::lock_guard<std::mutex> lock(s.mutex);
+  s.rings.push_back(std::make_unique<Ring>(s.rings.size()));
+  return *s.rings.back();
+}
+
+void dump(std::string const& path) {
+  auto& s = global();
+
+  file_header header = {};
+  std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.version = VERSION;
+  header.event_size = sizeof(event);
+  header.base_ticks = s.base_ticks;
+  header.base_ns = s.base_ns;
+  header.dump_ticks = ticks();
+  header.dump_ns = steady_ns();
+
+  std::vector<std::pair<std::uint32_t, std::vector<event>>> snapshots;
+  {
+    std::lock_guard<std::mutex> lock(s.mutex);
+    for (auto const& ring : s.rings)
+      snapshots.emplace_back(ring->thread_index(), ring->snapshot());
+  }
+  header.ring_count = snapshots.size();
+
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  for (auto const& [thread_index, events] : snapshots) {
+    ring_header rh = {thread_index, static_cast<std::uint32_t>(events.size())};
+    file.write(reinterpret_cast<const char*>(&rh), sizeof(rh));
+    file.write(reinterpret_cast<const char*>(events.data()),
+               events.size() * sizeof(event));
+  }
+
+  file.flush();
+  if (!file)
+    throw std::system_error(errno, std::generic_category(),
+                            "Failed to write trace to " + path);
+}
+
+void dump_on_exit(std::string const& path) {
+  static std::string* exit_path = nullptr;
+  if (exit_path != nullptr) {
+    *exit_path = path;
+    return;
+  }
+
+  global();
+  exit_path = new std::string(path);
+  std::atexit([] {
+    try {
+      dump(*exit_path);
+    } catch (...) {
+      // nothing left to report to at exit
+    }
+  });
+}
+
+std::vector<decoded_event> load(std::string const& path) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file)
+    throw std::system_error(errno, std::generic_category(),
+                            "Failed to open " + path);
+
+  file_header header;
+  if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+      std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0)
+    throw std::runtime_error(path + " is not a trace dump");
+  if (header.version != VERSION || header.event_size != sizeof(event))
+    throw std::runtime_error(path + " has an unsupported trace format");
+
+  double ns_per_tick =
+      header.dump_ticks > header.base_ticks
+          ? double(header.dump_ns - header.base_ns) /
+                double(header.dump_ticks - header.base_ticks)
+          : 1.0;
+
+  std::vector<decoded_event> decoded;
+  for (std::uint32_t r = 0; r < header.ring_count; ++r) {
+    ring_header rh;
+    if (!file.read(reinterpret_cast<char*>(&rh), sizeof(rh)))
+      throw std::runtime_error(path + " is truncated");
+
+    std::vector<event> events(rh.event_count);
+    if (!file.read(reinterpret_cast<char*>(events.data()),
+                   events.size() * sizeof(event)))
+      throw std::runtime_error(path + " is truncated");
+
+    for (auto const& e : events) {
+      double elapsed =
+          (double(e.timestamp) - double(header.base_ticks)) * ns_per_tick;
+      decoded.push_back({rh.thread_index,
+                         header.base_ns + static_cast<std::int64_t>(elapsed),
+                         e});
+    }
+  }
+
+  std::stable_sort(decoded.begin(), decoded.end(),
+                   [](decoded_event const& a, decoded_event const& b) {
+                     return a.ns < b.ns;
+                   });
+  return decoded;
+}
+}  // namespace streetpass::trace
@@ -0,0 +1,109 @@
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <initializer_list>
+#include <iostream>
+#include <vector>
+
+#include "crypto/ccmp.hpp"
+
+using namespace streetpass;
+using crypto::CcmpEngine;
+using crypto::ccmp_frame;
+
+namespace {
+// IEEE 802.11 CCMP test vector (802.11i-2004 H.7.1, kept as 802.11-2016
+// J.6.4), without the FCS
+const std::array<std::uint8_t, 16> TK = {0xc9, 0x7c, 0x1f, 0x67, 0xce, 0x37,
+                                         0x11, 0x85, 0x51, 0x4a, 0x8a, 0x19,
+                                         0xf2, 0xbd, 0xd5, 0x2f};
+const std::uint64_t PN = 0xb5039776e70c;
+
+const std::vector<std::uint8_t> MAC_HEADER = {
+    0x08, 0x48, 0xc3, 0x2c, 0x0f, 0xd2, 0xe1, 0x28, 0xa5, 0x7c, 0x50, 0x30,
+    0xf1, 0x84, 0x44, 0x08, 0xab, 0xae, 0xa5, 0xb8, 0xfc, 0xba, 0x80, 0x33};
+const std::vector<std::uint8_t> CCMP_HEADER = {0x0c, 0xe7, 0x00, 0x20,
+                                               0x76, 0x97, 0x03, 0xb5};
+const std::vector<std::uint8_t> PLAINTEXT = {
+    0xf8, 0xba, 0x1a, 0x55, 0xd0, 0x2f, 0x85, 0xae, 0x96, 0x7b,
+    0xb6, 0x2f, 0xb6, 0xcd, 0xa8, 0xeb, 0x7e, 0x78, 0xa0, 0x50};
+const std::vector<std::uint8_t> CIPHERTEXT = {
+    0xf3, 0xd0, 0xa2, 0xfe, 0x9a, 0x3d, 0xbf, 0x23, 0x42, 0xa6,
+    0x43, 0xe4, 0x32, 0x46, 0xe8, 0x0c, 0x3c, 0x04, 0xd0, 0x19};
+const std::vector<std::uint8_t> MIC = {0x78, 0x45, 0xce, 0x0b,
+                                       0x16, 0xf9, 0x76, 0x23};
+
+std::vector<std::uint8_t> concat(
+    std::initializer_list<std::vector<std::uint8_t>> parts) {
+  std::vector<std::uint8_t> res;
+  for (auto const& p : parts) res.insert(res.end(), p.begin(), p.end());
+  return res;
+}
+
+const std::vector<std::uint8_t> PROTECTED =
+    concat({MAC_HEADER, CCMP_HEADER, CIPHERTEXT, MIC});
+
+ccmp_frame make_frame(std::vector<std::uint8_t>& data) {
+  return {data.data(), data.size(), 0, 0, false};
+}
+
+int failures = 0;
+
+void check(bool ok, const char* what) {
+  std::cout << (ok ? "ok    " : "FAIL  ") << what << std::endl;
+  if (!ok) ++failures;
+}
+}  // namespace
+
+// Runs the CCMP engine against the 802.11 test vector, exits non-zero if any
+// case fails.
+int main() {
+  CcmpEngine engine(TK);
+
+  {
+    std::vector<std::uint8_t> data = concat(
+        {MAC_HEADER, std::vector<std::uint8_t>(CcmpEngine::HEADER_SIZE),
+         PLAINTEXT, std::vector<std::uint8_t>(CcmpEngine::MIC_SIZE)});
+    ccmp_frame f = make_frame(data);
+    f.pn = PN;
+    f.key_id = 0;
+    check(engine.encrypt(f) && f.valid, "encrypt succeeds");
+    check(data == PROTECTED, "encrypt matches the vector");
+  }
+
+  {
+    std::vector<std::uint8_t> data = PROTECTED;
+    ccmp_frame f = make_frame(data);
+    check(engine.decrypt(f) && f.valid, "decrypt authenticates");
+    check(f.pn == PN && f.key_id == 0, "decrypt reads the PN and key id");
+    check(std::equal(PLAINTEXT.begin(), PLAINTEXT.end(),
+                     data.begin() + MAC_HEADER.size() +
+                         CcmpEngine::HEADER_SIZE),
+          "decrypt recovers the plaintext");
+  }
+
+  {
+    std::vector<std::uint8_t> data = PROTECTED;
+    data.back() ^= 0x01;
+    std::vector<std::uint8_t> tampered = data;
+    ccmp_frame f = make_frame(data);
+    check(!engine.decrypt(f) && !f.valid, "decrypt rejects a bad MIC");
+    check(data == tampered, "a rejected frame keeps its ciphertext");
+  }
+
+  {
+    // the lock-step path, with the bad frame in the middle of the batch
+    std::vector<std::vector<std::uint8_t>> data(5, PROTECTED);
+    data[2][MAC_HEADER.size() + CcmpEngine::HEADER_SIZE] ^= 0x80;
+    std::vector<ccmp_frame> frames;
+    for (auto& d : data) frames.push_back(make_frame(d));
+    check(engine.decrypt_many(frames) == 4 && !frames[2].valid,
+          "decrypt_many authenticates all but the tampered frame");
+    check(std::equal(PLAINTEXT.begin(), PLAINTEXT.end(),
+                     data[4].begin() + MAC_HEADER.size() +
+                         CcmpEngine::HEADER_SIZE),
+          "decrypt_many recovers the plaintext");
+  }
+
+  return failures ? 1 : 0;
+}
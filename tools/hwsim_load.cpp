@@ -0,0 +1,386 @@
+#include <tins/tins.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cec/module_filter.hpp"
+#include "iface/physical.hpp"
+#include "iface/streetpass.hpp"
+#include "metrics/histogram.hpp"
+#include "nl80211/tx_queue.hpp"
+
+using namespace streetpass;
+using iface::PhysicalInterface;
+using iface::StreetpassInterface;
+using clock_type = std::chrono::steady_clock;
+
+namespace {
+// titles the generated module filters pick from, small enough for the
+// consoles of a crowd to share some
+const std::vector<std::uint32_t> TITLE_POOL = {
+    0x00020800, 0x00030700, 0x00031400, 0x00033600,
+    0x00034100, 0x00035200, 0x00042000, 0x00055d00,
+};
+
+struct options {
+  unsigned radios = 8;
+  unsigned scanners = 2;
+  unsigned seconds = 5;
+  double rate = 100;  // probe requests per second and sender
+  bool load_module = true;
+  // pass criteria of every step
+  double max_drop = 100;  // percent
+  bool all_discovered = false;
+};
+
+struct sender_result {
+  Tins::HWAddress<6> mac;
+  clock_type::time_point start;
+  std::uint64_t submitted = 0;
+  std::uint64_t sent = 0;
+  std::uint64_t failed = 0;
+};
+
+struct peer_seen {
+  clock_type::time_point first;
+  std::uint64_t frames = 0;
+};
+
+struct scanner_result {
+  std::map<Tins::HWAddress<6>, peer_seen> peers;
+  std::uint64_t matched = 0;
+};
+
+void usage(const char* argv0) {
+  std::cerr << "usage: " << argv0
+            << " [-r radios] [-s scanners] [-d seconds] [-p rate] [-k]"
+               " [-m max drop] [-a]\n"
+               "  -r  mac80211_hwsim radios to create (default 8)\n"
+               "  -s  radios scanning, the others send (default 2)\n"
+               "  -d  duration of every step in seconds (default 5)\n"
+               "  -p  probe requests per second and sender (default 100)\n"
+               "  -k  keep the loaded module instead of reloading it\n"
+               "  -m  fail a step dropping more than this percentage of the\n"
+               "      frames sent (default 100)\n"
+               "  -a  fail a step where a scanner missed a sender\n"
+               "exits with 2 when a step fails"
+            << std::endl;
+}
+
+bool is_hwsim(PhysicalInterface const& phys) {
+  std::error_code ec;
+  auto device = std::filesystem::canonical(
+      "/sys/class/ieee80211/" + phys.get_name() + "/device", ec);
+  return !ec && device.string().find("hwsim") != std::string::npos;
+}
+
+std::vector<PhysicalInterface> find_hwsim_radios(unsigned count) {
+  auto deadline = clock_type::now() + std::chrono::seconds(5);
+  std::vector<PhysicalInterface> res;
+  do {
+    res = PhysicalInterface::find_all_supported();
+    res.erase(std::remove_if(res.begin(), res.end(),
+                             [](auto const& x) { return !is_hwsim(x); }),
+              res.end());
+    if (res.size() >= count) break;
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  } while (clock_type::now() < deadline);
+
+  return res;
+}
+
+cec::ModuleFilter make_module_filter(std::mt19937& rng, unsigned titles) {
+  using TitleFilter = cec::ModuleFilter::TitleFilter;
+
+  cec::key_type console_id;
+  for (auto& b : console_id) b = rng();
+  cec::ModuleFilter filter(console_id);
+
+  std::vector<std::uint32_t> ids = TITLE_POOL;
+  std::shuffle(ids.begin(), ids.end(), rng);
+  std::vector<TitleFilter> filters;
+  for (unsigned i = 0; i < titles; ++i)
+    filters.emplace_back(ids[i], cec::SendMode::SEND_RECV,
+                         std::vector<TitleFilter::MVE>{});
+  filter.title_filters().filters(filters);
+  return filter;
+}
+
+std::vector<std::uint8_t> make_probereq(Tins::HWAddress<6> const& addr,
+                                        cec::ModuleFilter const& filter) {
+  cec::bytes module_filter_bytes = cec::bytes(filter);
+  cec::bytes vendor_specific_data;
+  vendor_specific_data.push_back(0x01);
+  vendor_specific_data.insert(vendor_specific_data.end(),
+                              module_filter_bytes.begin(),
+                              module_filter_bytes.end());
+
+  Tins::Dot11ProbeRequest probereq(Tins::HWAddress<6>::broadcast, addr);
+  probereq.ssid(StreetpassInterface::SSID);
+  probereq.supported_rates(StreetpassInterface::SUPPORTED_RATES);
+  probereq.vendor_specific(Tins::Dot11ManagementFrame::vendor_specific_type(
+      StreetpassInterface::OUI, vendor_specific_data));
+  return probereq.serialize();
+}
+
+// Sends the probe requests of one simulated console at a fixed rate until
+// the deadline, then waits a little for the last transmit statuses.
+void run_sender(StreetpassInterface& iface, std::vector<std::uint8_t> frame,
+                double rate, clock_type::time_point deadline,
+                sender_result& res) {
+  nl80211::TxQueue tx(iface.get_id(), StreetpassInterface::CHANNEL_FREQ);
+  auto done = [&res](nl80211::TxQueue::tx_status const& status) {
+    ++(status.error == 0 ? res.sent : res.failed);
+  };
+
+  auto period = std::chrono::duration_cast<clock_type::duration>(
+      std::chrono::duration<double>(1 / rate));
+  res.start = clock_type::now();
+  auto due = res.start;
+  while (clock_type::now() < deadline) {
+    for (auto now = clock_type::now(); due <= now; due += period) {
+      tx.submit(frame, done);
+      ++res.submitted;
+    }
+    auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::min(due, deadline) - clock_type::now());
+    if (tx.wait_readable(std::max(wait, std::chrono::milliseconds(0))))
+      tx.process();
+  }
+
+  auto drain = clock_type::now() + std::chrono::milliseconds(500);
+  while ((tx.in_flight() || tx.backlog()) && clock_type::now() < drain)
+    if (tx.wait_readable(std::chrono::milliseconds(50))) tx.process();
+  tx.process();
+}
+
+void run_scanner(StreetpassInterface& iface, unsigned timeout_ms,
+                 cec::ModuleFilter const& own, scanner_result& res) {
+  iface.scan_with_cb(timeout_ms, [&](Tins::HWAddress<6> const& addr,
+                                     cec::ModuleFilter const& other) {
+    auto now = clock_type::now();
+    auto [it, inserted] = res.peers.try_emplace(addr);
+    if (inserted) it->second.first = now;
+    ++it->second.frames;
+    res.matched += own.match(other);
+    return true;
+  });
+}
+
+// One step of the sweep: every scanner listens while the sending consoles
+// walk by, then the sent and received counts are compared. Returns whether
+// the step meets the pass criteria.
+bool run_step(std::vector<StreetpassInterface*> const& scanners,
+              std::vector<StreetpassInterface*> const& senders,
+              options const& opts, std::mt19937& rng) {
+  std::vector<scanner_result> scanned(scanners.size());
+  std::vector<sender_result> sent(senders.size());
+  cec::ModuleFilter own = make_module_filter(rng, 1);
+
+  auto duration = std::chrono::seconds(opts.seconds);
+  // the scanners register for probe requests before anything is sent, and
+  // keep listening for the frames still queued at the deadline
+  auto lead = std::chrono::milliseconds(200);
+  auto tail = std::chrono::milliseconds(500);
+  unsigned timeout_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                            lead + duration + tail)
+                            .count();
+
+  std::vector<std::thread> threads;
+  for (std::size_t i = 0; i < scanners.size(); ++i)
+    threads.emplace_back(run_scanner, std::ref(*scanners[i]), timeout_ms,
+                         std::cref(own), std::ref(scanned[i]));
+
+  std::this_thread::sleep_for(lead);
+  auto deadline = clock_type::now() + duration;
+  for (std::size_t i = 0; i < senders.size(); ++i) {
+    sent[i].mac = senders[i]->get_mac_addr();
+    auto filter = make_module_filter(rng, 1 + rng() % 3);
+    threads.emplace_back(run_sender, std::ref(*senders[i]),
+                         make_probereq(sent[i].mac, filter), opts.rate,
+                         deadline, std::ref(sent[i]));
+  }
+  for (auto& t : threads) t.join();
+
+  std::uint64_t submitted = 0, transmitted = 0, failed = 0;
+  for (auto const& s : sent) {
+    submitted += s.submitted;
+    transmitted += s.sent;
+    failed += s.failed;
+  }
+
+  metrics::Histogram latency_us;
+  std::uint64_t received = 0, matched = 0, undiscovered = 0;
+  for (auto const& sc : scanned) {
+    matched += sc.matched;
+    for (auto const& s : sent) {
+      auto it = sc.peers.find(s.mac);
+      if (it == sc.peers.end()) {
+        ++undiscovered;
+        continue;
+      }
+      received += it->second.frames;
+      latency_us.record(std::chrono::duration_cast<std::chrono::microseconds>(
+                            it->second.first - s.start)
+                            .count());
+    }
+  }
+
+  std::uint64_t expected = transmitted * scanners.size();
+  double drop = expected ? 1 - double(received) / expected : 0;
+  double fps = double(received) / opts.seconds;
+
+  std::cout << std::setw(7) << senders.size() << std::setw(10) << submitted
+            << std::setw(10) << transmitted << std::setw(8) << failed
+            << std::setw(10) << received << std::setw(10) << std::fixed
+            << std::setprecision(0) << fps << std::setw(8)
+            << std::setprecision(2) << drop * 100 << "%" << std::setw(10)
+            << latency_us.percentile(50) << std::setw(10)
+            << latency_us.percentile(99) << std::setw(10) << latency_us.max()
+            << std::setw(8) << undiscovered << std::setw(10) << matched
+            << std::endl;
+
+  bool passed = true;
+  if (drop * 100 > opts.max_drop) {
+    std::cerr << "FAIL: " << drop * 100 << "% dropped, at most "
+              << opts.max_drop << "% allowed" << std::endl;
+    passed = false;
+  }
+  if (opts.all_discovered && undiscovered != 0) {
+    std::cerr << "FAIL: " << undiscovered
+              << " scanner and sender pairs never discovered" << std::endl;
+    passed = false;
+  }
+  return passed;
+}
+}  // namespace
+
+// Loads mac80211_hwsim with the requested number of radios, sets up a
+// StreetPass interface on each, then grows a crowd of sending radios step by
+// step while the scanning ones report what they discovered. Needs the
+// rights to load kernel modules and create interfaces.
+int main(int argc, char** argv) {
+  options opts;
+  int opt;
+  while ((opt = getopt(argc, argv, "r:s:d:p:km:ah")) != -1) {
+    switch (opt) {
+      case 'r':
+        opts.radios = std::strtoul(optarg, nullptr, 10);
+        break;
+      case 's':
+        opts.scanners = std::strtoul(optarg, nullptr, 10);
+        break;
+      case 'd':
+        opts.seconds = std::strtoul(optarg, nullptr, 10);
+        break;
+      case 'p':
+        opts.rate = std::strtod(optarg, nullptr);
+        break;
+      case 'k':
+        opts.load_module = false;
+        break;
+      case 'm':
+        opts.max_drop = std::strtod(optarg, nullptr);
+        break;
+      case 'a':
+        opts.all_discovered = true;
+        break;
+      case 'h':
+        usage(argv[0]);
+        return 0;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+  if (optind != argc || opts.scanners == 0 ||
+      opts.radios <= opts.scanners || opts.seconds == 0 || opts.rate <= 0 ||
+      opts.max_drop < 0) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  if (opts.load_module) {
+    if (std::system("modprobe -r mac80211_hwsim 2>/dev/null") != 0) {
+      // not loaded yet
+    }
+    auto cmd =
+        "modprobe mac80211_hwsim radios=" + std::to_string(opts.radios);
+    if (std::system(cmd.c_str()) != 0) {
+      std::cerr << "Could not load mac80211_hwsim" << std::endl;
+      return 1;
+    }
+  }
+
+  std::vector<std::unique_ptr<StreetpassInterface>> ifaces;
+  try {
+    auto radios = find_hwsim_radios(opts.radios);
+    if (radios.size() < opts.radios) {
+      std::cerr << "Only " << radios.size()
+                << " supported mac80211_hwsim radios found" << std::endl;
+      return 1;
+    }
+    radios.erase(radios.begin() + opts.radios, radios.end());
+
+    std::vector<std::future<std::unique_ptr<StreetpassInterface>>> pending;
+    for (auto const& phys : radios)
+      pending.push_back(phys.setup_streetpass_interface_async(
+          "sphwsim" + std::to_string(phys.get_id())));
+
+    metrics::Histogram ready_us;
+    for (auto& f : pending) {
+      ifaces.push_back(f.get());
+      ready_us.record(std::chrono::duration_cast<std::chrono::microseconds>(
+                          ifaces.back()->ready_latency())
+                          .count());
+    }
+    std::cout << ifaces.size() << " interfaces ready, setup p50 "
+              << ready_us.percentile(50) << "us max " << ready_us.max()
+              << "us" << std::endl;
+  } catch (std::exception& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+
+  std::vector<StreetpassInterface*> scanners;
+  std::vector<StreetpassInterface*> senders;
+  for (auto& i : ifaces)
+    (scanners.size() < opts.scanners ? scanners : senders).push_back(i.get());
+
+  std::cout << std::setw(7) << "senders" << std::setw(10) << "submitted"
+            << std::setw(10) << "sent" << std::setw(8) << "failed"
+            << std::setw(10) << "received" << std::setw(10) << "rx/s"
+            << std::setw(9) << "drop" << std::setw(10) << "p50 us"
+            << std::setw(10) << "p99 us" << std::setw(10) << "max us"
+            << std::setw(8) << "missed" << std::setw(10) << "matched"
+            << std::endl;
+
+  // senders double every step until the whole crowd sends
+  std::mt19937 rng(std::random_device{}());
+  bool passed = true;
+  try {
+    for (std::size_t crowd = 1;; crowd = std::min(crowd * 2, senders.size())) {
+      passed &= run_step(scanners, {senders.begin(), senders.begin() + crowd},
+                         opts, rng);
+      if (crowd == senders.size()) break;
+    }
+  } catch (std::exception& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+
+  return passed ? 0 : 2;
+}
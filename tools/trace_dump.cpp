@@ -0,0 +1,62 @@
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "trace/trace.hpp"
+
+using namespace streetpass;
+
+namespace {
+std::string format_mac(std::array<std::uint8_t, 6> const& mac) {
+  std::stringstream ss;
+  ss << std::hex << std::setfill('0');
+  for (std::size_t i = 0; i < mac.size(); ++i)
+    ss << (i ? ":" : "") << std::setw(2) << unsigned(mac[i]);
+  return ss.str();
+}
+
+void usage(const char* argv0) {
+  std::cerr << "usage: " << argv0 << " <trace file> [peer mac]" << std::endl;
+}
+}  // namespace
+
+// Prints the events of a trace dump in time order, optionally only those of
+// one peer, e.g. to follow where its probe requests were dropped.
+int main(int argc, char** argv) {
+  if (argc < 2 || argc > 3 || std::strcmp(argv[1], "-h") == 0) {
+    usage(argv[0]);
+    return argc == 2 ? 0 : 1;
+  }
+
+  std::string peer = argc == 3 ? argv[2] : "";
+  for (auto& c : peer) c = std::tolower(static_cast<unsigned char>(c));
+
+  std::vector<trace::decoded_event> events;
+  try {
+    events = trace::load(argv[1]);
+  } catch (std::exception& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+
+  std::uint64_t start = events.empty() ? 0 : events.front().ns;
+  for (auto const& d : events) {
+    std::string mac = format_mac(d.e.mac);
+    if (!peer.empty() && mac != peer) continue;
+
+    std::cout << std::fixed << std::setprecision(3) << "+" << std::setw(14)
+              << (d.ns - start) / 1000.0 << "us  thread " << d.thread_index
+              << "  #" << std::left << std::setw(8) << d.e.sequence << " "
+              << std::setw(10) << trace::stage_name(d.e.where) << std::right
+              << " " << mac << "  result=" << d.e.result;
+    if (d.e.where == trace::stage::PARSED)
+      std::cout << " (" << trace::parse_result_name(d.e.result) << ")";
+    std::cout << std::endl;
+  }
+
+  return 0;
+}